@@ -0,0 +1,147 @@
+/**
+ * @brief Microbenchmark dell'hashtable dei nickname (hashtable.h) contro
+ *        icl_hash
+ *
+ * Misura il tempo medio di inserimento e di ricerca (di chiavi presenti e
+ * assenti) con nickname sintetici simili fra loro, come "user0001", e il
+ * tempo di inserimento con INSERT_THREADS thread che registrano insieme. Le
+ * ricerche avvengono in ordine casuale, e icl_hash viene usata come faceva
+ * hashtable.c prima (chiave copiata e nickname_t allocato ad ogni
+ * inserimento), così i tempi sono confrontabili.
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "hashtable.h"
+#include "icl_hash.h"
+
+#define DEFAULT_KEYS 100000
+#define LOOKUP_ROUNDS 10
+#define KEY_FORMAT "user%07d"
+#define INSERT_THREADS 4
+
+/**
+ * Chiavi inserite da un thread del test di inserimento concorrente
+ */
+typedef struct inserter_arg {
+	htable_t* ht;
+	char (*keys)[MAX_NAME_LENGTH + 1];
+	int first, n;
+} inserter_arg_t;
+
+static void* inserter(void* arg) {
+	inserter_arg_t* a = arg;
+	for (int i = a->first; i < a->first + a->n; ++i)
+		ts_hash_insert(a->ht, a->keys[2 * i]);
+	return NULL;
+}
+
+static double now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Stampa il tempo medio per operazione in nanosecondi
+ */
+static void report(const char* table, const char* op, double start, long nops) {
+	printf("%-10s %-16s %8.1f ns/op\n", table, op, (now() - start) * 1e9 / nops);
+}
+
+int main(int argc, char** argv) {
+	int nkeys = argc > 1 ? atoi(argv[1]) : DEFAULT_KEYS;
+	// le chiavi presenti sono quelle pari, quelle dispari servono per le
+	// ricerche che falliscono
+	char (*keys)[MAX_NAME_LENGTH + 1] = malloc(2 * nkeys * sizeof(*keys));
+	for (int i = 0; i < 2 * nkeys; ++i)
+		snprintf(keys[i], MAX_NAME_LENGTH + 1, KEY_FORMAT, i);
+	long found = 0;
+	double start;
+
+	int* order = malloc(nkeys * sizeof(int));
+	for (int i = 0; i < nkeys; ++i)
+		order[i] = i;
+	srand(1);
+	for (int i = nkeys - 1; i > 0; --i) {
+		int j = rand() % (i + 1);
+		int tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	printf("%d chiavi\n", nkeys);
+
+	htable_t* ht = hash_create(64, 1);
+	start = now();
+	for (int i = 0; i < nkeys; ++i)
+		ts_hash_insert(ht, keys[2 * i]);
+	report("htable", "inserimento", start, nkeys);
+	start = now();
+	for (int r = 0; r < LOOKUP_ROUNDS; ++r)
+		for (int i = 0; i < nkeys; ++i)
+			found += hash_find(ht, keys[2 * order[i]]) != NULL;
+	report("htable", "ricerca presenti", start, (long)LOOKUP_ROUNDS * nkeys);
+	start = now();
+	for (int r = 0; r < LOOKUP_ROUNDS; ++r)
+		for (int i = 0; i < nkeys; ++i)
+			found += hash_find(ht, keys[2 * order[i] + 1]) != NULL;
+	report("htable", "ricerca assenti", start, (long)LOOKUP_ROUNDS * nkeys);
+	ts_hash_destroy(ht);
+
+	// molte registrazioni insieme, ogni thread con chiavi sue
+	ht = hash_create(64, 1);
+	pthread_t tids[INSERT_THREADS];
+	inserter_arg_t args[INSERT_THREADS];
+	start = now();
+	for (int t = 0; t < INSERT_THREADS; ++t) {
+		args[t].ht = ht;
+		args[t].keys = keys;
+		args[t].first = t * (nkeys / INSERT_THREADS);
+		args[t].n = nkeys / INSERT_THREADS;
+		pthread_create(&tids[t], NULL, &inserter, &args[t]);
+	}
+	for (int t = 0; t < INSERT_THREADS; ++t)
+		pthread_join(tids[t], NULL);
+	report("htable", "inserimento MT", start, nkeys / INSERT_THREADS * INSERT_THREADS);
+	ts_hash_destroy(ht);
+
+	// icl_hash con il numero di bucket che usava il server
+	icl_hash_t* icl = icl_hash_create(100000, NULL, NULL);
+	start = now();
+	for (int i = 0; i < nkeys; ++i)
+		icl_hash_insert(icl, strdup(keys[2 * i]), create_nickname(1));
+	report("icl_hash", "inserimento", start, nkeys);
+	start = now();
+	for (int r = 0; r < LOOKUP_ROUNDS; ++r)
+		for (int i = 0; i < nkeys; ++i)
+			found += icl_hash_find(icl, keys[2 * order[i]]) != NULL;
+	report("icl_hash", "ricerca presenti", start, (long)LOOKUP_ROUNDS * nkeys);
+	start = now();
+	for (int r = 0; r < LOOKUP_ROUNDS; ++r)
+		for (int i = 0; i < nkeys; ++i)
+			found += icl_hash_find(icl, keys[2 * order[i] + 1]) != NULL;
+	report("icl_hash", "ricerca assenti", start, (long)LOOKUP_ROUNDS * nkeys);
+	icl_hash_destroy(icl, &free, &free_nickname);
+
+	if (found != 2L * LOOKUP_ROUNDS * nkeys) {
+		fprintf(stderr, "Errore: trovate %ld chiavi invece di %ld\n", found, 2L * LOOKUP_ROUNDS * nkeys);
+		return EXIT_FAILURE;
+	}
+	free(keys);
+	free(order);
+	return 0;
+}
@@ -0,0 +1,126 @@
+/**
+ * @brief Microbenchmark delle funzioni di hash per i nickname
+ *
+ * Confronta hash_pjw (quella predefinita di icl_hash) con strhash su alcuni
+ * insiemi di nickname sintetici: per ognuno inserisce le chiavi in una
+ * icl_hash con un bucket per chiave, stampa la distribuzione delle lunghezze
+ * delle liste di trabocco e misura quante ricerche al secondo riesce a fare.
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "icl_hash.h"
+#include "strhash.h"
+
+#define LOOKUP_ROUNDS 10
+#define MAX_CHAIN_HIST 8 /**< le liste più lunghe finiscono nell'ultima
+                              colonna */
+
+typedef char key_t[MAX_NAME_LENGTH + 1];
+
+static double now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Inserisce le chiavi in una icl_hash con la funzione data, ne stampa
+ * la distribuzione e misura le ricerche
+ *
+ * @param name il nome della funzione da stampare
+ * @param fun la funzione di hash (NULL per hash_pjw)
+ * @param keys le chiavi
+ * @param order l'ordine in cui cercarle
+ * @param nkeys il numero di chiavi
+ */
+static void run(const char* name, unsigned int (*fun)(void*), key_t* keys, int* order, int nkeys) {
+	icl_hash_t* ht = icl_hash_create(nkeys, fun, NULL);
+	for (int i = 0; i < nkeys; ++i)
+		icl_hash_insert(ht, keys[i], keys[i]);
+
+	long hist[MAX_CHAIN_HIST + 1] = { 0 };
+	int max_chain = 0;
+	long probes = 0;
+	for (int b = 0; b < ht->nbuckets; ++b) {
+		int len = 0;
+		for (icl_entry_t* e = ht->buckets[b]; e != NULL; e = e->next)
+			++len;
+		++hist[len < MAX_CHAIN_HIST ? len : MAX_CHAIN_HIST];
+		if (len > max_chain)
+			max_chain = len;
+		// trovare il k-esimo elemento di una lista costa k confronti
+		probes += (long)len * (len + 1) / 2;
+	}
+
+	long found = 0;
+	double start = now();
+	for (int r = 0; r < LOOKUP_ROUNDS; ++r)
+		for (int i = 0; i < nkeys; ++i)
+			found += icl_hash_find(ht, keys[order[i]]) != NULL;
+	double elapsed = now() - start;
+	if (found != (long)LOOKUP_ROUNDS * nkeys) {
+		fprintf(stderr, "Errore: chiavi non trovate con %s\n", name);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("  %-8s max %3d  confronti medi %5.2f  Mricerche/s %6.2f  liste:",
+	       name, max_chain, (double)probes / nkeys, LOOKUP_ROUNDS * nkeys / elapsed / 1e6);
+	for (int l = 0; l <= MAX_CHAIN_HIST; ++l)
+		printf(" %s%d:%ld", l == MAX_CHAIN_HIST ? ">=" : "", l, hist[l]);
+	printf("\n");
+	icl_hash_destroy(ht, NULL, NULL);
+}
+
+int main(int argc, char** argv) {
+	const int nkeys = argc > 1 ? atoi(argv[1]) : 100000;
+	key_t* keys = malloc(nkeys * sizeof(key_t));
+	int* order = malloc(nkeys * sizeof(int));
+	for (int i = 0; i < nkeys; ++i)
+		order[i] = i;
+	srand(1);
+	for (int i = nkeys - 1; i > 0; --i) {
+		int j = rand() % (i + 1);
+		int tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	const char* formats[] = { "user%04d", "user%07d", "giocatore_numero_%d", "%d" };
+	for (int f = 0; f < sizeof(formats) / sizeof(formats[0]) + 1; ++f) {
+		if (f < sizeof(formats) / sizeof(formats[0])) {
+			printf("%d chiavi \"%s\"\n", nkeys, formats[f]);
+			for (int i = 0; i < nkeys; ++i)
+				snprintf(keys[i], MAX_NAME_LENGTH + 1, formats[f], i);
+		}
+		else {
+			// nickname casuali di lunghezza tra 4 e MAX_NAME_LENGTH
+			printf("%d chiavi casuali\n", nkeys);
+			for (int i = 0; i < nkeys; ++i) {
+				int len = 4 + rand() % (MAX_NAME_LENGTH - 3);
+				for (int c = 0; c < len; ++c)
+					keys[i][c] = 'a' + rand() % 26;
+				keys[i][len] = '\0';
+			}
+		}
+		run("hash_pjw", NULL, keys, order, nkeys);
+		run("strhash", &strhash, keys, order, nkeys);
+	}
+
+	free(keys);
+	free(order);
+	return 0;
+}
@@ -0,0 +1,59 @@
+/**
+ * @file broadcast.c
+ * @brief Implementazione di broadcast.h
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+
+#include "broadcast.h"
+
+// ------- Funzioni esportate --------------
+// Documentate in broadcast.h
+
+int create_bcast_log(bcast_log_t* log, int size) {
+	log->entries = malloc(size * sizeof(message_t));
+	log->seqs = malloc(size * sizeof(unsigned long));
+	if (log->entries == NULL || log->seqs == NULL) {
+		free(log->entries);
+		free(log->seqs);
+		return -1;
+	}
+	log->size = size;
+	log->count = 0;
+	pthread_mutex_init(&(log->mutex), NULL);
+	return 0;
+}
+
+void clear_bcast_log(bcast_log_t* log) {
+	long stored = log->count < log->size ? log->count : log->size;
+	for (long k = 0; k < stored; ++k) {
+		msgbuf_unref(log->entries[(log->count - 1 - k) % log->size].data.buf);
+	}
+	free(log->entries);
+	free(log->seqs);
+	pthread_mutex_destroy(&(log->mutex));
+}
+
+void bcast_append(bcast_log_t* log, message_t msg, unsigned long seq) {
+	int pos = log->count % log->size;
+	if (log->count >= log->size) {
+		msgbuf_unref(log->entries[pos].data.buf);
+	}
+	log->entries[pos] = msg;
+	log->seqs[pos] = seq;
+	++log->count;
+}
+
+message_t* bcast_nth(bcast_log_t* log, int k, unsigned long* seq) {
+	if (k >= log->count || k >= log->size) {
+		return NULL;
+	}
+	int pos = (log->count - 1 - k) % log->size;
+	*seq = log->seqs[pos];
+	return log->entries + pos;
+}
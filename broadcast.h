@@ -0,0 +1,93 @@
+/**
+ * @file broadcast.h
+ * @brief Libreria per il registro dei messaggi inviati a tutti
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+#ifndef CHATTERBOX_BROADCAST_H_
+#define CHATTERBOX_BROADCAST_H_
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "lock.h"
+#include "message.h"
+#include "msgbuf.h"
+
+/**
+ * @struct bcast_log
+ * @brief Registro circolare degli ultimi messaggi inviati con POSTTXTALL_OP
+ *
+ * Un messaggio a tutti viene inserito una sola volta qui invece che
+ * nell'history di ogni nickname; ogni nickname ricorda da quale numero di
+ * sequenza in poi i messaggi a tutti lo riguardano (vedere
+ * nickname::bcast_cursor), e GETPREVMSGS_OP li unisce alla sua history al
+ * momento della lettura. Basta conservarne tanti quanti ne contiene una
+ * history, perché quelli più vecchi non verrebbero comunque restituiti.
+ *
+ * I numeri di sequenza vengono dallo stesso contatore usato per le history, così
+ * i due elenchi si possono unire in ordine. bcast_append e bcast_nth vanno
+ * chiamate con la lock presa.
+ *
+ * @var struct bcast_log::mutex Lock del registro
+ * @var struct bcast_log::entries Array circolare dei messaggi (i buffer sono
+ *                                msgbuf_t)
+ * @var struct bcast_log::seqs Numero di sequenza di ogni messaggio
+ * @var struct bcast_log::size Dimensione di entries
+ * @var struct bcast_log::count Numero di messaggi inseriti da sempre
+ */
+typedef struct bcast_log {
+	pthread_mutex_t mutex;
+	message_t* entries;
+	unsigned long* seqs;
+	int size;
+	long count;
+} bcast_log_t;
+
+/**
+ * @brief Inizializza un registro vuoto
+ *
+ * @param log Il registro da inizializzare
+ * @param size Il numero di messaggi da conservare
+ * @return 0 in caso di successo, < 0 se non c'è abbastanza memoria
+ */
+int create_bcast_log(bcast_log_t* log, int size);
+
+/**
+ * @brief Libera la memoria occupata da un registro e rilascia i buffer dei
+ * messaggi che conteneva
+ *
+ * @param log Il registro da eliminare
+ */
+void clear_bcast_log(bcast_log_t* log);
+
+/**
+ * @brief Inserisce un messaggio nel registro, eliminando il più vecchio se è
+ * pieno
+ *
+ * Il registro prende il riferimento al buffer di chi chiama, come
+ * add_to_history.
+ *
+ * @param log Il registro
+ * @param msg Il messaggio da inserire
+ * @param seq Il numero di sequenza del messaggio, maggiore di quelli già
+ *            inseriti
+ */
+void bcast_append(bcast_log_t* log, message_t msg, unsigned long seq);
+
+/**
+ * @brief Restituisce uno dei messaggi conservati, a partire dal più recente
+ *
+ * @param log Il registro
+ * @param k Quanti messaggi più recenti saltare (0 per il più recente)
+ * @param seq Puntatore su cui viene scritto il numero di sequenza del messaggio
+ * @return Il messaggio, NULL se il registro ne contiene meno di k + 1
+ */
+message_t* bcast_nth(bcast_log_t* log, int k, unsigned long* seq);
+
+#endif /* CHATTERBOX_BROADCAST_H_ */
@@ -25,7 +25,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/select.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
@@ -39,9 +41,36 @@
 #include "hashtable.h"
 #include "lock.h"
 #include "worker.h"
+#include "uring.h"
 
-#define NICKNAME_HASH_BUCKETS_N 100000
+/**
+ * Numero iniziale di bucket dell'hashtable dei nickname, che poi cresce con il
+ * numero di utenti registrati
+ */
+#define NICKNAME_HASH_BUCKETS_N 64
 #define CONFIG_LINE_LENGTH 1024
+/**
+ * Suffisso aggiunto a StatFileName per il file delle statistiche che non fanno
+ * parte di quelle di printStats
+ */
+#define EXTRA_STATS_SUFFIX ".extra"
+/**
+ * Numero di fd occupati dal server prima di quelli dei client: stdin, stdout,
+ * stderr, il socket, l'eventfd del listener, la sua epoll, l'epoll delle code
+ * di uscita e l'io_uring del listener (epoll e io_uring del listener non sono
+ * mai aperti insieme: quello non usato punta a /dev/null, così il posto resta
+ * occupato)
+ */
+#define RESERVED_FDS 8
+/**
+ * fd dell'io_uring del listener
+ */
+#define LISTENER_URING_FD 7
+/**
+ * Numero massimo di eventi restituiti da una singola epoll_wait (o di
+ * completamenti letti insieme dall'io_uring)
+ */
+#define LISTENER_MAX_EVENTS 64
 
 /**
  * Struttura che memorizza le statistiche del server, struct statistics
@@ -67,15 +96,27 @@ pthread_mutex_t stats_mutex;
 fifo_t queue;
 
 /**
- * Array di variabili condivise con il listener, una per ogni vorker
+ * Array di code con cui i worker restituiscono i fd al listener, una per ogni
+ * worker seguite da una per ogni thread di I/O
  */
-int* freefd;
-char* freefd_ack;
+spsc_t* returned_fds;
 
 /**
- * Tid del signal handler
+ * Flag che vale 1 se è già stato scritto sull'eventfd del listener un
+ * risveglio che non è ancora stato gestito
  */
-pthread_t signal_handler;
+int listener_wakeup_pending = 0;
+
+/**
+ * Carico di ogni worker: in modalità reactor il numero di client assegnati, in
+ * modalità stealing il numero di fd in attesa nelle sue code
+ */
+int* worker_load;
+
+/**
+ * Code dei worker in modalità stealing, una per ogni worker
+ */
+worker_queues_t* worker_queues;
 
 /**
  * Variabile globale per interrompere i cicli infiniti dei thread
@@ -87,21 +128,88 @@ bool threads_continue = true;
  */
 htable_t* nickname_htable;
 
+/**
+ * Registro dei messaggi inviati a tutti
+ */
+bcast_log_t broadcasts;
+
+/**
+ * Elenco dei nickname connessi
+ */
+online_list_t online_users;
+
+/**
+ * Cache dei file aperti per GETFILE_OP
+ */
+file_cache_t file_cache;
+/**
+ * Archivio dei file ricevuti con POSTFILE_OP
+ */
+file_store_t file_store;
+
+/**
+ * Coda dei fd con un'operazione su file per i thread di I/O, e le operazioni
+ * (indicizzate per fd)
+ */
+fifo_t file_queue;
+file_job_t* file_jobs;
+
+/**
+ * Statistiche delle richieste di messaggi e di quelle su file
+ */
+op_class_stats_t msg_class_stats;
+op_class_stats_t file_class_stats;
+
+/**
+ * Contatore da cui vengono presi i numeri di sequenza dei messaggi salvati,
+ * sia nelle history che in broadcasts
+ */
+unsigned long msg_seq = 0;
+
 /**
  * Informazioni sui client connessi
  */
 int num_connected = 0;
-char** fd_to_nickname;
+int num_clients = 0;
+
+/**
+ * Sessioni dei client, indicizzate per fd
+ */
+client_session_t* fd_sessions;
+
+/**
+ * fd dei client che ricevono i cambiamenti della lista dei connessi
+ */
+int* presence_subs;
+int num_presence_subs = 0;
+
+/**
+ * Stato di lettura dei messaggi di ogni client, indicizzato per fd
+ */
+msg_reader_t* fd_readers;
 pthread_mutex_t connected_mutex;
 
+/**
+ * Code di uscita dei client, indicizzate per fd
+ */
+out_queue_t* fd_outqueues;
+
 /**
  * Costanti globali lette dal file di configurazione
  */
 int ThreadsInPool;
+int FileThreadsInPool = 0;
 int MaxHistMsgs;
 int MaxMsgSize;
 int MaxFileSize;
 int MaxConnections;
+int EpollEdgeTriggered = 0;
+int UseIoUring = 0;
+int MaxMsgsPerWakeup = 16;
+int OutQueueHighWater = 1024;
+int OutQueueLowWater = 256;
+out_policy_t OutQueuePolicy = OUT_POLICY_DROP;
+dispatch_mode_t DispatchMode = DISPATCH_QUEUE;
 char* DirName;
 char* StatFileName;
 char* UnixPath;
@@ -116,6 +224,76 @@ void usage(const char *progname) {
 }
 
 
+#if defined DEBUG && defined VERBOSE
+/**
+ * @brief Stampa un nickname se è connesso, da passare a ts_hash_foreach
+ */
+static void printConnected(char* key, nickname_t* val, void* arg) {
+	if (val->fd != 0) {
+		fprintf(stderr, "  %s\n", key);
+	}
+}
+#endif
+
+/**
+ * @brief Numero di richieste in corso di una classe, per le statistiche
+ */
+static unsigned long classPending(op_class_stats_t* cls) {
+	return __atomic_load_n(&(cls->pending), __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Numero di fd in coda per i worker, per le statistiche
+ *
+ * In modalità queue è l'occupazione della coda condivisa, in modalità
+ * stealing quella delle inbox e delle deque dei worker. In modalità reactor i
+ * fd pronti restano nelle epoll dei worker e non si possono contare: ci sono
+ * solo quelli nelle inbox, in attesa di essere aggiunti.
+ */
+static size_t msgQueueDepth() {
+	if (DispatchMode == DISPATCH_QUEUE) {
+		return ts_size(&queue);
+	}
+	size_t depth = 0;
+	for (int i = 0; i < ThreadsInPool; ++i) {
+		depth += spsc_size(&(worker_queues[i].inbox));
+		if (DispatchMode == DISPATCH_STEALING) {
+			depth += deque_size(&(worker_queues[i].deque));
+		}
+	}
+	return depth;
+}
+
+/**
+ * @brief Durata media delle richieste di una classe in microsecondi, per le
+ * statistiche
+ */
+static unsigned long classAverage(op_class_stats_t* cls) {
+	unsigned long served = __atomic_load_n(&(cls->served), __ATOMIC_RELAXED);
+	return served == 0 ? 0 : __atomic_load_n(&(cls->total_usec), __ATOMIC_RELAXED) / served;
+}
+
+/**
+ * @brief Apre in append un file delle statistiche su statsfd
+ *
+ * @param path Il file
+ * @param statsfd Il fd su cui aprirlo
+ * @return true in caso di successo
+ */
+static bool openStats(const char* path, int statsfd) {
+	int filefd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0744);
+	if (filefd < 0
+		|| dup2(filefd, statsfd) < 0) {
+		perror("aprendo il file delle statistiche");
+		if (filefd >= 0) {
+			close(filefd);
+		}
+		return false;
+	}
+	close(filefd);
+	return true;
+}
+
 /**
  * @brief main del thread che si occupa della gestione dei segnali
  *
@@ -131,8 +309,7 @@ void usage(const char *progname) {
  */
 void signal_handler_thread(sigset_t* handled_signals) {
 	const int statsfd = MaxConnections + ThreadsInPool + 1;
-	const int list_pipefd = MaxConnections + ThreadsInPool + 2;
-	char listener_ack_val = 1;
+	const int wakeupfd = 4;
 	int sig_received;
 
 	while(threads_continue) {
@@ -145,28 +322,14 @@ void signal_handler_thread(sigset_t* handled_signals) {
 				fprintf(stderr, "Ricevuto segnale SIGUSR1\n");
 				#if defined VERBOSE
 					fprintf(stderr, "Elenco utenti connessi:\n");
-					int i;
-					icl_entry_t* j;
-					char* key;
-					nickname_t* val;
-					icl_hash_foreach(nickname_htable->htable, i, j, key, val) {
-						if (val->fd != 0) {
-							fprintf(stderr, "  %s\n", key);
-						}
-	 				}
+					ts_hash_foreach(nickname_htable, &printConnected, NULL);
 				#endif
 			#endif
 			// gestire il segnale
-			int filefd = open(StatFileName, O_WRONLY | O_CREAT | O_APPEND, 0744);
-			if (filefd < 0
-				|| dup2(filefd, statsfd) < 0) {
-				perror("aprendo il file delle statistiche");
-			}
-			else {
-				close(filefd);
+			if (openStats(StatFileName, statsfd)) {
 				if (dprintf(statsfd, "%ld - %d %d %ld %ld %ld %ld %ld\n",
 			                 time(NULL),
-							 nickname_htable->htable->nentries,
+							 hash_count(nickname_htable),
 							 num_connected,
 							 chattyStats.ndelivered,
 							 chattyStats.nnotdelivered,
@@ -178,13 +341,28 @@ void signal_handler_thread(sigset_t* handled_signals) {
 				}
 				close(statsfd);
 			}
-		}
-		else if (sig_received == SIGUSR2) {
-			// Deve mandare un ack al listener tramite la pipe
-			while (write(list_pipefd, &listener_ack_val, 1) < 0) {
-				// Questa write non dovrebbe avere motivo di fallire
-				// Se fallisce semplicemente riprovo a mandare l'ack
-				perror("write, mandando ack al listener, riprovo");
+			// Le altre statistiche vanno in un file a parte, così quello di
+			// printStats mantiene il suo formato
+			char extra[strlen(StatFileName) + sizeof(EXTRA_STATS_SUFFIX)];
+			snprintf(extra, sizeof(extra), "%s%s", StatFileName, EXTRA_STATS_SUFFIX);
+			if (openStats(extra, statsfd)) {
+				// La memoria occupata dalle history, in byte, e per i
+				// messaggi e poi per i file i fd in coda, le richieste in
+				// corso e la loro durata media, in microsecondi. Senza thread
+				// di I/O le richieste di file passano dalla coda dei messaggi
+				if (dprintf(statsfd, "%ld - history %ld msg %zu %lu %lu file %zu %lu %lu\n",
+							 time(NULL),
+							 history_memory(),
+							 msgQueueDepth(),
+							 classPending(&msg_class_stats),
+							 classAverage(&msg_class_stats),
+							 ts_size(&file_queue),
+							 classPending(&file_class_stats),
+							 classAverage(&file_class_stats)
+						     ) < 0) {
+					perror("scrivendo le statistiche");
+				}
+				close(statsfd);
 			}
 		}
 		else if (sig_received == SIGINT || sig_received == SIGTERM || sig_received == SIGQUIT) {
@@ -192,119 +370,483 @@ void signal_handler_thread(sigset_t* handled_signals) {
 				fprintf(stderr, "Ricevuto segnale di interruzione, chiudo su tutto per bene\n");
 			#endif
 			threads_continue = false;
-			// Sblocca il listener scrivendogli sulla pipe
-			while (write(list_pipefd, &listener_ack_val, 1) < 0) {
-				perror("write, mandando ack al listener, riprovo");
+			// Sblocca il listener scrivendo sul suo eventfd
+			while (eventfd_write(wakeupfd, 1) < 0) {
+				// Questa write non dovrebbe avere motivo di fallire
+				// Se fallisce semplicemente riprovo
+				perror("write, svegliando il listener, riprovo");
+			}
+			// Sblocca i worker con un TERMINATION_FD oppure, in modalità
+			// reactor, rendendo pronto l'eventfd presente in tutte le loro epoll
+			if (DispatchMode == DISPATCH_REACTOR) {
+				while (eventfd_write(TERMINATION_EVENTFD, 1) < 0) {
+					perror("write, terminando i worker, riprovo");
+				}
 			}
-			// Sblocca i worker con un TERMINATION_FD
-			for (unsigned int i = 0; i < ThreadsInPool; ++i) {
-				ts_push(&queue, TERMINATION_FD);
+			else if (DispatchMode == DISPATCH_STEALING) {
+				for (unsigned int i = 0; i < ThreadsInPool; ++i) {
+					wake_worker(i);
+				}
+			}
+			else {
+				for (unsigned int i = 0; i < ThreadsInPool; ++i) {
+					ts_push(&queue, TERMINATION_FD);
+				}
+			}
+			for (unsigned int i = 0; i < FileThreadsInPool; ++i) {
+				ts_push(&file_queue, TERMINATION_FD);
 			}
 			break;
 		}
 	}
 
-	close(list_pipefd);
 	return;
 }
 
 
 /**
- * @brief main del thread listener, che gestisce le connessioni con i client
+ * io_uring del listener, usato al posto della sua epoll se UseIoUring è vero
+ */
+static uring_t listener_ring;
+
+/**
+ * @brief Prende un SQE libero dall'io_uring del listener
  *
- * Gestisce sia le richieste di nuove connessioni, sia i messaggi inviati dai
- * client già connessi.
+ * Se la coda di sottomissione è piena invia al kernel quelli già preparati.
  *
- * @param arg Nulla (si può passare NULL)
+ * @return L'SQE, NULL in caso di errore
  */
-void* listener_thread(void* arg) {
-	// Non c'è bisogno di leggerlo, deve esere 3 per forza
+static struct io_uring_sqe* listener_sqe() {
+	struct io_uring_sqe* sqe = uring_get_sqe(&listener_ring);
+	if (sqe == NULL && uring_submit(&listener_ring, 0) >= 0) {
+		sqe = uring_get_sqe(&listener_ring);
+	}
+	return sqe;
+}
+
+/**
+ * @brief Registra (o riarma) un fd di un client nell'epoll del listener
+ *
+ * I fd dei client sono registrati con EPOLLONESHOT: dopo il primo evento
+ * vengono disattivati finché il worker non li restituisce, così lo stesso fd
+ * non può essere passato a due worker contemporaneamente.
+ *
+ * Con l'io_uring prepara invece una richiesta di poll, che vale una volta sola
+ * come EPOLLONESHOT e viene inviata insieme alle altre alla successiva attesa
+ * del listener, senza una syscall per ogni fd.
+ *
+ * @param epollfd L'epoll del listener
+ * @param op EPOLL_CTL_ADD per un nuovo fd, EPOLL_CTL_MOD per riarmarlo
+ * @param fd Il fd del client
+ * @return Il valore restituito da epoll_ctl
+ */
+static int arm_client_fd(int epollfd, int op, int fd) {
+	if (UseIoUring) {
+		struct io_uring_sqe* sqe = listener_sqe();
+		if (sqe == NULL) {
+			return -1;
+		}
+		uring_prep_poll(sqe, fd, POLLIN, fd);
+		return 0;
+	}
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	if (EpollEdgeTriggered) {
+		ev.events |= EPOLLET;
+	}
+	ev.data.fd = fd;
+	return epoll_ctl(epollfd, op, fd, &ev);
+}
+
+/**
+ * @brief Sceglie il worker con il carico minore
+ *
+ * A parità di carico i worker vengono scelti a turno, partendo da quello dopo
+ * l'ultimo scelto. Viene chiamata solo dal listener.
+ *
+ * @return il numero del worker scelto
+ */
+static int least_loaded_worker() {
+	static int next = 0;
+	int best = next;
+	for (int i = 1; i < ThreadsInPool; ++i) {
+		int w = (next + i) % ThreadsInPool;
+		if (__atomic_load_n(worker_load + w, __ATOMIC_RELAXED)
+			< __atomic_load_n(worker_load + best, __ATOMIC_RELAXED)) {
+			best = w;
+		}
+	}
+	next = (best + 1) % ThreadsInPool;
+	return best;
+}
+
+/**
+ * @brief Assegna un nuovo client ad un worker (modalità reactor)
+ *
+ * Sceglie il worker con meno client assegnati; a parità di carico i worker
+ * vengono scelti a turno, così le connessioni si distribuiscono in modo
+ * uniforme anche quando tutti i worker sono scarichi.
+ *
+ * @param fd Il fd del nuovo client
+ * @return Il valore restituito da epoll_ctl
+ */
+static int assign_to_worker(int fd) {
+	int best = least_loaded_worker();
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	// Il carico va aumentato prima di registrare il fd: da quel momento il
+	// worker può servirlo e, se il client si disconnette, diminuire il carico
+	__atomic_add_fetch(worker_load + best, 1, __ATOMIC_RELAXED);
+	if (epoll_ctl(WORKER_EPOLLFD(best), EPOLL_CTL_ADD, fd, &ev) < 0) {
+		__atomic_sub_fetch(worker_load + best, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+	#ifdef DEBUG
+		fprintf(stderr, "Client su fd %d assegnato al worker %d\n", fd, best);
+	#endif
+	return 0;
+}
+
+/**
+ * @brief Passa un fd pronto al worker meno carico in modalità stealing
+ *
+ * Il fd viene inserito nella inbox del worker, che lo sposterà nella propria
+ * deque; da lì un altro worker libero può rubarlo.
+ *
+ * @param fd Il fd del client
+ */
+static void dispatch_to_worker(int fd) {
+	int best = least_loaded_worker();
+	__atomic_add_fetch(worker_load + best, 1, __ATOMIC_RELAXED);
+	// Non può fallire: ogni fd si trova al più in una coda alla volta e
+	// ognuna ha almeno MaxConnections posti
+	bool pushed = spsc_push(&(worker_queues[best].inbox), fd);
+	assert(pushed);
+	(void)pushed;
+	wake_worker(best);
+	#if defined DEBUG && defined VERBOSE
+		fprintf(stderr, "fd %d passato al worker %d\n", fd, best);
+	#endif
+}
+
+/**
+ * @brief Passa ai worker un fd che ha richieste da servire
+ *
+ * Serve sia per i fd segnalati dalla epoll del listener sia per quelli
+ * restituiti dai thread di I/O, che potrebbero avere altre richieste già nel
+ * buffer di ricezione. In modalità reactor arrivano qui solo i secondi: il fd
+ * viene passato al worker meno carico tramite la sua inbox, e il worker lo
+ * serve subito (senza aspettare un evento della epoll, che per le richieste
+ * già nel buffer non arriverebbe) prima di aggiungerlo alla sua epoll.
+ *
+ * @param fd Il fd del client
+ */
+static void dispatch_ready_fd(int fd) {
+	if (DispatchMode == DISPATCH_STEALING) {
+		dispatch_to_worker(fd);
+	}
+	else if (DispatchMode == DISPATCH_REACTOR) {
+		int best = least_loaded_worker();
+		__atomic_add_fetch(worker_load + best, 1, __ATOMIC_RELAXED);
+		// Non può fallire, come in dispatch_to_worker
+		bool pushed = spsc_push(&(worker_queues[best].inbox), fd);
+		assert(pushed);
+		(void)pushed;
+		while (eventfd_write(worker_queues[best].wakefd, 1) < 0) {
+			perror("write, svegliando un worker, riprovo");
+		}
+	}
+	else {
+		ts_push(&queue, fd);
+	}
+}
+
+/**
+ * @brief Gestisce un risveglio del listener, riarmando i fd restituiti dai
+ * worker e passando ai worker quelli restituiti dai thread di I/O
+ *
+ * @param epollfd L'epoll del listener
+ */
+static void handle_wakeup(int epollfd) {
+	const int wakeupfd = 4;
+	eventfd_t wakeups;
+	int returned;
+	// Azzera il contatore dell'eventfd: un solo risveglio basta per tutti i
+	// fd restituiti nel frattempo
+	if (eventfd_read(wakeupfd, &wakeups) < 0) {
+		perror("leggendo l'eventfd del listener");
+	}
+	// Va azzerato prima di svuotare le code: un worker che restituisce un fd
+	// dopo questo punto deve svegliare di nuovo il listener. La exchange
+	// sincronizza con quella dei worker, quindi i fd inseriti prima sono
+	// visibili.
+	__atomic_exchange_n(&listener_wakeup_pending, 0, __ATOMIC_SEQ_CST);
+	for (int i = 0; i < ThreadsInPool + FileThreadsInPool; ++i) {
+		while (spsc_pop(returned_fds + i, &returned)) {
+			if (i >= ThreadsInPool) {
+				// Restituito da un thread di I/O
+				dispatch_ready_fd(returned);
+			}
+			else if (arm_client_fd(epollfd, EPOLL_CTL_MOD, returned) < 0) {
+				perror("riarmando un fd restituito da un worker");
+			}
+			#if defined DEBUG && defined VERBOSE
+				fprintf(stderr, "Ricevuto fd %d dal worker %d\n", returned, i);
+			#endif
+		}
+	}
+}
+
+/**
+ * @brief Invia le code di uscita dei client che sono tornati scrivibili
+ */
+static void handle_out_queues() {
+	struct epoll_event outevents[LISTENER_MAX_EVENTS];
+	int nout = epoll_wait(OUT_EPOLLFD, outevents, LISTENER_MAX_EVENTS, 0);
+	for (int o = 0; o < nout; ++o) {
+		#if defined DEBUG && defined VERBOSE
+			fprintf(stderr, "Invio la coda di uscita del fd %d\n", outevents[o].data.fd);
+		#endif
+		if (flush_out_queue(outevents[o].data.fd)) {
+			// Un client parcheggiato che si è messo in pari
+			dispatch_ready_fd(outevents[o].data.fd);
+		}
+	}
+}
+
+/**
+ * @brief Registra una nuova connessione appena accettata
+ *
+ * @param epollfd L'epoll del listener
+ * @param newfd Il fd della connessione
+ */
+static void handle_new_client(int epollfd, int newfd) {
+	#ifdef DEBUG
+		fprintf(stderr, "Richiesta di nuova connessione: %d\n", newfd);
+	#endif
+	// Accetta al massimo MaxConnections client. Il controllo sul valore del
+	// fd serve solo a non uscire da fd_sessions (un worker potrebbe avere
+	// appena aperto un file)
+	error_handling_lock(&connected_mutex);
+	bool accepted = num_clients < MaxConnections - RESERVED_FDS
+		&& newfd < MaxConnections;
+	if (accepted) {
+		++num_clients;
+	}
+	error_handling_unlock(&connected_mutex);
+	// I worker leggono dai client senza bloccarsi, per servire tutte le
+	// richieste già arrivate (vedere readMsgNonBlocking)
+	if (accepted
+		&& (fcntl(newfd, F_SETFL, O_NONBLOCK) < 0
+			|| (DispatchMode == DISPATCH_REACTOR
+				? assign_to_worker(newfd)
+				: arm_client_fd(epollfd, EPOLL_CTL_ADD, newfd)) < 0)) {
+		perror("registrando un client nell'epoll");
+		error_handling_lock(&connected_mutex);
+		--num_clients;
+		error_handling_unlock(&connected_mutex);
+		accepted = false;
+	}
+	if (!accepted) {
+		increaseStat(nerrors);
+		close(newfd);
+	}
+}
+
+/**
+ * @brief Ciclo del listener con l'epoll
+ *
+ * @param epollfd L'epoll del listener
+ */
+static void listener_epoll_loop(int epollfd) {
+	// Non c'è bisogno di leggerli, devono essere 3 e 4 per forza
 	const int ssfd = 3;
-	const int pipefd = 4;
-	char ack_buf[ThreadsInPool];
-	// Indice del massimo fd atteso nella select
-	int fdnum = pipefd;
+	const int wakeupfd = 4;
+	struct epoll_event events[LISTENER_MAX_EVENTS];
 
-	// Preparazione iniziale del fd_set
-	fd_set set, rset;
-	FD_ZERO(&set);
-	FD_SET(ssfd, &set);
-	FD_SET(pipefd, &set);
+	// Il socket e l'eventfd restano sempre level-triggered: la
+	// configurazione riguarda solo i fd dei client
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = ssfd;
+	if (epoll_ctl(epollfd, EPOLL_CTL_ADD, ssfd, &ev) < 0) {
+		perror("registrando il socket nell'epoll");
+		exit(EXIT_FAILURE);
+	}
+	ev.data.fd = wakeupfd;
+	if (epoll_ctl(epollfd, EPOLL_CTL_ADD, wakeupfd, &ev) < 0) {
+		perror("registrando l'eventfd nell'epoll");
+		exit(EXIT_FAILURE);
+	}
+	// Una epoll è pronta in lettura quando ha eventi da restituire
+	ev.data.fd = OUT_EPOLLFD;
+	if (epoll_ctl(epollfd, EPOLL_CTL_ADD, OUT_EPOLLFD, &ev) < 0) {
+		perror("registrando l'epoll di uscita nell'epoll");
+		exit(EXIT_FAILURE);
+	}
 
 	// Ciclo di esecuzione
 	while (threads_continue) {
-		rset = set;
-		// Usa la SC select per ascoltare contemporaneamente su molti socket
 		#if defined DEBUG && defined VERBOSE
-			fprintf(stderr, "Inizia la select\n");
+			fprintf(stderr, "Inizia la epoll_wait\n");
 		#endif
-		if (select(fdnum + 1, &rset, NULL, NULL, NULL) < 0) {
-			perror("select del listener");
+		int nready = epoll_wait(epollfd, events, LISTENER_MAX_EVENTS, -1);
+		if (nready < 0) {
+			if (errno != EINTR) {
+				perror("epoll_wait del listener");
+			}
+			continue;
 		}
-		else {
-			// Select terminata correttamente: controlla quale fd è pronto
+		#if defined DEBUG && defined VERBOSE
+			fprintf(stderr, "Ricevuti %d eventi dalla epoll_wait\n", nready);
+		#endif
+		for (int e = 0; e < nready; ++e) {
+			int fd = events[e].data.fd;
+			if (fd == wakeupfd) {
+				handle_wakeup(epollfd);
+			}
+			else if (fd == OUT_EPOLLFD) {
+				// Client con dati in coda che sono tornati scrivibili
+				handle_out_queues();
+			}
+			else if (fd == ssfd) {
+				// Richiesta di nuova connessione
+				int newfd = accept(ssfd, NULL, 0);
+				if (newfd < 0) {
+					perror("accept");
+					continue;
+				}
+				handle_new_client(epollfd, newfd);
+			}
+			else {
+				// Richiesta su una connessione già aperta. Il fd resta
+				// disattivato (EPOLLONESHOT) finché un worker non lo
+				// restituisce
+				#ifdef DEBUG
+					fprintf(stderr, "Richiesta su fd %d\n", fd);
+				#endif
+				dispatch_ready_fd(fd);
+			}
+		}
+	}
+}
+
+/**
+ * @brief Ciclo del listener con l'io_uring
+ *
+ * Al posto della epoll ci sono una accept e dei poll (uno per il socket di
+ * ogni client in attesa, uno per l'eventfd e uno per l'epoll di uscita), tutti
+ * di una sola volta e riarmati dopo ogni completamento. I riarmi si accumulano
+ * nella coda di sottomissione e vengono inviati con la stessa syscall che
+ * aspetta i completamenti successivi, che poi vengono letti tutti insieme.
+ *
+ * È sperimentale e si usa solo se richiesto (IoUring = 1): sostituisce
+ * l'attesa del listener, mentre letture, scritture e file restano syscall
+ * normali.
+ */
+static void listener_uring_loop() {
+	const int ssfd = 3;
+	const int wakeupfd = 4;
+	// Senza epoll: arm_client_fd usa il ring e ignora questo valore
+	const int epollfd = -1;
+	uring_event_t events[LISTENER_MAX_EVENTS];
+	struct io_uring_sqe* sqe;
+
+	// Il ring ha posto per tutti i client, quindi queste non falliscono
+	uring_prep_accept(listener_sqe(), ssfd, ssfd);
+	uring_prep_poll(listener_sqe(), wakeupfd, POLLIN, wakeupfd);
+	uring_prep_poll(listener_sqe(), OUT_EPOLLFD, POLLIN, OUT_EPOLLFD);
+
+	// Ciclo di esecuzione
+	while (threads_continue) {
+		if (uring_submit(&listener_ring, 1) < 0) {
+			if (errno != EINTR) {
+				perror("io_uring_enter del listener");
+			}
+			continue;
+		}
+		unsigned nready;
+		while (threads_continue
+			&& (nready = uring_reap(&listener_ring, events, LISTENER_MAX_EVENTS)) > 0) {
 			#if defined DEBUG && defined VERBOSE
-                fprintf(stderr, "Ricevuto qualcosa dalla select\n");
-            #endif
-			for (int fd = 0; fd <= fdnum; ++fd) {
-				if (FD_ISSET(fd, &rset)) {
-					if (fd == pipefd) {
-						// Cancella tutti gli ack del signal handler. Visto che
-						// gli ack dovrebbero arrivare solo dai worker,
-						// dovrebbero essere al massimo ThreadsInPool
-						while (read(pipefd, ack_buf, ThreadsInPool) < 0) {
-							perror("errore leggendo gli ack, riprovo");
-							// In caso di errore semplicemente riprova
-						}
-						// Controlla quali ack sono a 1 (eventualmente nessuno,
-						// in caso di segnali spurii)
-						for (int i = 0; i < ThreadsInPool; ++i) {
-							if (freefd_ack[i] == 1) {
-								// Aggiunge freefd[i] alla bitmap su cui esegue
-								// la select
-								FD_SET(freefd[i], &set);
-								// Non c'è bisogno di aggiornare fdnum perché un
-								// fd arrivato da un worker è stato accettato dal
-								// listener, quindi ha già modificato fdnum
-								#if defined DEBUG && defined VERBOSE
-									fprintf(stderr, "Ricevuto fd %d da un worker\n", freefd[i]);
-								#endif
-								freefd_ack[i] = 0;
-							}
-						}
+				fprintf(stderr, "Ricevuti %u completamenti dall'io_uring\n", nready);
+			#endif
+			for (unsigned e = 0; e < nready; ++e) {
+				int fd = events[e].user_data;
+				if (fd == wakeupfd) {
+					handle_wakeup(epollfd);
+					if ((sqe = listener_sqe()) != NULL) {
+						uring_prep_poll(sqe, wakeupfd, POLLIN, wakeupfd);
 					}
-					else if (fd == ssfd) {
-						// Richiesta di nuova connessione
-						int newfd = accept(ssfd, NULL, 0);
-						#ifdef DEBUG
-							fprintf(stderr, "Richiesta di nuova connessione: %d\n", newfd);
-						#endif
-						// Accetta al massimo MaxConnections dai client
-						if (newfd < MaxConnections) {
-							FD_SET(newfd, &set);
-							if (newfd > fdnum) {
-								fdnum = newfd;
-							}
-						}
-						else {
-							increaseStat(nerrors);
-							close(newfd);
-						}
+				}
+				else if (fd == OUT_EPOLLFD) {
+					handle_out_queues();
+					if ((sqe = listener_sqe()) != NULL) {
+						uring_prep_poll(sqe, OUT_EPOLLFD, POLLIN, OUT_EPOLLFD);
+					}
+				}
+				else if (fd == ssfd) {
+					// Il risultato è il fd della nuova connessione
+					if (events[e].res < 0) {
+						errno = -events[e].res;
+						perror("accept");
 					}
 					else {
-						// Richiesta su una connessione già aperta
-						#ifdef DEBUG
-							fprintf(stderr, "Richiesta su fd %d\n", fd);
-						#endif
-						ts_push(&queue, fd);
-						FD_CLR(fd, &set);
+						handle_new_client(epollfd, events[e].res);
+					}
+					if ((sqe = listener_sqe()) != NULL) {
+						uring_prep_accept(sqe, ssfd, ssfd);
 					}
 				}
+				else {
+					// Richiesta su una connessione già aperta: il poll non è
+					// più attivo finché un worker non restituisce il fd. Anche
+					// in caso di errore il fd passa ad un worker, che se ne
+					// accorge leggendo
+					#ifdef DEBUG
+						fprintf(stderr, "Richiesta su fd %d\n", fd);
+					#endif
+					dispatch_ready_fd(fd);
+				}
 			}
 		}
 	}
+}
 
-	close(pipefd);
+/**
+ * @brief main del thread listener, che gestisce le connessioni con i client
+ *
+ * Gestisce sia le richieste di nuove connessioni, sia i messaggi inviati dai
+ * client già connessi. Ascolta tutti i fd con una epoll (o con l'io_uring se
+ * UseIoUring è vero), che restituisce solo quelli pronti: il costo di ogni
+ * risveglio non dipende dal numero di client.
+ *
+ * In modalità reactor il listener accetta solo le nuove connessioni e le
+ * assegna ai worker, che poi ascoltano i propri client. In modalità stealing i
+ * fd pronti vanno direttamente al worker meno carico invece che nella coda
+ * condivisa.
+ *
+ * @param arg Nulla (si può passare NULL)
+ */
+void* listener_thread(void* arg) {
+	// Non c'è bisogno di leggerli, devono essere 4 e 5 per forza
+	const int wakeupfd = 4;
+	const int epollfd = 5;
+
+	if (UseIoUring) {
+		listener_uring_loop();
+	}
+	else {
+		listener_epoll_loop(epollfd);
+		close(epollfd);
+	}
+
+	close(wakeupfd);
 	return NULL;
 }
 
@@ -368,6 +910,15 @@ int main(int argc, char *argv[]) {
 						fprintf(stderr, "Letto ThreadsInPool: %d\n", ThreadsInPool);
 					#endif
 				}
+				else if (strncmp(paramName, "FileThreadsInPool", strlen("FileThreadsInPool") + 1) == 0) {
+					FileThreadsInPool = strtol(paramValue, NULL, 10);
+					if (FileThreadsInPool < 0) {
+						FileThreadsInPool = 0;
+					}
+					#if defined DEBUG && defined VERBOSE
+						fprintf(stderr, "Letto FileThreadsInPool: %d\n", FileThreadsInPool);
+					#endif
+				}
 				else if (strncmp(paramName, "MaxHistMsgs", strlen("MaxHistMsgs") + 1) == 0) {
 					MaxHistMsgs = strtol(paramValue, NULL, 10);
 					#if defined DEBUG && defined VERBOSE
@@ -388,11 +939,77 @@ int main(int argc, char *argv[]) {
 				}
 				else if (strncmp(paramName, "MaxConnections", strlen("MaxConnections") + 1) == 0) {
 					MaxConnections = strtol(paramValue, NULL, 10);
-					MaxConnections += 5; // Serve solo aumentata
+					MaxConnections += RESERVED_FDS; // Serve solo aumentata
 					#if defined DEBUG && defined VERBOSE
 						fprintf(stderr, "Letto MaxConnections: %d\n", MaxConnections);
 					#endif
 				}
+				else if (strncmp(paramName, "EpollEdgeTriggered", strlen("EpollEdgeTriggered") + 1) == 0) {
+					EpollEdgeTriggered = strtol(paramValue, NULL, 10);
+					#if defined DEBUG && defined VERBOSE
+						fprintf(stderr, "Letto EpollEdgeTriggered: %d\n", EpollEdgeTriggered);
+					#endif
+				}
+				else if (strncmp(paramName, "IoUring", strlen("IoUring") + 1) == 0) {
+					UseIoUring = strtol(paramValue, NULL, 10);
+					#if defined DEBUG && defined VERBOSE
+						fprintf(stderr, "Letto IoUring: %d\n", UseIoUring);
+					#endif
+				}
+				else if (strncmp(paramName, "MaxMsgsPerWakeup", strlen("MaxMsgsPerWakeup") + 1) == 0) {
+					MaxMsgsPerWakeup = strtol(paramValue, NULL, 10);
+					if (MaxMsgsPerWakeup < 1) {
+						MaxMsgsPerWakeup = 1;
+					}
+					#if defined DEBUG && defined VERBOSE
+						fprintf(stderr, "Letto MaxMsgsPerWakeup: %d\n", MaxMsgsPerWakeup);
+					#endif
+				}
+				else if (strncmp(paramName, "OutQueueHighWater", strlen("OutQueueHighWater") + 1) == 0) {
+					OutQueueHighWater = strtol(paramValue, NULL, 10);
+					#if defined DEBUG && defined VERBOSE
+						fprintf(stderr, "Letto OutQueueHighWater: %d\n", OutQueueHighWater);
+					#endif
+				}
+				else if (strncmp(paramName, "OutQueueLowWater", strlen("OutQueueLowWater") + 1) == 0) {
+					OutQueueLowWater = strtol(paramValue, NULL, 10);
+					#if defined DEBUG && defined VERBOSE
+						fprintf(stderr, "Letto OutQueueLowWater: %d\n", OutQueueLowWater);
+					#endif
+				}
+				else if (strncmp(paramName, "OutQueuePolicy", strlen("OutQueuePolicy") + 1) == 0) {
+					if (strncmp(paramValue, "drop", strlen("drop") + 1) == 0) {
+						OutQueuePolicy = OUT_POLICY_DROP;
+					}
+					else if (strncmp(paramValue, "disconnect", strlen("disconnect") + 1) == 0) {
+						OutQueuePolicy = OUT_POLICY_DISCONNECT;
+					}
+					else {
+						fprintf(stderr, "OutQueuePolicy sconosciuta: %s\n", paramValue);
+						exit(EXIT_FAILURE);
+					}
+					#if defined DEBUG && defined VERBOSE
+						fprintf(stderr, "Letto OutQueuePolicy: %d\n", OutQueuePolicy);
+					#endif
+				}
+				else if (strncmp(paramName, "DispatchMode", strlen("DispatchMode") + 1) == 0) {
+					if (strncmp(paramValue, "queue", strlen("queue") + 1) == 0) {
+						DispatchMode = DISPATCH_QUEUE;
+					}
+					else if (strncmp(paramValue, "reactor", strlen("reactor") + 1) == 0) {
+						DispatchMode = DISPATCH_REACTOR;
+					}
+					else if (strncmp(paramValue, "stealing", strlen("stealing") + 1) == 0) {
+						DispatchMode = DISPATCH_STEALING;
+					}
+					else {
+						fprintf(stderr, "DispatchMode sconosciuta: %s\n", paramValue);
+						exit(EXIT_FAILURE);
+					}
+					#if defined DEBUG && defined VERBOSE
+						fprintf(stderr, "Letto DispatchMode: %d\n", DispatchMode);
+					#endif
+				}
 				else if (strncmp(paramName, "UnixPath", strlen("UnixPath") + 1) == 0) {
 					UnixPath = malloc((strlen(paramValue) + 1) * sizeof(char));
 					strncpy(UnixPath, paramValue, strlen(paramValue) + 1);
@@ -423,6 +1040,10 @@ int main(int argc, char *argv[]) {
 	free(line);
 
 	fclose(conf_file);
+	// La soglia bassa non può superare quella alta
+	if (OutQueueLowWater > OutQueueHighWater) {
+		OutQueueLowWater = OutQueueHighWater;
+	}
 
 	// Ignora SIGPIPE per tutto il processo
 	struct sigaction s;
@@ -440,7 +1061,6 @@ int main(int argc, char *argv[]) {
 	// lazy evaluation dell'OR
 	if (sigemptyset(&signalmask) < 0
 		|| sigaddset(&signalmask, SIGUSR1) < 0
-		|| sigaddset(&signalmask, SIGUSR2) < 0
 		|| sigaddset(&signalmask, SIGINT) < 0
 		|| sigaddset(&signalmask, SIGTERM) < 0
 		|| sigaddset(&signalmask, SIGQUIT) < 0
@@ -454,8 +1074,32 @@ int main(int argc, char *argv[]) {
 	}
 
 	// Crea le strutture condivise
-	queue = create_fifo();
+	// Ogni fd è nella coda al più una volta (EPOLLONESHOT), più i TERMINATION_FD
+	queue = create_fifo(MaxConnections + ThreadsInPool);
+	if (queue.buf == NULL) {
+		perror("creando la coda dei client");
+		exit(EXIT_FAILURE);
+	}
 	nickname_htable = hash_create(NICKNAME_HASH_BUCKETS_N, MaxHistMsgs);
+	if (create_bcast_log(&broadcasts, MaxHistMsgs) < 0) {
+		perror("creando il registro dei messaggi a tutti");
+		exit(EXIT_FAILURE);
+	}
+	if (create_online_list(&online_users, MaxConnections) < 0) {
+		perror("creando l'elenco dei connessi");
+		exit(EXIT_FAILURE);
+	}
+	create_file_cache(&file_cache, FILE_CACHE_ENTRIES, FILE_FD_BASE);
+	if (create_file_store(&file_store, DirName, FILE_FD_BASE) < 0) {
+		perror("aprendo l'archivio dei file");
+		exit(EXIT_FAILURE);
+	}
+	// Come queue, più i TERMINATION_FD dei thread di I/O
+	file_queue = create_fifo(MaxConnections + FileThreadsInPool);
+	if (file_queue.buf == NULL) {
+		perror("creando la coda dei thread di I/O");
+		exit(EXIT_FAILURE);
+	}
 	int socketfd = createSocket(UnixPath);
 	if (socketfd != 3) {
 		if (dup2(socketfd, 3) < 0) {
@@ -466,47 +1110,183 @@ int main(int argc, char *argv[]) {
 			close(socketfd);
 		}
 	}
-	int pipefd[2];
-	if (pipe(pipefd) < 0) {
-		perror("creando la pipe");
+	int wakeupfd = eventfd(0, 0);
+	if (wakeupfd < 0) {
+		perror("creando l'eventfd del listener");
 		exit(EXIT_FAILURE);
 	}
-	if (pipefd[0] != 4) {
-		if (dup2(pipefd[0], 4) < 0) {
-			perror("errore spostando il la pipe su fd 4");
+	if (wakeupfd != 4) {
+		if (dup2(wakeupfd, 4) < 0) {
+			perror("errore spostando l'eventfd su fd 4");
 			exit(EXIT_FAILURE);
 		}
 		else {
-			close(pipefd[0]);
+			close(wakeupfd);
+		}
+	}
+	// Se il kernel non supporta io_uring il listener usa la sua epoll
+	if (UseIoUring) {
+		if (create_uring(&listener_ring, MaxConnections + 8) < 0) {
+			perror("io_uring non disponibile, uso epoll");
+			UseIoUring = 0;
+		}
+		else if (listener_ring.fd != LISTENER_URING_FD) {
+			if (dup2(listener_ring.fd, LISTENER_URING_FD) < 0) {
+				perror("errore spostando l'io_uring su fd 7");
+				exit(EXIT_FAILURE);
+			}
+			close(listener_ring.fd);
+			listener_ring.fd = LISTENER_URING_FD;
+		}
+	}
+	// L'epoll del listener serve solo se non c'è l'io_uring
+	if (!UseIoUring) {
+		int epollfd = epoll_create1(0);
+		if (epollfd < 0) {
+			perror("creando l'epoll del listener");
+			exit(EXIT_FAILURE);
+		}
+		if (epollfd != 5) {
+			if (dup2(epollfd, 5) < 0) {
+				perror("errore spostando l'epoll su fd 5");
+				exit(EXIT_FAILURE);
+			}
+			else {
+				close(epollfd);
+			}
 		}
 	}
-	if (pipefd[1] != 2 + MaxConnections + ThreadsInPool) {
-		if (dup2(pipefd[1], 2 + MaxConnections + ThreadsInPool) < 0) {
-			perror("errore spostando la pipe su fd 2 + roba");
+	int outepollfd = epoll_create1(0);
+	if (outepollfd < 0) {
+		perror("creando l'epoll delle code di uscita");
+		exit(EXIT_FAILURE);
+	}
+	if (outepollfd != OUT_EPOLLFD) {
+		if (dup2(outepollfd, OUT_EPOLLFD) < 0) {
+			perror("errore spostando l'epoll delle code di uscita su fd 6");
 			exit(EXIT_FAILURE);
 		}
 		else {
-			close(pipefd[1]);
+			close(outepollfd);
+		}
+	}
+	// I fd riservati non usati (l'epoll o l'io_uring del listener, o lo stdio
+	// se era chiuso) puntano a /dev/null: accept non li assegna ai client,
+	// che restano così tutti sopra RESERVED_FDS
+	for (int fd = 0; fd < RESERVED_FDS; ++fd) {
+		if (fcntl(fd, F_GETFD) < 0 && errno == EBADF) {
+			int nullfd = open("/dev/null", O_RDWR);
+			if (nullfd < 0
+				|| (nullfd != fd && dup2(nullfd, fd) < 0)) {
+				perror("occupando i fd riservati");
+				exit(EXIT_FAILURE);
+			}
+			if (nullfd != fd) {
+				close(nullfd);
+			}
 		}
 	}
 	pthread_t listener;
 	pthread_t pool[ThreadsInPool];
-	if ((freefd = malloc(ThreadsInPool * sizeof(int))) == NULL
-		|| (freefd_ack = calloc(ThreadsInPool, sizeof(char))) == NULL
-		|| (fd_to_nickname = calloc(MaxConnections, sizeof(char*))) == NULL
+	int worker_number[ThreadsInPool];
+	// Almeno un elemento, perché gli array di lunghezza 0 non sono ammessi
+	pthread_t file_pool[FileThreadsInPool + 1];
+	int file_thread_number[FileThreadsInPool + 1];
+	if ((returned_fds = malloc((ThreadsInPool + FileThreadsInPool) * sizeof(spsc_t))) == NULL
+		|| (file_jobs = malloc(MaxConnections * sizeof(file_job_t))) == NULL
+		|| (worker_load = calloc(ThreadsInPool, sizeof(int))) == NULL
+		|| (fd_sessions = calloc(MaxConnections, sizeof(client_session_t))) == NULL
+		|| (presence_subs = malloc(MaxConnections * sizeof(int))) == NULL
+		|| (fd_readers = calloc(MaxConnections, sizeof(msg_reader_t))) == NULL
+		|| (fd_outqueues = calloc(MaxConnections, sizeof(out_queue_t))) == NULL
 		) {
 		perror("out of memory");
 		exit(EXIT_FAILURE);
 	}
+	for (int i = 0; i < MaxConnections; ++i) {
+		pthread_mutex_init(&(fd_outqueues[i].mutex), NULL);
+	}
+	for (int i = 0; i < ThreadsInPool + FileThreadsInPool; ++i) {
+		// Ogni fd si trova al più in una coda alla volta, quindi MaxConnections
+		// posti bastano perché un worker non trovi mai la coda piena
+		if (create_spsc(returned_fds + i, MaxConnections) < 0) {
+			perror("out of memory");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (DispatchMode == DISPATCH_STEALING || DispatchMode == DISPATCH_REACTOR) {
+		if ((worker_queues = calloc(ThreadsInPool, sizeof(worker_queues_t))) == NULL) {
+			perror("out of memory");
+			exit(EXIT_FAILURE);
+		}
+		for (int i = 0; i < ThreadsInPool; ++i) {
+			// Come per returned_fds, MaxConnections posti bastano sempre
+			if (create_spsc(&(worker_queues[i].inbox), MaxConnections) < 0
+				|| (DispatchMode == DISPATCH_STEALING
+					&& create_deque(&(worker_queues[i].deque), MaxConnections) < 0)) {
+				perror("out of memory");
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+	if (DispatchMode == DISPATCH_REACTOR) {
+		// Un eventfd per terminare i worker e una epoll per ogni worker, su fd
+		// fissi oltre quelli riservati ai file (vedere worker.h)
+		int termfd = eventfd(0, 0);
+		if (termfd < 0 || dup2(termfd, TERMINATION_EVENTFD) < 0) {
+			perror("creando l'eventfd di terminazione dei worker");
+			exit(EXIT_FAILURE);
+		}
+		close(termfd);
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = TERMINATION_EVENTFD;
+		for (int i = 0; i < ThreadsInPool; ++i) {
+			int wepollfd = epoll_create1(0);
+			if (wepollfd < 0 || dup2(wepollfd, WORKER_EPOLLFD(i)) < 0) {
+				perror("creando l'epoll di un worker");
+				exit(EXIT_FAILURE);
+			}
+			close(wepollfd);
+			if (epoll_ctl(WORKER_EPOLLFD(i), EPOLL_CTL_ADD, TERMINATION_EVENTFD, &ev) < 0) {
+				perror("registrando l'eventfd di terminazione");
+				exit(EXIT_FAILURE);
+			}
+			// L'eventfd della inbox va spostato sopra quelli dei client,
+			// come i fd della cache dei file
+			int wakefd = eventfd(0, 0);
+			if (wakefd < 0
+				|| (worker_queues[i].wakefd = fcntl(wakefd, F_DUPFD, FILE_FD_BASE)) < 0) {
+				perror("creando l'eventfd di un worker");
+				exit(EXIT_FAILURE);
+			}
+			close(wakefd);
+			struct epoll_event wev;
+			memset(&wev, 0, sizeof(wev));
+			wev.events = EPOLLIN;
+			wev.data.fd = worker_queues[i].wakefd;
+			if (epoll_ctl(WORKER_EPOLLFD(i), EPOLL_CTL_ADD, worker_queues[i].wakefd, &wev) < 0) {
+				perror("registrando l'eventfd di un worker");
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
 	pthread_mutex_init(&connected_mutex, NULL);
 	pthread_mutex_init(&stats_mutex, NULL);
-	signal_handler = pthread_self();
 	// Crea i vari thread
 	pthread_create(&listener, NULL, &listener_thread, NULL);
 	for (unsigned int i = 0; i < ThreadsInPool; ++i) {
-		// ricicla lo spazio di freefd per passare ai worker il loro numero
-		freefd[i] = i;
-		pthread_create(pool + i, NULL, &worker_thread, freefd + i);
+		worker_number[i] = i;
+		pthread_create(pool + i, NULL,
+			DispatchMode == DISPATCH_REACTOR ? &reactor_thread
+				: DispatchMode == DISPATCH_STEALING ? &stealing_thread
+				: &worker_thread,
+			worker_number + i);
+	}
+	for (unsigned int i = 0; i < FileThreadsInPool; ++i) {
+		file_thread_number[i] = i;
+		pthread_create(file_pool + i, NULL, &file_thread, file_thread_number + i);
 	}
 	// Diventa il thread che gestisce i segnali
 	signal_handler_thread(&signalmask);
@@ -519,6 +1299,9 @@ int main(int argc, char *argv[]) {
 	for (unsigned int i = 0; i < ThreadsInPool; ++i) {
 		pthread_join(pool[i], NULL);
 	}
+	for (unsigned int i = 0; i < FileThreadsInPool; ++i) {
+		pthread_join(file_pool[i], NULL);
+	}
 
 	// Elimina il socket
 	#if defined DEBUG && defined VERBOSE
@@ -530,21 +1313,52 @@ int main(int argc, char *argv[]) {
 		fprintf(stderr, "Cancello la coda condivisa\n");
 	#endif
 	clear_fifo(&queue);
+	clear_fifo(&file_queue);
+	free(file_jobs);
 	#if defined DEBUG && defined VERBOSE
 		fprintf(stderr, "Libero gli array di comunicazione listener-worker\n");
 	#endif
-	free(freefd);
-	free(freefd_ack);
-	// libera tutti i valori inizializzati di fd_to_nickname
+	for (int i = 0; i < ThreadsInPool + FileThreadsInPool; ++i) {
+		clear_spsc(returned_fds + i);
+	}
+	free(returned_fds);
+	free(worker_load);
+	if (DispatchMode == DISPATCH_STEALING) {
+		for (int i = 0; i < ThreadsInPool; ++i) {
+			clear_deque(&(worker_queues[i].deque));
+		}
+	}
+	if (DispatchMode == DISPATCH_REACTOR) {
+		for (int i = 0; i < ThreadsInPool; ++i) {
+			close(WORKER_EPOLLFD(i));
+			close(worker_queues[i].wakefd);
+		}
+		close(TERMINATION_EVENTFD);
+	}
+	if (DispatchMode == DISPATCH_STEALING || DispatchMode == DISPATCH_REACTOR) {
+		for (int i = 0; i < ThreadsInPool; ++i) {
+			clear_spsc(&(worker_queues[i].inbox));
+		}
+		free(worker_queues);
+	}
+
+	// I nickname_t delle sessioni appartengono a nickname_htable
 	#if defined DEBUG && defined VERBOSE
-		fprintf(stderr, "Svuoto fd_to_nickname\n");
+		fprintf(stderr, "Svuoto i buffer dei client\n");
 	#endif
 	for (int i = 0; i < MaxConnections; ++i) {
-		if (fd_to_nickname[i] != NULL) {
-			free(fd_to_nickname[i]);
-		}
+		resetReader(fd_readers + i);
+		resetWriter(&(fd_outqueues[i].writer));
+		pthread_mutex_destroy(&(fd_outqueues[i].mutex));
+	}
+	free(fd_sessions);
+	free(presence_subs);
+	free(fd_readers);
+	free(fd_outqueues);
+	close(OUT_EPOLLFD);
+	if (UseIoUring) {
+		clear_uring(&listener_ring);
 	}
-	free(fd_to_nickname);
 	// Non ci sono altri thread oltre a main, quindi nessuno ha il lock
 	pthread_mutex_destroy(&connected_mutex);
 	pthread_mutex_destroy(&stats_mutex);
@@ -552,6 +1366,12 @@ int main(int argc, char *argv[]) {
 		fprintf(stderr, "Elimino l'hashtable\n");
 	#endif
 	ts_hash_destroy(nickname_htable);
+	// i worker sono terminati, quindi nessuno è più in una sezione
+	epoch_cleanup();
+	clear_bcast_log(&broadcasts);
+	clear_online_list(&online_users);
+	clear_file_cache(&file_cache);
+	clear_file_store(&file_store);
 
 	return 0;
 }
@@ -17,6 +17,8 @@
 
 /* aggiungere altre define qui */
 
+#define CACHE_LINE_SIZE                  64 /**< dimensione di una linea di cache */
+
 
 
 // to avoid warnings like "ISO C forbids an empty translation unit"
@@ -1,3 +1,7 @@
+#include <poll.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+
 #include "connections.h"
 
 /**
@@ -73,11 +77,29 @@ int openConnection(char* path, unsigned int ntimes, unsigned int secs) {
 
 // -------- receiver side -----
 
+/**
+* @brief Aspetta che un fd non bloccante sia pronto
+*
+* @param fd il descrittore di file
+* @param events POLLIN o POLLOUT
+*
+* @return < 0 in caso di errore (e imposta errno)
+*/
+static int waitFd(long fd, short events) {
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = events;
+	int res;
+	while ((res = poll(&pfd, 1, -1)) < 0 && errno == EINTR);
+	return res;
+}
+
 /**
 * @brief Legge un certo numero di byte da un file descriptor
 *
 * La lettura avviene garantendo la sicurezza da interruzioni (la read viene
-* riavviata) o da short read/write.
+* riavviata) o da short read/write. Se il fd è non bloccante aspetta che
+* arrivino i dati, quindi si comporta sempre come una lettura bloccante.
 * Oltre a leggere i byte, imposta errno se la read restituisce un errore
 *
 * @param fd il descrittore di file da cui leggere
@@ -97,6 +119,8 @@ static int readByte(long fd, void* buf, size_t byte) {
 		if (byte_read < 0) {
 			if (errno == EINTR)
 				continue; //continua il ciclo
+			if ((errno == EAGAIN || errno == EWOULDBLOCK) && waitFd(fd, POLLIN) >= 0)
+				continue;
 			// vuol dire che il socket ha avuto dei problemi, già settato errno
 			return -1;
 		}
@@ -144,6 +168,189 @@ int readMsg(long fd, message_t *msg) {
 	// readData restituisce già il valore corretto, impostando errno se serve
 }
 
+/**
+* @brief Calcola la lunghezza del frame che inizia in reader->start
+*
+* @param reader il buffer di ricezione
+* @param hdr_size sizeof(message_hdr_t) se il frame è un messaggio intero, 0 se
+*                 è solo un body
+*
+* @return la lunghezza del frame, oppure la lunghezza minima che deve avere se
+*         l'header del body non è ancora arrivato
+*/
+static size_t frameLength(msg_reader_t* reader, size_t hdr_size) {
+	size_t fixed = hdr_size + sizeof(message_data_hdr_t);
+	if (reader->end - reader->start < fixed)
+		return fixed;
+	message_data_hdr_t data_hdr;
+	memcpy(&data_hdr, reader->buf + reader->start + hdr_size, sizeof(message_data_hdr_t));
+	return fixed + data_hdr.len;
+}
+
+/**
+* @brief Estrae un frame completo dal buffer di ricezione
+*
+* Gli header vengono copiati (nel buffer potrebbero non essere allineati), il
+* body resta nel buffer.
+*
+* @param reader il buffer di ricezione
+* @param hdr dove scrivere l'header del messaggio, NULL se il frame è solo un
+*            body
+* @param data dove scrivere il body
+* @param len la lunghezza del frame, calcolata con frameLength
+*/
+static void parseFrame(msg_reader_t* reader, message_hdr_t* hdr, message_data_t* data, size_t len) {
+	char* p = reader->buf + reader->start;
+	if (hdr != NULL) {
+		memcpy(hdr, p, sizeof(message_hdr_t));
+		p += sizeof(message_hdr_t);
+	}
+	memcpy(&(data->hdr), p, sizeof(message_data_hdr_t));
+	data->buf = p + sizeof(message_data_hdr_t);
+	reader->start += len;
+}
+
+/**
+* @brief Prepara il buffer di ricezione per una read
+*
+* Sposta all'inizio i dati non ancora consumati e, se serve, ingrandisce il
+* buffer perché possa contenere un frame lungo len.
+*
+* @param reader il buffer di ricezione
+* @param len la lunghezza del frame da completare
+*
+* @return < 0 se non c'è abbastanza memoria (e imposta errno)
+*/
+static int makeRoom(msg_reader_t* reader, size_t len) {
+	if (reader->start == reader->end) {
+		reader->start = reader->end = 0;
+		if (reader->size > READER_MAX_IDLE_SIZE) {
+			// Non tiene occupata memoria dopo un messaggio molto grande
+			free(reader->buf);
+			reader->buf = NULL;
+			reader->size = 0;
+		}
+	}
+	else if (reader->start > 0 && reader->size - reader->start < len) {
+		memmove(reader->buf, reader->buf + reader->start, reader->end - reader->start);
+		reader->end -= reader->start;
+		reader->start = 0;
+	}
+	if (reader->size - reader->start < len || reader->buf == NULL) {
+		size_t new_size = reader->size > 0 ? reader->size : READER_INITIAL_SIZE;
+		while (new_size < reader->start + len)
+			new_size *= 2;
+		char* new_buf = realloc(reader->buf, new_size);
+		if (new_buf == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		reader->buf = new_buf;
+		reader->size = new_size;
+	}
+	return 0;
+}
+
+// Estrae il prossimo messaggio da un fd non bloccante
+int readMsgNonBlocking(long fd, msg_reader_t* reader, message_t* msg) {
+	bool drained = false;
+	while (true) {
+		size_t len = frameLength(reader, sizeof(message_hdr_t));
+		if (reader->end - reader->start >= len) {
+			parseFrame(reader, &(msg->hdr), &(msg->data), len);
+			return 1;
+		}
+		if (drained) {
+			// Il messaggio resta a metà nel buffer
+			errno = EAGAIN;
+			return -1;
+		}
+		if (makeRoom(reader, len) < 0)
+			return -1;
+		size_t space = reader->size - reader->end;
+		ssize_t byte_read = read(fd, reader->buf + reader->end, space);
+		if (byte_read < 0) {
+			if (errno == EINTR)
+				continue;
+			// Anche EAGAIN: non è arrivato niente dall'ultima volta
+			return -1;
+		}
+		if (byte_read == 0)
+			return 0;
+		reader->end += byte_read;
+		// Se la read non ha riempito lo spazio libero il socket è vuoto: non
+		// serve un'altra read solo per ricevere EAGAIN
+		drained = (size_t)byte_read < space;
+	}
+}
+
+// Legge un body passando dal buffer di ricezione
+int readDataBuffered(long fd, msg_reader_t* reader, message_data_t* data) {
+	while (true) {
+		size_t len = frameLength(reader, 0);
+		if (reader->end - reader->start >= len) {
+			parseFrame(reader, NULL, data, len);
+			return 1;
+		}
+		if (makeRoom(reader, len) < 0)
+			return -1;
+		ssize_t byte_read = read(fd, reader->buf + reader->end, reader->size - reader->end);
+		if (byte_read < 0) {
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN || errno == EWOULDBLOCK) && waitFd(fd, POLLIN) >= 0)
+				continue;
+			return -1;
+		}
+		if (byte_read == 0)
+			return 0;
+		reader->end += byte_read;
+	}
+}
+
+// Legge l'header di un body passando dal buffer di ricezione
+int readDataHdrBuffered(long fd, msg_reader_t* reader, message_data_hdr_t* hdr) {
+	size_t avail = reader->end - reader->start;
+	if (avail >= sizeof(message_data_hdr_t)) {
+		memcpy(hdr, reader->buf + reader->start, sizeof(message_data_hdr_t));
+		reader->start += sizeof(message_data_hdr_t);
+		return 1;
+	}
+	// Copia la parte già arrivata e legge il resto direttamente
+	memcpy(hdr, reader->buf + reader->start, avail);
+	reader->start = reader->end;
+	return readByte(fd, (char*)hdr + avail, sizeof(message_data_hdr_t) - avail);
+}
+
+// Legge una parte di un body passando dal buffer di ricezione
+ssize_t readChunkBuffered(long fd, msg_reader_t* reader, char* buf, size_t byte) {
+	size_t avail = reader->end - reader->start;
+	if (avail > 0) {
+		if (avail > byte)
+			avail = byte;
+		memcpy(buf, reader->buf + reader->start, avail);
+		reader->start += avail;
+		return avail;
+	}
+	while (true) {
+		ssize_t byte_read = read(fd, buf, byte);
+		if (byte_read < 0) {
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN || errno == EWOULDBLOCK) && waitFd(fd, POLLIN) >= 0)
+				continue;
+			return -1;
+		}
+		return byte_read;
+	}
+}
+
+// Libera il buffer di ricezione
+void resetReader(msg_reader_t* reader) {
+	free(reader->buf);
+	memset(reader, 0, sizeof(msg_reader_t));
+}
+
 
 // ------- sender side ------
 
@@ -151,7 +358,8 @@ int readMsg(long fd, message_t *msg) {
 * @brief Scrive un certo numero di byte su un file descriptor
 *
 * La scrittura avviene garantendo la sicurezza da interruzioni (la write viene
-* riavviata) o da short read/write.
+* riavviata) o da short read/write. Se il fd è non bloccante e il buffer del
+* socket è pieno aspetta che si liberi.
 * Oltre a scrivere i byte, imposta errno se la write restituisce un errore
 *
 * @param fd il descrittore di file su cui scrivere
@@ -169,6 +377,8 @@ static int sendByte(long fd, void* buf, size_t byte) {
 		if (byte_written < 0) {
 			if (errno == EINTR)
 				continue; // continua il ciclo
+			if ((errno == EAGAIN || errno == EWOULDBLOCK) && waitFd(fd, POLLOUT) >= 0)
+				continue;
 			errno = EPIPE;
 			return -1;
 		}
@@ -182,12 +392,86 @@ static int sendByte(long fd, void* buf, size_t byte) {
 }
 
 
+// Documentata in connections.h
+void skipIov(struct iovec** iov, int* iovcnt, size_t byte) {
+	while (*iovcnt > 0 && byte >= (*iov)->iov_len) {
+		byte -= (*iov)->iov_len;
+		++(*iov);
+		--(*iovcnt);
+	}
+	if (*iovcnt > 0) {
+		(*iov)->iov_base = (char*)(*iov)->iov_base + byte;
+		(*iov)->iov_len -= byte;
+	}
+}
+
+/**
+* @brief Scrive una sequenza di buffer su un file descriptor con writev
+*
+* Come sendByte gestisce interruzioni, scritture parziali (anche a metà di un
+* buffer) e fd non bloccanti. Per non superare il limite di buffer per singola
+* writev ne scrive al più SEND_MAX_IOV alla volta.
+*
+* @param fd il descrittore di file su cui scrivere
+* @param iov i buffer da scrivere, in ordine. L'array viene modificato
+* @param iovcnt il numero di buffer
+*
+* @return 1 se ha scritto tutto,
+*         0 se ha scritto 0 byte (ovvero se la connessione è chiusa),
+*         < 0 in caso di errore (e imposta errno)
+*/
+static int sendIov(long fd, struct iovec* iov, int iovcnt) {
+	while (true) {
+		// Salta i buffer già scritti del tutto (o vuoti)
+		while (iovcnt > 0 && iov->iov_len == 0) {
+			++iov;
+			--iovcnt;
+		}
+		if (iovcnt == 0)
+			return 1;
+		ssize_t byte_written = writev(fd, iov, iovcnt < SEND_MAX_IOV ? iovcnt : SEND_MAX_IOV);
+		if (byte_written < 0) {
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN || errno == EWOULDBLOCK) && waitFd(fd, POLLOUT) >= 0)
+				continue;
+			errno = EPIPE;
+			return -1;
+		}
+		if (byte_written == 0)
+			return 0;
+		skipIov(&iov, &iovcnt, byte_written);
+	}
+}
+
+// Documentata in connections.h
+void msgToIov(struct iovec* iov, message_t* msg) {
+	iov[0].iov_base = &(msg->hdr);
+	iov[0].iov_len = sizeof(message_hdr_t);
+	iov[1].iov_base = &(msg->data.hdr);
+	iov[1].iov_len = sizeof(message_data_hdr_t);
+	iov[2].iov_base = msg->data.buf;
+	iov[2].iov_len = msg->data.hdr.len;
+}
+
 int sendRequest(long fd, message_t *msg) {
-	// Scrive l'header
-	int result = sendHeader(fd, &(msg->hdr));
-	if (result <= 0)
-		return result;  //errno già impostato da sendHeader
-	return sendData(fd, &(msg->data));
+	// Header, header dei dati e dati con una sola syscall
+	struct iovec iov[3];
+	msgToIov(iov, msg);
+	return sendIov(fd, iov, 3);
+}
+
+int sendRequests(long fd, message_t **msgs, int n) {
+	struct iovec* iov = malloc(3 * n * sizeof(struct iovec));
+	if (iov == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	for (int i = 0; i < n; ++i)
+		msgToIov(iov + 3 * i, msgs[i]);
+	int result = sendIov(fd, iov, 3 * n);
+	free(iov);
+	return result;
 }
 
 int sendHeader(long fd, message_hdr_t *hdr) {
@@ -195,13 +479,12 @@ int sendHeader(long fd, message_hdr_t *hdr) {
 }
 
 int sendData(long fd, message_data_t *data) {
-	// Scrive l'header dei dati
-	int result = sendByte(fd, &(data->hdr), sizeof(message_data_hdr_t));
-	if (result <= 0)
-		return result; //errno già impostato da sendByte
-
-	// Scriver i dati veri e propri
-	return sendByte(fd, data->buf, data->hdr.len);
-	// valore di ritorno di sendByte già corretto
-	// errno già impostato da sendByte
+	// Scrive l'header dei dati e i dati veri e propri insieme
+	struct iovec iov[2];
+	iov[0].iov_base = &(data->hdr);
+	iov[0].iov_len = sizeof(message_data_hdr_t);
+	iov[1].iov_base = data->buf;
+	iov[1].iov_len = data->hdr.len;
+	return sendIov(fd, iov, 2);
+	// errno già impostato da sendIov
 }
@@ -10,6 +10,8 @@
 
 #define MAX_RETRIES     10
 #define MAX_SLEEPING     3
+#define SEND_MAX_IOV  1024 /**< numero massimo di buffer scritti con una sola
+                                writev (il limite di Linux) */
 #if !defined(UNIX_PATH_MAX)
 #define UNIX_PATH_MAX  64
 #endif
@@ -21,6 +23,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 
 #include <message.h>
@@ -127,6 +130,127 @@ int readData(long fd, message_data_t *data);
  */
 int readMsg(long fd, message_t *msg);
 
+#define READER_INITIAL_SIZE 4096   /**< dimensione iniziale del buffer di
+                                         ricezione di un msg_reader_t */
+#define READER_MAX_IDLE_SIZE 65536 /**< un buffer di ricezione vuoto più grande
+                                        di così viene liberato */
+
+/**
+ * @struct msg_reader
+ * @brief Buffer di ricezione di una connessione non bloccante
+ *
+ * Ogni read prende tutti i dati disponibili sul socket (fino allo spazio
+ * libero nel buffer), anche se contengono più messaggi, e i messaggi completi
+ * vengono poi estratti dal buffer senza altre syscall. Quello che resta di un
+ * messaggio arrivato a metà viene conservato fino alla chiamata successiva.
+ * Una struttura azzerata (ad esempio con calloc) è pronta all'uso.
+ *
+ * I dati tra start e end sono ricevuti ma non ancora consumati.
+ *
+ * @var struct msg_reader::buf Il buffer di ricezione
+ * @var struct msg_reader::size Dimensione di buf
+ * @var struct msg_reader::start Inizio dei dati non ancora consumati
+ * @var struct msg_reader::end Fine dei dati ricevuti
+ */
+typedef struct msg_reader {
+	char* buf;
+	size_t size;
+	size_t start;
+	size_t end;
+} msg_reader_t;
+
+/**
+ * @function readMsgNonBlocking
+ * @brief Estrae il prossimo messaggio da una connessione non bloccante
+ *
+ * Se nel buffer c'è già un messaggio completo lo restituisce senza fare
+ * syscall, altrimenti fa una read per prendere tutto quello che il client ha
+ * inviato. Se il messaggio non è ancora arrivato tutto la parte ricevuta resta
+ * nel buffer e la lettura riprende con una chiamata successiva.
+ *
+ * Il buffer del body restituito punta dentro il buffer di ricezione: resta
+ * valido solo fino alla chiamata successiva di readMsgNonBlocking o
+ * readDataBuffered sullo stesso reader, e non va liberato. Chi deve
+ * conservarlo più a lungo deve copiarlo.
+ *
+ * @param fd     descrittore della connessione (con O_NONBLOCK)
+ * @param reader buffer di ricezione associato alla connessione
+ * @param msg    puntatore su cui viene scritto il messaggio completo
+ *
+ * @return 1 se il messaggio è completo,
+ *         0 se la connessione è chiusa,
+ *         < 0 in caso di errore (errno vale EAGAIN o EWOULDBLOCK se il
+ *         messaggio non è ancora arrivato tutto)
+ */
+int readMsgNonBlocking(long fd, msg_reader_t* reader, message_t* msg);
+
+/**
+ * @function readDataBuffered
+ * @brief Legge un body passando dal buffer di ricezione, aspettando se serve
+ *
+ * Serve per le operazioni che dopo il messaggio si aspettano un secondo body
+ * (POSTFILE_OP): una parte potrebbe essere già arrivata insieme al messaggio.
+ * A differenza di readMsgNonBlocking si blocca finché il body non è completo.
+ *
+ * Il buffer restituito segue le stesse regole di readMsgNonBlocking, e la
+ * chiamata invalida anche i buffer restituiti in precedenza.
+ *
+ * @param fd     descrittore della connessione
+ * @param reader buffer di ricezione associato alla connessione
+ * @param data   puntatore su cui viene scritto il body
+ *
+ * @return <=0 se c'e' stato un errore
+ *         (se <0 errno deve essere settato, se == 0 connessione chiusa)
+ */
+int readDataBuffered(long fd, msg_reader_t* reader, message_data_t* data);
+
+/**
+ * @function readDataHdrBuffered
+ * @brief Legge solo l'header di un body passando dal buffer di ricezione,
+ *        aspettando se serve
+ *
+ * Permette di controllare la lunghezza di un body prima di riceverlo; il body
+ * va poi letto con readChunkBuffered.
+ *
+ * @param fd     descrittore della connessione
+ * @param reader buffer di ricezione associato alla connessione
+ * @param hdr    puntatore su cui viene scritto l'header del body
+ *
+ * @return <=0 se c'e' stato un errore
+ *         (se <0 errno deve essere settato, se == 0 connessione chiusa)
+ */
+int readDataHdrBuffered(long fd, msg_reader_t* reader, message_data_hdr_t* hdr);
+
+/**
+ * @function readChunkBuffered
+ * @brief Legge al più byte byte, prima dal buffer di ricezione poi dal socket
+ *
+ * I dati già nel buffer di ricezione vengono copiati, gli altri letti
+ * direttamente in buf, quindi il buffer di ricezione non cresce. Aspetta se
+ * non c'è ancora niente da leggere.
+ *
+ * @param fd     descrittore della connessione
+ * @param reader buffer di ricezione associato alla connessione
+ * @param buf    dove scrivere i dati, di almeno byte byte
+ * @param byte   il numero massimo di byte da leggere
+ *
+ * @return il numero di byte letti (> 0),
+ *         0 se la connessione è chiusa,
+ *         < 0 in caso di errore (e imposta errno)
+ */
+ssize_t readChunkBuffered(long fd, msg_reader_t* reader, char* buf, size_t byte);
+
+/**
+ * @function resetReader
+ * @brief Libera il buffer di ricezione di una connessione
+ *
+ * Va chiamata quando la connessione viene chiusa, prima di riusare la
+ * struttura per un altro fd.
+ *
+ * @param reader il buffer di ricezione da azzerare
+ */
+void resetReader(msg_reader_t* reader);
+
 
 // ------- sender side ------
 
@@ -138,6 +262,9 @@ int readMsg(long fd, message_t *msg);
  * leggerlo correttamente sia con una chiamata readMsg che con le due chiamate
  * consecutive di readHeader e readData.
  *
+ * L'intero messaggio viene inviato con una sola writev (più di una solo se il
+ * socket non riesce ad accettarlo tutto insieme).
+ *
  * @param fd     descrittore della connessione
  * @param msg    puntatore al messaggio da inviare
  *
@@ -145,6 +272,21 @@ int readMsg(long fd, message_t *msg);
  */
 int sendRequest(long fd, message_t *msg);
 
+/**
+ * @function sendRequests
+ * @brief Invia più messaggi di fila sulla stessa connessione.
+ *
+ * Equivale a chiamare sendRequest su ogni messaggio, ma li scrive tutti con
+ * una sola writev (o poche, se sono più di SEND_MAX_IOV / 3).
+ *
+ * @param fd     descrittore della connessione
+ * @param msgs   array di puntatori ai messaggi da inviare, in ordine
+ * @param n      numero di messaggi
+ *
+ * @return <=0 se c'e' stato un errore
+ */
+int sendRequests(long fd, message_t **msgs, int n);
+
 /**
  * @brief Invia l'header di un messaggio.
  *
@@ -166,5 +308,28 @@ int sendHeader(long fd, message_hdr_t *hdr);
  */
 int sendData(long fd, message_data_t *data);
 
+/**
+ * @function msgToIov
+ * @brief Prepara i tre buffer che compongono un messaggio, nell'ordine in cui
+ *        vanno inviati
+ *
+ * @param iov    dove scrivere i buffer, deve avere posto per 3 elementi
+ * @param msg    il messaggio
+ */
+void msgToIov(struct iovec* iov, message_t* msg);
+
+/**
+ * @function skipIov
+ * @brief Avanza in una sequenza di buffer di un certo numero di byte, anche a
+ *        metà di un buffer
+ *
+ * @param iov    puntatore all'array di buffer, viene spostato oltre quelli
+ *               consumati del tutto
+ * @param iovcnt puntatore al numero di buffer rimasti
+ * @param byte   il numero di byte da consumare (al più la somma delle
+ *               lunghezze)
+ */
+void skipIov(struct iovec** iov, int* iovcnt, size_t byte);
+
 
 #endif /* CONNECTIONS_H_ */
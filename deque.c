@@ -0,0 +1,96 @@
+/**
+ * @file deque.c
+ * @brief Implementazione di deque.h
+ *
+ * Segue la versione con gli atomici di C11 descritta da Lê, Pop, Cohen e
+ * Zappa Nardelli ("Correct and Efficient Work-Stealing for Weak Memory
+ * Models"), senza ridimensionamento dell'array.
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+
+#include "deque.h"
+
+// ------- Funzioni esportate --------------
+// Documentate in deque.h
+
+int create_deque(deque_t* d, size_t capacity) {
+	size_t size = 1;
+	while (size < capacity) {
+		size <<= 1;
+	}
+	if ((d->buf = malloc(size * sizeof(DEQUE_TYPE_T))) == NULL) {
+		return -1;
+	}
+	d->mask = size - 1;
+	d->top = d->bottom = 0;
+	return 0;
+}
+
+void clear_deque(deque_t* d) {
+	free(d->buf);
+	d->buf = NULL;
+}
+
+bool deque_push(deque_t* d, DEQUE_TYPE_T v) {
+	long b = __atomic_load_n(&(d->bottom), __ATOMIC_RELAXED);
+	long t = __atomic_load_n(&(d->top), __ATOMIC_ACQUIRE);
+	if (b - t > d->mask) {
+		return false;
+	}
+	// L'elemento può essere letto da un ladro in contemporanea a una
+	// scrittura successiva nella stessa cella, quindi l'accesso è atomico
+	__atomic_store_n(d->buf + (b & d->mask), v, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&(d->bottom), b + 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+bool deque_pop(deque_t* d, DEQUE_TYPE_T* v) {
+	long b = __atomic_load_n(&(d->bottom), __ATOMIC_RELAXED) - 1;
+	__atomic_store_n(&(d->bottom), b, __ATOMIC_RELAXED);
+	// Prenota l'elemento prima di leggere top: un ladro che legge il vecchio
+	// bottom dopo questo punto vede anche il nuovo
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	long t = __atomic_load_n(&(d->top), __ATOMIC_RELAXED);
+	bool res = true;
+	if (t <= b) {
+		*v = __atomic_load_n(d->buf + (b & d->mask), __ATOMIC_RELAXED);
+		if (t == b) {
+			// Ultimo elemento: è conteso con i ladri
+			res = __atomic_compare_exchange_n(&(d->top), &t, t + 1, false,
+			                                  __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+			__atomic_store_n(&(d->bottom), b + 1, __ATOMIC_RELAXED);
+		}
+	}
+	else {
+		// Deque vuota
+		res = false;
+		__atomic_store_n(&(d->bottom), b + 1, __ATOMIC_RELAXED);
+	}
+	return res;
+}
+
+bool deque_steal(deque_t* d, DEQUE_TYPE_T* v) {
+	long t = __atomic_load_n(&(d->top), __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	long b = __atomic_load_n(&(d->bottom), __ATOMIC_ACQUIRE);
+	if (t >= b) {
+		return false;
+	}
+	*v = __atomic_load_n(d->buf + (t & d->mask), __ATOMIC_RELAXED);
+	// Se la CAS fallisce l'elemento è stato preso da qualcun altro
+	return __atomic_compare_exchange_n(&(d->top), &t, t + 1, false,
+	                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+size_t deque_size(deque_t* d) {
+	long b = __atomic_load_n(&(d->bottom), __ATOMIC_ACQUIRE);
+	long t = __atomic_load_n(&(d->top), __ATOMIC_ACQUIRE);
+	return b > t ? b - t : 0;
+}
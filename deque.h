@@ -0,0 +1,108 @@
+/**
+ * @file deque.h
+ * @brief Libreria per una deque lock-free per il work stealing (Chase-Lev)
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+#ifndef CHATTERBOX_DEQUE_H_
+#define CHATTERBOX_DEQUE_H_
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <config.h>
+
+#define DEQUE_TYPE_T int /**< il tipo degli elementi della deque */
+
+/**
+ * @struct deque
+ * @brief Deque di Chase-Lev a capacità fissa
+ *
+ * Un solo thread, il proprietario, inserisce ed estrae dal fondo (bottom),
+ * quindi vede gli elementi in ordine LIFO e riprende per primi quelli usati
+ * più di recente. Gli altri thread possono rubare elementi dalla cima (top),
+ * cioè i più vecchi. Solo l'ultimo elemento rimasto è conteso tra proprietario
+ * e ladri, e viene assegnato con una CAS su top.
+ *
+ * top e bottom crescono sempre e vengono ridotti modulo la capacità (una
+ * potenza di 2) solo per accedere a buf; sono su linee di cache separate
+ * perché bottom è scritto solo dal proprietario.
+ *
+ * @var struct deque::buf Array circolare degli elementi
+ * @var struct deque::mask Capacità della deque meno 1
+ * @var struct deque::top Indice del prossimo elemento da rubare
+ * @var struct deque::bottom Indice della prossima posizione libera
+ */
+typedef struct deque {
+	DEQUE_TYPE_T* buf;
+	long mask;
+	char pad0[CACHE_LINE_SIZE];
+	long top;
+	char pad1[CACHE_LINE_SIZE - sizeof(long)];
+	long bottom;
+	char pad2[CACHE_LINE_SIZE - sizeof(long)];
+} deque_t;
+
+/**
+ * @brief Inizializza una nuova deque vuota
+ * @param d La deque da inizializzare
+ * @param capacity Il numero minimo di elementi che la deque deve poter
+ *                 contenere (viene arrotondato alla potenza di 2 successiva)
+ * @return 0 in caso di successo, < 0 se non c'è abbastanza memoria
+ */
+int create_deque(deque_t* d, size_t capacity);
+
+/**
+ * @brief Libera la memoria occupata da una deque
+ * @param d la deque da svuotare
+ */
+void clear_deque(deque_t* d);
+
+/**
+ * @brief Inserisce un elemento in fondo alla deque. Può essere chiamata solo
+ * dal proprietario.
+ *
+ * @param d La deque in cui inserire l'elemento
+ * @param v L'elemento da inserire
+ * @return true se l'elemento è stato inserito, false se la deque è piena
+ */
+bool deque_push(deque_t* d, DEQUE_TYPE_T v);
+
+/**
+ * @brief Estrae l'ultimo elemento inserito. Può essere chiamata solo dal
+ * proprietario.
+ *
+ * @param d La deque da cui estrarre l'elemento
+ * @param v Puntatore su cui viene scritto l'elemento estratto
+ * @return true se è stato estratto un elemento, false se la deque era vuota
+ * (o un ladro ha preso l'ultimo elemento)
+ */
+bool deque_pop(deque_t* d, DEQUE_TYPE_T* v);
+
+/**
+ * @brief Ruba il primo elemento della deque. Può essere chiamata da qualsiasi
+ * thread, compreso il proprietario.
+ *
+ * @param d La deque da cui rubare l'elemento
+ * @param v Puntatore su cui viene scritto l'elemento estratto
+ * @return true se è stato estratto un elemento, false se la deque era vuota o
+ * un altro thread ha preso l'elemento per primo
+ */
+bool deque_steal(deque_t* d, DEQUE_TYPE_T* v);
+
+/**
+ * @brief Numero di elementi nella deque. Se altri thread la stanno usando il
+ * risultato è solo indicativo.
+ *
+ * @param d La deque
+ * @return il numero di elementi presenti
+ */
+size_t deque_size(deque_t* d);
+
+#endif /* CHATTERBOX_DEQUE_H_ */
@@ -0,0 +1,174 @@
+/**
+ * @file epoch.c
+ * @brief Implementazione di epoch.h
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+
+#include "epoch.h"
+
+/**
+ * @struct epoch_garbage
+ * @brief Un oggetto in attesa di essere liberato
+ *
+ * @var struct epoch_garbage::next L'oggetto tolto subito dopo
+ * @var struct epoch_garbage::ptr L'oggetto
+ * @var struct epoch_garbage::free_fun La funzione con cui liberarlo
+ * @var struct epoch_garbage::epoch L'epoca in cui è stato tolto
+ */
+typedef struct epoch_garbage {
+	struct epoch_garbage* next;
+	void* ptr;
+	void (*free_fun)(void*);
+	unsigned long epoch;
+} epoch_garbage_t;
+
+/**
+ * L'epoca globale, parte da 1 perché 0 indica un thread fuori dalle sezioni
+ */
+static unsigned long global_epoch = 1;
+
+/**
+ * Stato dei thread e numero di quelli usati
+ */
+static epoch_slot_t slots[EPOCH_MAX_THREADS];
+static int nslots = 0;
+
+/**
+ * Lo stato del thread corrente, assegnato al primo ingresso in una sezione
+ */
+static __thread epoch_slot_t* my_slot = NULL;
+
+/**
+ * Oggetti in attesa, in ordine di epoca (si aggiunge in coda, si libera dalla
+ * testa), protetti da garbage_mutex
+ */
+static pthread_mutex_t garbage_mutex = PTHREAD_MUTEX_INITIALIZER;
+static epoch_garbage_t* garbage_head = NULL;
+static epoch_garbage_t* garbage_tail = NULL;
+static long garbage_count = 0;
+
+// ------------------ Funzioni interne ---------------
+
+/**
+ * @brief Restituisce lo stato del thread corrente, assegnandogliene uno se non
+ * ce l'ha
+ */
+static epoch_slot_t* get_slot() {
+	if (my_slot == NULL) {
+		int n = __atomic_fetch_add(&nslots, 1, __ATOMIC_ACQ_REL);
+		if (n >= EPOCH_MAX_THREADS) {
+			fprintf(stderr, "Troppi thread per epoch.c (al più %d)\n", EPOCH_MAX_THREADS);
+			exit(EXIT_FAILURE);
+		}
+		my_slot = &(slots[n]);
+	}
+	return my_slot;
+}
+
+/**
+ * @brief Avanza l'epoca se tutti i thread in una sezione hanno visto quella
+ * corrente. Va chiamata con garbage_mutex presa.
+ */
+static void try_advance() {
+	unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+	int n = __atomic_load_n(&nslots, __ATOMIC_ACQUIRE);
+	if (n > EPOCH_MAX_THREADS)
+		n = EPOCH_MAX_THREADS;
+	for (int i = 0; i < n; ++i) {
+		unsigned long seen = __atomic_load_n(&(slots[i].epoch), __ATOMIC_SEQ_CST);
+		if (seen != 0 && seen != epoch)
+			return;
+	}
+	__atomic_store_n(&global_epoch, epoch + 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief Libera gli oggetti tolti almeno due epoche fa. Va chiamata con
+ * garbage_mutex presa.
+ */
+static void free_expired() {
+	unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+	while (garbage_head != NULL && garbage_head->epoch + 2 <= epoch) {
+		epoch_garbage_t* g = garbage_head;
+		garbage_head = g->next;
+		g->free_fun(g->ptr);
+		free(g);
+		__atomic_sub_fetch(&garbage_count, 1, __ATOMIC_RELAXED);
+	}
+	if (garbage_head == NULL)
+		garbage_tail = NULL;
+}
+
+// ------- Funzioni esportate --------------
+// Documentate in epoch.h
+
+void epoch_enter() {
+	epoch_slot_t* slot = get_slot();
+	if (slot->nesting++ == 0) {
+		__atomic_store_n(&(slot->epoch), __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST), __ATOMIC_RELAXED);
+		// le letture della sezione non devono avvenire prima che l'epoca
+		// sia visibile a try_advance
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	}
+}
+
+void epoch_exit() {
+	epoch_slot_t* slot = my_slot;
+	if (--slot->nesting == 0) {
+		__atomic_store_n(&(slot->epoch), 0, __ATOMIC_RELEASE);
+		if (__atomic_load_n(&garbage_count, __ATOMIC_RELAXED) > 0)
+			epoch_collect();
+	}
+}
+
+void epoch_retire(void* ptr, void (*free_fun)(void*)) {
+	epoch_garbage_t* g = malloc(sizeof(epoch_garbage_t));
+	g->next = NULL;
+	g->ptr = ptr;
+	g->free_fun = free_fun;
+	error_handling_lock(&garbage_mutex);
+	// ptr è già stato tolto: chi lo vede ancora è entrato in una sezione
+	// non dopo questa epoca
+	g->epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+	if (garbage_tail == NULL)
+		garbage_head = g;
+	else
+		garbage_tail->next = g;
+	garbage_tail = g;
+	__atomic_add_fetch(&garbage_count, 1, __ATOMIC_RELAXED);
+	try_advance();
+	free_expired();
+	error_handling_unlock(&garbage_mutex);
+}
+
+void epoch_collect() {
+	// se qualcun altro sta già liberando non serve aspettarlo
+	if (pthread_mutex_trylock(&garbage_mutex) != 0)
+		return;
+	try_advance();
+	free_expired();
+	error_handling_unlock(&garbage_mutex);
+}
+
+long epoch_pending() {
+	return __atomic_load_n(&garbage_count, __ATOMIC_RELAXED);
+}
+
+void epoch_cleanup() {
+	error_handling_lock(&garbage_mutex);
+	while (garbage_head != NULL) {
+		epoch_garbage_t* g = garbage_head;
+		garbage_head = g->next;
+		g->free_fun(g->ptr);
+		free(g);
+	}
+	garbage_tail = NULL;
+	garbage_count = 0;
+	error_handling_unlock(&garbage_mutex);
+}
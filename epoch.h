@@ -0,0 +1,101 @@
+/**
+ * @file epoch.h
+ * @brief Libreria per liberare la memoria condivisa letta senza lock
+ *        (epoch-based reclamation)
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ *
+ * Chi legge una struttura condivisa senza lock (ad esempio con hash_find) lo
+ * fa all'interno di una sezione, tra epoch_enter ed epoch_exit, e può usare i
+ * puntatori che trova fino alla fine della sezione. Chi toglie un oggetto
+ * dalla struttura non lo libera subito ma lo passa ad epoch_retire, che lo
+ * libera solo quando tutte le sezioni che potevano averlo visto sono finite.
+ *
+ * Per saperlo c'è un'epoca globale: ogni thread all'ingresso in una sezione
+ * si segna l'epoca corrente, e l'epoca avanza solo quando tutti i thread in
+ * una sezione hanno visto quella corrente. Un oggetto tolto durante l'epoca
+ * e può quindi essere liberato quando l'epoca arriva a e + 2.
+ *
+ * Entrare ed uscire da una sezione non richiede lock né operazioni atomiche
+ * read-modify-write, ma un thread che resta a lungo in una sezione impedisce
+ * di liberare la memoria (non di toglierla dalle strutture).
+ */
+#ifndef CHATTERBOX_EPOCH_H_
+#define CHATTERBOX_EPOCH_H_
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "lock.h"
+
+#define EPOCH_MAX_THREADS 1024 /**< numero massimo di thread che possono
+                                    entrare in una sezione */
+
+/**
+ * @struct epoch_slot
+ * @brief Stato di un thread, su una linea di cache tutta sua perché viene
+ * scritto ad ogni ingresso in una sezione
+ *
+ * @var struct epoch_slot::epoch L'epoca vista all'ingresso nella sezione, 0
+ *                               se il thread non è in una sezione
+ * @var struct epoch_slot::nesting Numero di sezioni annidate in cui si trova
+ *                                 il thread
+ */
+typedef struct epoch_slot {
+	unsigned long epoch;
+	int nesting;
+	char pad[CACHE_LINE_SIZE - sizeof(unsigned long) - sizeof(int)];
+} epoch_slot_t;
+
+/**
+ * @brief Entra in una sezione
+ *
+ * Le sezioni possono essere annidate: solo la più esterna conta.
+ */
+void epoch_enter();
+
+/**
+ * @brief Esce da una sezione
+ *
+ * Se ci sono oggetti in attesa e nessun altro thread li sta già liberando,
+ * prova a liberare quelli che non sono più raggiungibili.
+ */
+void epoch_exit();
+
+/**
+ * @brief Rimanda la liberazione di un oggetto già tolto dalle strutture
+ * condivise a quando nessuna sezione può più vederlo
+ *
+ * Può essere chiamata da qualsiasi thread, anche all'interno di una sezione.
+ *
+ * @param ptr l'oggetto
+ * @param free_fun la funzione con cui liberarlo
+ */
+void epoch_retire(void* ptr, void (*free_fun)(void*));
+
+/**
+ * @brief Prova ad avanzare l'epoca e libera gli oggetti che non sono più
+ * raggiungibili
+ */
+void epoch_collect();
+
+/**
+ * @brief Numero di oggetti passati ad epoch_retire non ancora liberati
+ */
+long epoch_pending();
+
+/**
+ * @brief Libera tutti gli oggetti in attesa
+ *
+ * Va chiamata alla terminazione, quando nessun thread è più in una sezione.
+ */
+void epoch_cleanup();
+
+#endif /* CHATTERBOX_EPOCH_H_ */
@@ -10,109 +10,162 @@
  *       flavio.ascari@sns.it
  */
 
-#include "fifo.h"
+#include <stdint.h>
+#include <string.h>
 
-/**
- * @struct node
- * @brief Nodo di una double linked list
- */
-struct node {
-	TYPE_T v;
-	struct node* next;
-	struct node* prev;
-};
+#include "fifo.h"
 
 
 // ------------------ Funzioni interne ---------------
 
 /**
- * @brief Controlla se la coda è vuota
- * @return True se e solo se la coda è vuota
+ * @brief Sveglia un thread bloccato sulla futex, se ce n'è almeno uno.
+ *
+ * La fence ordina l'operazione appena fatta sulla coda prima della lettura di
+ * waiters: un thread che si sta per bloccare o vede l'operazione quando
+ * riprova, oppure viene visto qui e svegliato.
  */
-static inline bool is_empty(fifo_t queue) {
-	return queue.head == NULL;
+static inline void wake_one(int* futex, int* waiters) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(waiters, __ATOMIC_RELAXED) > 0) {
+		__atomic_add_fetch(futex, 1, __ATOMIC_RELEASE);
+		futex_wake(futex, 1);
+	}
 }
 
 /**
- * @brief Implementazione della pop sulla double linked list
+ * @brief Prova ad inserire un elemento senza bloccarsi
+ * @return true se l'elemento è stato inserito, false se la coda è piena
  */
-static TYPE_T pop(fifo_t* queue) {
-	// si aspetta che l'utente abbia già controllato che queue non sia vuota
-	node_t* last = queue->tail;
-	TYPE_T res = queue->tail->v;
-	if (queue->tail == queue->head)
-		// se è l'unico elemento rimasto
-		queue->tail = queue->head = NULL;
-	else {
-		queue->tail = queue->tail->prev;
-		queue->tail->next = NULL;
+static bool try_push(fifo_t* q, TYPE_T v) {
+	fifo_cell_t* cell;
+	size_t pos = __atomic_load_n(&(q->enqueue_pos), __ATOMIC_RELAXED);
+	while (true) {
+		cell = q->buf + (pos & q->mask);
+		size_t seq = __atomic_load_n(&(cell->seq), __ATOMIC_ACQUIRE);
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+		if (diff == 0) {
+			// Cella libera per questo giro: prova a prenotarla
+			if (__atomic_compare_exchange_n(&(q->enqueue_pos), &pos, pos + 1,
+			                                true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+			// La CAS fallita ha già aggiornato pos
+		}
+		else if (diff < 0) {
+			// La cella contiene ancora un elemento del giro precedente
+			return false;
+		}
+		else {
+			// Un altro produttore ha preso questa posizione
+			pos = __atomic_load_n(&(q->enqueue_pos), __ATOMIC_RELAXED);
+		}
 	}
-	free(last);
-	return res;
+	cell->v = v;
+	__atomic_store_n(&(cell->seq), pos + 1, __ATOMIC_RELEASE);
+	return true;
 }
 
 /**
- * @brief Implementazione della push sulla double linked list
+ * @brief Prova ad estrarre un elemento senza bloccarsi
+ * @return true se è stato estratto un elemento, false se la coda è vuota
  */
-static void push(fifo_t* queue, TYPE_T v) {
-	node_t* new = malloc(sizeof(node_t));
-	new->prev = NULL;
-	new->v = v;
-	new->next = queue->head;
-	if (queue->head == NULL)
-		queue->tail = new;
-	else
-		queue->head->prev = new;
-	queue->head = new;
+static bool try_pop(fifo_t* q, TYPE_T* v) {
+	fifo_cell_t* cell;
+	size_t pos = __atomic_load_n(&(q->dequeue_pos), __ATOMIC_RELAXED);
+	while (true) {
+		cell = q->buf + (pos & q->mask);
+		size_t seq = __atomic_load_n(&(cell->seq), __ATOMIC_ACQUIRE);
+		intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&(q->dequeue_pos), &pos, pos + 1,
+			                                true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		}
+		else if (diff < 0) {
+			// Nessun produttore ha ancora pubblicato questa cella
+			return false;
+		}
+		else {
+			pos = __atomic_load_n(&(q->dequeue_pos), __ATOMIC_RELAXED);
+		}
+	}
+	*v = cell->v;
+	// La cella sarà di nuovo scrivibile al giro successivo
+	__atomic_store_n(&(cell->seq), pos + q->mask + 1, __ATOMIC_RELEASE);
+	return true;
 }
 
 // ------- Funzioni esportate --------------
 // Documentate in fifo.h
 
 // crea una nuova coda
-fifo_t create_fifo() {
+fifo_t create_fifo(size_t capacity) {
 	fifo_t res;
-	res.head = res.tail = NULL;
-	pthread_mutex_init(&(res.mutex), NULL);
-	pthread_cond_init(&(res.cond_empty), NULL);
+	memset(&res, 0, sizeof(res));
+	size_t size = 2;
+	while (size < capacity) {
+		size <<= 1;
+	}
+	if ((res.buf = malloc(size * sizeof(fifo_cell_t))) == NULL) {
+		return res;
+	}
+	for (size_t i = 0; i < size; ++i) {
+		res.buf[i].seq = i;
+	}
+	res.mask = size - 1;
 	return res;
 }
 
 // svuota la coda
 void clear_fifo(fifo_t* q) {
-	// TODO (opt): togliere la sincronizzazione
-	error_handling_lock(&(q->mutex));
-	while (!is_empty(*q)) {
-		// TODO (opt): la pop fa del lavoro inutile, riscrivere
-		pop(q);
-	}
-	error_handling_unlock(&(q->mutex));
-	pthread_mutex_destroy(&(q->mutex));
+	free(q->buf);
+	q->buf = NULL;
 }
 
 // Thread-safe pop
 TYPE_T ts_pop(fifo_t* q) {
 	TYPE_T n;
-	error_handling_lock(&(q->mutex));
-	while (is_empty(*q))
-		pthread_cond_wait(&(q->cond_empty), &(q->mutex));
-	n = pop(q);
-	error_handling_unlock(&(q->mutex));
+	while (!try_pop(q, &n)) {
+		// Legge il contatore prima di riprovare: se qualcuno inserisce dopo
+		// questa lettura, la futex_wait ritorna subito
+		int key = __atomic_load_n(&(q->not_empty), __ATOMIC_ACQUIRE);
+		__atomic_add_fetch(&(q->empty_waiters), 1, __ATOMIC_SEQ_CST);
+		if (try_pop(q, &n)) {
+			__atomic_sub_fetch(&(q->empty_waiters), 1, __ATOMIC_RELAXED);
+			break;
+		}
+		futex_wait(&(q->not_empty), key);
+		__atomic_sub_fetch(&(q->empty_waiters), 1, __ATOMIC_RELAXED);
+	}
+	wake_one(&(q->not_full), &(q->full_waiters));
 	return n;
 }
 
 // Thread-safe push
 void ts_push(fifo_t* q, TYPE_T v) {
-	error_handling_lock(&(q->mutex));
-	push(q, v);
-	pthread_cond_signal(&(q->cond_empty));
-	error_handling_unlock(&(q->mutex));
+	while (!try_push(q, v)) {
+		int key = __atomic_load_n(&(q->not_full), __ATOMIC_ACQUIRE);
+		__atomic_add_fetch(&(q->full_waiters), 1, __ATOMIC_SEQ_CST);
+		if (try_push(q, v)) {
+			__atomic_sub_fetch(&(q->full_waiters), 1, __ATOMIC_RELAXED);
+			break;
+		}
+		futex_wait(&(q->not_full), key);
+		__atomic_sub_fetch(&(q->full_waiters), 1, __ATOMIC_RELAXED);
+	}
+	wake_one(&(q->not_empty), &(q->empty_waiters));
+}
+
+size_t ts_size(fifo_t* q) {
+	// dequeue_pos non supera mai enqueue_pos, quindi va letto per primo
+	size_t head = __atomic_load_n(&(q->dequeue_pos), __ATOMIC_ACQUIRE);
+	return __atomic_load_n(&(q->enqueue_pos), __ATOMIC_ACQUIRE) - head;
 }
 
-bool ts_is_empty(fifo_t q){
-	bool r;
-	error_handling_lock(&(q.mutex));
-	r = is_empty(q);
-	error_handling_unlock(&(q.mutex));
-	return r;
+bool ts_is_empty(fifo_t* q){
+	size_t pos = __atomic_load_n(&(q->dequeue_pos), __ATOMIC_ACQUIRE);
+	size_t seq = __atomic_load_n(&(q->buf[pos & q->mask].seq), __ATOMIC_ACQUIRE);
+	return (intptr_t)seq - (intptr_t)(pos + 1) < 0;
 }
@@ -18,40 +18,81 @@
 #include <pthread.h>
 #include <unistd.h>
 
+#include <config.h>
 #include <message.h>
 #include "lock.h"
 
 #define TYPE_T int /**< il tipo degli elementi della coda */
 
-// strutture dati private, ridichiarate qui per necessità
-typedef struct node node_t;
-typedef node_t* dllist_t; /**< Tipo della double linked list*/
+/**
+ * @struct fifo_cell
+ * @brief Elemento dell'array circolare di fifo_t
+ * @var struct fifo_cell::seq Numero di sequenza della cella: dice se la cella
+ *                            è pronta per essere scritta o letta al giro
+ *                            corrente
+ * @var struct fifo_cell::v Il valore contenuto
+ */
+typedef struct fifo_cell {
+	size_t seq;
+	TYPE_T v;
+} fifo_cell_t;
 
 /**
  * @struct fifo
- * @brief Implementazione di fifo_t con una double linked list
- * @var struct fifo::head Testa dalla lista
- * @var struct fifo::tail Coda dalla lista
- * @var struct fifo::mutex Mutex interna della coda per implementare la
- *                         sincronizzazione tra thread
- * @var struct fifo::cond_empty Variabile di condizione interna su cui si bloccano
- *                              i thread che trovano la coda vuota in attesa di
- *                              nuovi elementi
+ * @brief Implementazione di fifo_t con un array circolare limitato lock-free
+ *
+ * Coda a più produttori e più consumatori basata sui numeri di sequenza delle
+ * celle (schema di Vyukov): push e pop prenotano una posizione con una CAS
+ * sul rispettivo indice e poi pubblicano la cella aggiornandone il numero di
+ * sequenza, quindi nel caso comune non prendono nessun lock.
+ *
+ * I thread si bloccano solo quando la coda è vuota (pop) o piena (push),
+ * aspettando su una futex. Ogni futex è un contatore che viene incrementato ad
+ * ogni risveglio, insieme al numero di thread in attesa: chi inserisce o
+ * estrae fa una syscall solo se qualcuno sta effettivamente dormendo.
+ *
+ * I due indici e le futex sono su linee di cache separate perché vengono
+ * scritti da thread diversi.
+ *
+ * @var struct fifo::buf Array circolare delle celle
+ * @var struct fifo::mask Capacità della coda meno 1 (la capacità è una potenza
+ *                        di 2)
+ * @var struct fifo::enqueue_pos Prossima posizione in cui inserire
+ * @var struct fifo::dequeue_pos Prossima posizione da cui estrarre
+ * @var struct fifo::not_empty Futex su cui si bloccano i thread che trovano la
+ *                             coda vuota
+ * @var struct fifo::empty_waiters Numero di thread bloccati su not_empty
+ * @var struct fifo::not_full Futex su cui si bloccano i thread che trovano la
+ *                            coda piena
+ * @var struct fifo::full_waiters Numero di thread bloccati su not_full
  */
 typedef struct fifo {
-	dllist_t head, tail;
-	pthread_mutex_t mutex;
-	pthread_cond_t cond_empty;
+	fifo_cell_t* buf;
+	size_t mask;
+	char pad0[CACHE_LINE_SIZE];
+	size_t enqueue_pos;
+	char pad1[CACHE_LINE_SIZE - sizeof(size_t)];
+	size_t dequeue_pos;
+	char pad2[CACHE_LINE_SIZE - sizeof(size_t)];
+	int not_empty, empty_waiters;
+	char pad3[CACHE_LINE_SIZE - 2 * sizeof(int)];
+	int not_full, full_waiters;
+	char pad4[CACHE_LINE_SIZE - 2 * sizeof(int)];
 } fifo_t;
 
 /**
  * @brief Inizializza una nuova coda vuota
- * @return la nuova coda
+ * @param capacity Il numero massimo di elementi contenuti nella coda (viene
+ *                 arrotondato alla potenza di 2 successiva)
+ * @return la nuova coda. Se non c'è abbastanza memoria il campo buf è NULL
  */
-fifo_t create_fifo();
+fifo_t create_fifo(size_t capacity);
 
 /**
  * @brief Svuota una coda per liberare la memoria
+ *
+ * Nessun thread deve usare la coda durante o dopo questa chiamata.
+ *
  * @param q la coda da svuotare
  */
 void clear_fifo(fifo_t* q);
@@ -60,7 +101,7 @@ void clear_fifo(fifo_t* q);
  * @brief Thread-safe pop
  *
  * Rimuove il primo elemento dalla coda, gestendo la sincronizzazione tra
- * thread.
+ * thread. Se la coda è vuota si blocca finché non viene inserito un elemento.
  *
  * @param q La coda da cui estrarre l'elemento
  * @return l'elemento rimosso dalla coda
@@ -71,7 +112,7 @@ TYPE_T ts_pop(fifo_t* q);
  * @brief Thread-safe push
  *
  * Inserisce un nuovo elementi in fondo alla coda, gestendo la sincronizzazione
- * tra thread.
+ * tra thread. Se la coda è piena si blocca finché non si libera un posto.
  *
  * @param q La coda in cui inserire l'elemento
  * @param v l'elemento da inserire
@@ -81,11 +122,25 @@ void ts_push(fifo_t* q, TYPE_T v);
 /**
  * @brief Thread-safe is_empty
  *
- * Controlla se la coda è vuota, gestendo la sincronizzazione tra thread.
+ * Controlla se la coda è vuota, gestendo la sincronizzazione tra thread. Il
+ * risultato può essere già superato quando la funzione ritorna, se altri
+ * thread stanno usando la coda.
  *
  * @param q La coda da controllare
  * @return true se e solo se la coda è vuota
  */
-bool ts_is_empty(fifo_t q);
+bool ts_is_empty(fifo_t* q);
+
+/**
+ * @brief Numero di elementi nella coda
+ *
+ * Conta anche gli inserimenti e le estrazioni già iniziati ma non ancora
+ * finiti: se altri thread stanno usando la coda il risultato è solo
+ * indicativo.
+ *
+ * @param q La coda
+ * @return il numero di elementi presenti
+ */
+size_t ts_size(fifo_t* q);
 
 #endif /* CHATTERBOX_FIFO_H_ */
@@ -0,0 +1,198 @@
+/**
+ * @file filecache.c
+ * @brief Implementazione di filecache.h
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "filecache.h"
+#include "strhash.h"
+
+// ------------------ Funzioni interne ---------------
+
+/**
+ * @brief Cerca un file nella cache. Va chiamata con la lock presa.
+ *
+ * @param cache La cache
+ * @param path Il percorso del file
+ * @param hash L'hash del percorso
+ * @return Il file, NULL se non è nella cache
+ */
+static file_entry_t* find_entry(file_cache_t* cache, const char* path, unsigned int hash) {
+	for (file_entry_t* e = cache->head; e != NULL; e = e->next) {
+		if (e->hash == hash && strcmp(e->path, path) == 0) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Toglie un file dalla lista. Va chiamata con la lock presa.
+ */
+static void unlink_entry(file_cache_t* cache, file_entry_t* e) {
+	if (e->prev == NULL) {
+		cache->head = e->next;
+	}
+	else {
+		e->prev->next = e->next;
+	}
+	if (e->next == NULL) {
+		cache->tail = e->prev;
+	}
+	else {
+		e->next->prev = e->prev;
+	}
+	e->prev = e->next = NULL;
+}
+
+/**
+ * @brief Inserisce un file in testa alla lista. Va chiamata con la lock presa.
+ */
+static void push_entry(file_cache_t* cache, file_entry_t* e) {
+	e->prev = NULL;
+	e->next = cache->head;
+	if (cache->head == NULL) {
+		cache->tail = e;
+	}
+	else {
+		cache->head->prev = e;
+	}
+	cache->head = e;
+}
+
+/**
+ * @brief Chiude il fd di un file e libera la memoria
+ */
+static void free_entry(file_entry_t* e) {
+	close(e->fd);
+	free(e);
+}
+
+/**
+ * @brief Toglie un file dalla cache: se nessuno lo usa viene chiuso subito,
+ * altrimenti dall'ultimo file_cache_release. Va chiamata con la lock presa.
+ */
+static void evict_entry(file_cache_t* cache, file_entry_t* e) {
+	unlink_entry(cache, e);
+	--cache->count;
+	e->evicted = true;
+	if (e->refs == 0) {
+		free_entry(e);
+	}
+}
+
+/**
+ * @brief Apre un file e crea l'elemento della cache corrispondente, senza
+ * prendere la lock
+ *
+ * @return Il nuovo elemento, NULL in caso di errore (e imposta errno)
+ */
+static file_entry_t* open_entry(file_cache_t* cache, const char* path, unsigned int hash) {
+	file_entry_t* e = malloc(sizeof(file_entry_t) + strlen(path) + 1);
+	if (e == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		free(e);
+		return NULL;
+	}
+	// Il fd viene spostato sopra minfd
+	e->fd = fcntl(fd, F_DUPFD, cache->minfd);
+	close(fd);
+	if (e->fd < 0 || fstat(e->fd, &(e->st)) < 0) {
+		int err = errno;
+		if (e->fd >= 0) {
+			close(e->fd);
+		}
+		free(e);
+		errno = err;
+		return NULL;
+	}
+	e->hash = hash;
+	e->refs = 1;
+	e->evicted = false;
+	strcpy(e->path, path);
+	return e;
+}
+
+// ------- Funzioni esportate --------------
+// Documentate in filecache.h
+
+void create_file_cache(file_cache_t* cache, int size, int minfd) {
+	cache->head = cache->tail = NULL;
+	cache->count = 0;
+	cache->size = size;
+	cache->minfd = minfd;
+	pthread_mutex_init(&(cache->mutex), NULL);
+}
+
+void clear_file_cache(file_cache_t* cache) {
+	while (cache->head != NULL) {
+		evict_entry(cache, cache->head);
+	}
+	pthread_mutex_destroy(&(cache->mutex));
+}
+
+file_entry_t* file_cache_open(file_cache_t* cache, const char* path) {
+	unsigned int hash = strhash((void*)path);
+	error_handling_lock(&(cache->mutex));
+	file_entry_t* e = find_entry(cache, path, hash);
+	if (e != NULL) {
+		++e->refs;
+		unlink_entry(cache, e);
+		push_entry(cache, e);
+		error_handling_unlock(&(cache->mutex));
+		return e;
+	}
+	error_handling_unlock(&(cache->mutex));
+	// Apre il file senza la lock, per non bloccare gli altri worker
+	file_entry_t* opened = open_entry(cache, path, hash);
+	if (opened == NULL) {
+		return NULL;
+	}
+	error_handling_lock(&(cache->mutex));
+	if ((e = find_entry(cache, path, hash)) != NULL) {
+		// Un altro thread l'ha aperto nel frattempo
+		++e->refs;
+		error_handling_unlock(&(cache->mutex));
+		free_entry(opened);
+		return e;
+	}
+	push_entry(cache, opened);
+	if (++cache->count > cache->size) {
+		evict_entry(cache, cache->tail);
+	}
+	error_handling_unlock(&(cache->mutex));
+	return opened;
+}
+
+void file_cache_release(file_cache_t* cache, file_entry_t* entry) {
+	error_handling_lock(&(cache->mutex));
+	if (--entry->refs == 0 && entry->evicted) {
+		free_entry(entry);
+	}
+	error_handling_unlock(&(cache->mutex));
+}
+
+void file_cache_invalidate(file_cache_t* cache, const char* path) {
+	error_handling_lock(&(cache->mutex));
+	file_entry_t* e = find_entry(cache, path, strhash((void*)path));
+	if (e != NULL) {
+		evict_entry(cache, e);
+	}
+	error_handling_unlock(&(cache->mutex));
+}
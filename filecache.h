@@ -0,0 +1,122 @@
+/**
+ * @file filecache.h
+ * @brief Libreria per la cache dei file aperti da GETFILE_OP
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+#ifndef CHATTERBOX_FILECACHE_H_
+#define CHATTERBOX_FILECACHE_H_
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "lock.h"
+
+/**
+ * @struct file_entry
+ * @brief Un file aperto nella cache
+ *
+ * Chi lo ottiene con file_cache_open può usare fd e st finché non lo
+ * restituisce con file_cache_release, anche se nel frattempo il file viene
+ * tolto dalla cache: il fd viene chiuso solo quando non lo usa più nessuno.
+ *
+ * @var struct file_entry::prev Il file usato più recentemente di questo
+ * @var struct file_entry::next Il file usato meno recentemente di questo
+ * @var struct file_entry::hash Hash del percorso
+ * @var struct file_entry::fd Il fd aperto in sola lettura
+ * @var struct file_entry::refs Numero di utilizzatori
+ * @var struct file_entry::evicted true se il file è stato tolto dalla cache
+ * @var struct file_entry::st Il risultato di fstat sul fd
+ * @var struct file_entry::path Il percorso del file
+ */
+typedef struct file_entry {
+	struct file_entry* prev;
+	struct file_entry* next;
+	unsigned int hash;
+	int fd;
+	int refs;
+	bool evicted;
+	struct stat st;
+	char path[];
+} file_entry_t;
+
+/**
+ * @struct file_cache
+ * @brief Cache LRU dei file aperti
+ *
+ * I file sono in una lista dal più recente al meno recente: un file trovato
+ * viene spostato in testa e, quando sono più di size, quelli in coda vengono
+ * tolti. I fd vengono spostati sopra minfd, così non occupano i numeri
+ * riservati ai client.
+ *
+ * @var struct file_cache::mutex Lock della cache
+ * @var struct file_cache::head Il file usato più recentemente
+ * @var struct file_cache::tail Il file usato meno recentemente
+ * @var struct file_cache::count Numero di file nella cache
+ * @var struct file_cache::size Numero massimo di file nella cache
+ * @var struct file_cache::minfd Numero minimo dei fd aperti dalla cache
+ */
+typedef struct file_cache {
+	pthread_mutex_t mutex;
+	file_entry_t* head;
+	file_entry_t* tail;
+	int count;
+	int size;
+	int minfd;
+} file_cache_t;
+
+/**
+ * @brief Inizializza una cache vuota
+ *
+ * @param cache La cache da inizializzare
+ * @param size Il numero massimo di file aperti da tenere
+ * @param minfd Il numero minimo dei fd aperti dalla cache
+ */
+void create_file_cache(file_cache_t* cache, int size, int minfd);
+
+/**
+ * @brief Chiude tutti i file della cache e libera la memoria. Nessun file deve
+ * essere in uso.
+ *
+ * @param cache La cache da eliminare
+ */
+void clear_file_cache(file_cache_t* cache);
+
+/**
+ * @brief Apre un file passando dalla cache
+ *
+ * Se il file è nella cache non fa nessuna syscall, altrimenti lo apre in sola
+ * lettura, ne legge le informazioni con fstat e lo inserisce nella cache.
+ *
+ * @param cache La cache
+ * @param path Il percorso del file
+ * @return Il file, da restituire con file_cache_release; NULL in caso di
+ *         errore (e imposta errno)
+ */
+file_entry_t* file_cache_open(file_cache_t* cache, const char* path);
+
+/**
+ * @brief Restituisce un file ottenuto con file_cache_open
+ *
+ * @param cache La cache
+ * @param entry Il file
+ */
+void file_cache_release(file_cache_t* cache, file_entry_t* entry);
+
+/**
+ * @brief Toglie un file dalla cache, ad esempio perché è stato riscritto
+ *
+ * @param cache La cache
+ * @param path Il percorso del file
+ */
+void file_cache_invalidate(file_cache_t* cache, const char* path);
+
+#endif /* CHATTERBOX_FILECACHE_H_ */
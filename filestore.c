@@ -0,0 +1,478 @@
+/**
+ * @file filestore.c
+ * @brief Implementazione di filestore.h
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "filestore.h"
+#include "strhash.h"
+
+/**
+ * Numero di bucket delle hashtable dell'indice
+ */
+#define INDEX_BUCKETS 1024
+/**
+ * Lunghezza di un hash in esadecimale
+ */
+#define HEX_LEN (2 * SHA256_SIZE)
+
+// ------------------ Funzioni interne ---------------
+
+/**
+ * @brief Concatena tre stringhe in memoria allocata
+ *
+ * @return La stringa, da liberare con free; NULL se non c'è memoria
+ */
+static char* concat(const char* a, const char* b, const char* c) {
+	size_t la = strlen(a), lb = strlen(b), lc = strlen(c);
+	char* s = malloc(la + lb + lc + 1);
+	if (s == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memcpy(s, a, la);
+	memcpy(s + la, b, lb);
+	memcpy(s + la + lb, c, lc + 1);
+	return s;
+}
+
+/**
+ * @brief Toglie da un nome scelto da un client i "./" iniziali
+ *
+ * @return Il nome senza "./" iniziali, NULL se resta vuoto (e imposta errno)
+ */
+static const char* clean_name(const char* name) {
+	while (name[0] == '.' && name[1] == '/') {
+		name += 2;
+		while (name[0] == '/') {
+			++name;
+		}
+	}
+	if (name[0] == '\0') {
+		errno = EINVAL;
+		return NULL;
+	}
+	return name;
+}
+
+/**
+ * @brief Nome del link in DirName per un nome già passato da clean_name:
+ * l'ultimo componente, se non inizia con '.' (così non può essere uno dei
+ * file dell'archivio né uscire da DirName)
+ *
+ * @return Il nome del link, NULL se per quel nome non c'è un link
+ */
+static const char* link_name(const char* name) {
+	const char* slash = strrchr(name, '/');
+	if (slash != NULL) {
+		name = slash + 1;
+	}
+	return name[0] == '\0' || name[0] == '.' ? NULL : name;
+}
+
+/**
+ * @brief Percorso del file temporaneo di uno slot
+ *
+ * @param prefix ".tmp" per il contenuto, ".lnk" per il link al nome
+ */
+static char* tmp_path(file_store_t* store, const char* prefix, int slot) {
+	char name[32];
+	snprintf(name, sizeof(name), "%s%d", prefix, slot);
+	return concat(store->dir, BLOBS_DIR, name);
+}
+
+/**
+ * @brief Scrive un hash in esadecimale in hex, terminato da \0
+ */
+static void to_hex(const unsigned char digest[SHA256_SIZE], char hex[HEX_LEN + 1]) {
+	for (int i = 0; i < SHA256_SIZE; ++i) {
+		snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+	}
+}
+
+/**
+ * @brief Controlla se un nome è quello di un contenuto (un hash esadecimale)
+ */
+static bool is_blob_name(const char* name) {
+	if (strlen(name) != HEX_LEN) {
+		return false;
+	}
+	for (int i = 0; i < HEX_LEN; ++i) {
+		if (!((name[i] >= '0' && name[i] <= '9') || (name[i] >= 'a' && name[i] <= 'f'))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Associa un contenuto ad una chiave, prendendo possesso di entrambe le
+ * stringhe. Va chiamata con la lock presa (o senza altri thread).
+ *
+ * @return 0 in caso di successo, < 0 se non c'è memoria
+ */
+static int set_entry(file_store_t* store, char* key, char* hex) {
+	icl_hash_delete(store->index, key, free, free);
+	if (icl_hash_insert(store->index, key, hex) == NULL) {
+		free(key);
+		free(hex);
+		errno = ENOMEM;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Scrive un record dell'indice: l'hash, la lunghezza della chiave e la
+ * chiave, che può contenere spazi e '\\n'
+ *
+ * @return 0 in caso di successo, < 0 in caso di errore (e imposta errno)
+ */
+static int write_record(int fd, const char* key, const char* hex) {
+	size_t keylen = strlen(key);
+	char* record = malloc(HEX_LEN + keylen + 32);
+	if (record == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	int len = sprintf(record, "%s %zu ", hex, keylen);
+	memcpy(record + len, key, keylen);
+	len += keylen;
+	record[len++] = '\n';
+	// Una sola write, così un record non si mescola con gli altri
+	ssize_t written = write(fd, record, len);
+	free(record);
+	if (written != len) {
+		if (written >= 0) {
+			errno = EIO;
+		}
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Legge l'indice salvato nella hashtable. Un record incompleto alla
+ * fine (ad esempio per un crash durante la scrittura) viene ignorato.
+ *
+ * @return 0 in caso di successo, < 0 in caso di errore (e imposta errno)
+ */
+static int load_index(file_store_t* store) {
+	char* path = concat(store->dir, INDEX_FILE, "");
+	if (path == NULL) {
+		return -1;
+	}
+	FILE* in = fopen(path, "r");
+	free(path);
+	if (in == NULL) {
+		// Nessun indice: l'archivio è nuovo
+		return errno == ENOENT ? 0 : -1;
+	}
+	char hex[HEX_LEN + 1];
+	size_t keylen;
+	while (fscanf(in, "%64s %zu", hex, &keylen) == 2 && fgetc(in) == ' ') {
+		char* key = malloc(keylen + 1);
+		if (key == NULL) {
+			fclose(in);
+			errno = ENOMEM;
+			return -1;
+		}
+		if (!is_blob_name(hex) || fread(key, 1, keylen, in) != keylen
+			|| fgetc(in) != '\n') {
+			free(key);
+			break;
+		}
+		key[keylen] = '\0';
+		char* value = strdup(hex);
+		if (value == NULL || set_entry(store, key, value) < 0) {
+			fclose(in);
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+	fclose(in);
+	return 0;
+}
+
+/**
+ * @brief Riscrive l'indice con solo i record validi e lo riapre in append
+ *
+ * @return 0 in caso di successo, < 0 in caso di errore (e imposta errno)
+ */
+static int compact_index(file_store_t* store, int minfd) {
+	char* path = concat(store->dir, INDEX_FILE, "");
+	char* tmp = concat(store->dir, INDEX_FILE, ".tmp");
+	int fd = -1;
+	int res = -1;
+	if (path != NULL && tmp != NULL
+		&& (fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0) {
+		res = 0;
+		int i;
+		icl_entry_t* e;
+		char* key;
+		char* hex;
+		icl_hash_foreach(store->index, i, e, key, hex) {
+			if (res == 0 && write_record(fd, key, hex) < 0) {
+				res = -1;
+			}
+		}
+		close(fd);
+		fd = -1;
+		if (res == 0 && (rename(tmp, path) < 0
+			|| (fd = open(path, O_WRONLY | O_APPEND)) < 0)) {
+			res = -1;
+		}
+	}
+	int err = errno;
+	if (fd >= 0) {
+		// Il fd viene spostato sopra minfd
+		store->indexfd = fcntl(fd, F_DUPFD, minfd);
+		err = errno;
+		close(fd);
+		if (store->indexfd < 0) {
+			res = -1;
+		}
+	}
+	free(path);
+	free(tmp);
+	errno = err;
+	return res;
+}
+
+/**
+ * @brief Elimina i contenuti non più usati e, se all_tmp, anche i file
+ * temporanei. Va chiamata con la lock presa (o senza altri thread).
+ *
+ * @return Il numero di contenuti eliminati, < 0 in caso di errore (e imposta
+ *         errno)
+ */
+static int prune_blobs(file_store_t* store, bool all_tmp) {
+	char* blobs = concat(store->dir, BLOBS_DIR, "");
+	if (blobs == NULL) {
+		return -1;
+	}
+	// Gli hash usati dall'indice
+	icl_hash_t* used = icl_hash_create(INDEX_BUCKETS, strhash, NULL);
+	if (used == NULL) {
+		free(blobs);
+		errno = ENOMEM;
+		return -1;
+	}
+	int i;
+	icl_entry_t* e;
+	char* key;
+	char* hex;
+	icl_hash_foreach(store->index, i, e, key, hex) {
+		if (icl_hash_find(used, hex) == NULL) {
+			icl_hash_insert(used, hex, hex);
+		}
+	}
+	int pruned = 0;
+	DIR* dir = opendir(blobs);
+	if (dir == NULL) {
+		pruned = -1;
+	}
+	else {
+		struct dirent* ent;
+		while ((ent = readdir(dir)) != NULL) {
+			bool blob = is_blob_name(ent->d_name);
+			if ((blob && icl_hash_find(used, ent->d_name) == NULL)
+				|| (!blob && all_tmp && ent->d_name[0] == '.'
+					&& strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0)) {
+				char* path = concat(blobs, ent->d_name, "");
+				if (path != NULL && unlink(path) == 0 && blob) {
+					++pruned;
+				}
+				free(path);
+			}
+		}
+		closedir(dir);
+	}
+	// Le stringhe appartengono all'indice
+	icl_hash_destroy(used, NULL, NULL);
+	free(blobs);
+	return pruned;
+}
+
+// ------- Funzioni esportate --------------
+// Documentate in filestore.h
+
+int create_file_store(file_store_t* store, const char* dir, int minfd) {
+	store->indexfd = -1;
+	store->index = NULL;
+	store->dir = strdup(dir);
+	if (store->dir == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	char* blobs = concat(dir, BLOBS_DIR, "");
+	if (blobs == NULL
+		|| (mkdir(dir, 0755) < 0 && errno != EEXIST)
+		|| (mkdir(blobs, 0755) < 0 && errno != EEXIST)) {
+		int err = errno;
+		free(blobs);
+		free(store->dir);
+		errno = err;
+		return -1;
+	}
+	free(blobs);
+	store->index = icl_hash_create(INDEX_BUCKETS, strhash, NULL);
+	if (store->index == NULL) {
+		free(store->dir);
+		errno = ENOMEM;
+		return -1;
+	}
+	if (load_index(store) < 0 || prune_blobs(store, true) < 0
+		|| compact_index(store, minfd) < 0) {
+		int err = errno;
+		icl_hash_destroy(store->index, free, free);
+		free(store->dir);
+		errno = err;
+		return -1;
+	}
+	pthread_mutex_init(&(store->mutex), NULL);
+	return 0;
+}
+
+void clear_file_store(file_store_t* store) {
+	close(store->indexfd);
+	icl_hash_destroy(store->index, free, free);
+	free(store->dir);
+	pthread_mutex_destroy(&(store->mutex));
+}
+
+int file_store_open_tmp(file_store_t* store, int slot) {
+	char* path = tmp_path(store, ".tmp", slot);
+	if (path == NULL) {
+		return -1;
+	}
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	free(path);
+	return fd;
+}
+
+void file_store_discard(file_store_t* store, int slot) {
+	char* path = tmp_path(store, ".tmp", slot);
+	if (path != NULL) {
+		unlink(path);
+		free(path);
+	}
+}
+
+int file_store_commit(file_store_t* store, int slot, const unsigned char digest[SHA256_SIZE],
+	const char* receiver, const char* name) {
+	if ((name = clean_name(name)) == NULL) {
+		return -1;
+	}
+	char hex[HEX_LEN + 1];
+	to_hex(digest, hex);
+	const char* linked = link_name(name);
+	char* tmp = tmp_path(store, ".tmp", slot);
+	char* lnk = tmp_path(store, ".lnk", slot);
+	char* blob = concat(store->dir, BLOBS_DIR, hex);
+	char* named = linked == NULL ? NULL : concat(store->dir, linked, "");
+	char* key = concat(receiver, "\n", name);
+	char* value = strdup(hex);
+	int res = -1;
+	if (tmp == NULL || lnk == NULL || blob == NULL || (linked != NULL && named == NULL)
+		|| key == NULL || value == NULL) {
+		errno = ENOMEM;
+	}
+	else {
+		// Con la lock un contenuto appena creato non può essere eliminato da
+		// file_store_prune prima di entrare nell'indice
+		error_handling_lock(&(store->mutex));
+		// Se il contenuto c'è già il file temporaneo non serve
+		if (link(tmp, blob) == 0 || errno == EEXIST) {
+			unlink(tmp);
+			// DirName/<nome> viene sostituito in modo atomico. Non è un
+			// errore se non si può creare: i download passano dall'indice
+			if (named != NULL) {
+				unlink(lnk);
+				if (link(blob, lnk) < 0 || rename(lnk, named) < 0) {
+					unlink(lnk);
+				}
+			}
+			if (write_record(store->indexfd, key, hex) < 0) {
+				perror("scrivendo l'indice dei file");
+			}
+			res = set_entry(store, key, value);
+			key = value = NULL;
+		}
+		error_handling_unlock(&(store->mutex));
+	}
+	int err = errno;
+	free(tmp);
+	free(lnk);
+	free(blob);
+	free(named);
+	free(key);
+	free(value);
+	errno = err;
+	return res;
+}
+
+bool file_store_valid_name(const char* name) {
+	return clean_name(name) != NULL;
+}
+
+char* file_store_named_path(file_store_t* store, const char* name) {
+	if ((name = clean_name(name)) == NULL) {
+		return NULL;
+	}
+	if ((name = link_name(name)) == NULL) {
+		errno = ENOENT;
+		return NULL;
+	}
+	return concat(store->dir, name, "");
+}
+
+char* file_store_path(file_store_t* store, const char* receiver, const char* name) {
+	if ((name = clean_name(name)) == NULL) {
+		return NULL;
+	}
+	char* key = concat(receiver, "\n", name);
+	if (key == NULL) {
+		return NULL;
+	}
+	char* path;
+	error_handling_lock(&(store->mutex));
+	char* hex = icl_hash_find(store->index, key);
+	const char* linked;
+	if (hex != NULL) {
+		path = concat(store->dir, BLOBS_DIR, hex);
+	}
+	else if ((linked = link_name(name)) != NULL) {
+		path = concat(store->dir, linked, "");
+	}
+	else {
+		errno = ENOENT;
+		path = NULL;
+	}
+	error_handling_unlock(&(store->mutex));
+	free(key);
+	return path;
+}
+
+int file_store_prune(file_store_t* store) {
+	error_handling_lock(&(store->mutex));
+	int pruned = prune_blobs(store, false);
+	error_handling_unlock(&(store->mutex));
+	return pruned;
+}
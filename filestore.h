@@ -0,0 +1,168 @@
+/**
+ * @file filestore.h
+ * @brief Libreria per l'archivio dei file ricevuti con POSTFILE_OP, che salva
+ * ogni contenuto una volta sola
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ *
+ * Il contenuto di ogni file sta in DirName/.blobs/<hash>, dove hash è lo
+ * SHA-256 del contenuto in esadecimale: un file inviato più volte, anche con
+ * nomi diversi, viene scritto su disco una volta sola. Un indice associa ad
+ * ogni coppia (destinatario, nome) il contenuto da inviare con GETFILE_OP, così
+ * file con lo stesso nome inviati a utenti diversi non si sovrascrivono.
+ *
+ * L'indice è salvato in DirName/.index, a cui ogni nuovo file aggiunge un
+ * record; all'avvio viene riletto, riscritto senza i record sostituiti e i
+ * contenuti non più usati vengono eliminati. Per compatibilità anche
+ * DirName/<nome> resta un link all'ultimo contenuto ricevuto con quel nome.
+ *
+ * I nomi scelti dai client (tolti i "./" iniziali) entrano nell'indice così
+ * come sono, ma non possono raggiungere i file dell'archivio né uscire da
+ * DirName: il link usa solo l'ultimo componente del nome, e non viene creato
+ * se questo inizia con '.'. Così "dir/file" ha il link DirName/file, mentre
+ * ".bashrc" si scarica solo dall'indice.
+ */
+#ifndef CHATTERBOX_FILESTORE_H_
+#define CHATTERBOX_FILESTORE_H_
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "lock.h"
+#include "icl_hash.h"
+#include "sha256.h"
+
+/**
+ * Sottodirectory con i contenuti dei file
+ */
+#define BLOBS_DIR ".blobs/"
+/**
+ * File con l'indice
+ */
+#define INDEX_FILE ".index"
+
+/**
+ * @struct file_store
+ * @brief L'archivio dei file
+ *
+ * @var struct file_store::mutex Lock dell'indice
+ * @var struct file_store::dir La directory, terminata da '/'
+ * @var struct file_store::index L'indice: le chiavi sono il destinatario e il
+ *                               nome separati da '\\n', i valori l'hash del
+ *                               contenuto in esadecimale
+ * @var struct file_store::indexfd Il fd di INDEX_FILE, aperto in append
+ */
+typedef struct file_store {
+	pthread_mutex_t mutex;
+	char* dir;
+	icl_hash_t* index;
+	int indexfd;
+} file_store_t;
+
+/**
+ * @brief Apre l'archivio in una directory, creandola se serve
+ *
+ * Rilegge l'indice, lo riscrive compattato ed elimina i contenuti non più
+ * usati e i file temporanei rimasti da un'esecuzione precedente.
+ *
+ * @param store L'archivio da inizializzare
+ * @param dir La directory, terminata da '/'
+ * @param minfd Il numero minimo del fd dell'indice
+ * @return 0 in caso di successo, < 0 in caso di errore (e imposta errno)
+ */
+int create_file_store(file_store_t* store, const char* dir, int minfd);
+
+/**
+ * @brief Chiude l'archivio e libera la memoria (i file restano su disco)
+ *
+ * @param store L'archivio da chiudere
+ */
+void clear_file_store(file_store_t* store);
+
+/**
+ * @brief Apre in scrittura il file temporaneo in cui ricevere un file
+ *
+ * Ogni thread deve usare uno slot diverso.
+ *
+ * @param store L'archivio
+ * @param slot Il numero del file temporaneo
+ * @return Il fd del file, < 0 in caso di errore (e imposta errno)
+ */
+int file_store_open_tmp(file_store_t* store, int slot);
+
+/**
+ * @brief Elimina il file temporaneo, ad esempio se la ricezione è fallita
+ *
+ * @param store L'archivio
+ * @param slot Il numero del file temporaneo
+ */
+void file_store_discard(file_store_t* store, int slot);
+
+/**
+ * @brief Aggiunge all'archivio il file temporaneo, già ricevuto e chiuso
+ *
+ * Se un file con lo stesso contenuto è già presente il file temporaneo viene
+ * eliminato, altrimenti diventa il contenuto. In entrambi i casi l'indice
+ * associa il contenuto a (receiver, name).
+ *
+ * @param store L'archivio
+ * @param slot Il numero del file temporaneo
+ * @param digest Lo SHA-256 del contenuto
+ * @param receiver Il destinatario
+ * @param name Il nome del file
+ * @return 0 in caso di successo, < 0 in caso di errore (e imposta errno,
+ *         EINVAL se il nome non è valido, vedere file_store_valid_name)
+ */
+int file_store_commit(file_store_t* store, int slot, const unsigned char digest[SHA256_SIZE],
+	const char* receiver, const char* name);
+
+/**
+ * @brief Controlla se un nome può essere usato per un file: non deve essere
+ * vuoto dopo aver tolto i "./" iniziali
+ *
+ * @param name Il nome del file
+ * @return true se il nome è valido
+ */
+bool file_store_valid_name(const char* name);
+
+/**
+ * @brief Restituisce il percorso del link in DirName per un nome
+ *
+ * @param store L'archivio
+ * @param name Il nome del file
+ * @return Il percorso, da liberare con free; NULL se il nome non è valido, se
+ *         non ha un link (ENOENT) o non c'è memoria (e imposta errno)
+ */
+char* file_store_named_path(file_store_t* store, const char* name);
+
+/**
+ * @brief Restituisce il percorso del contenuto da inviare per GETFILE_OP
+ *
+ * Se (receiver, name) non è nell'indice restituisce il link in DirName.
+ *
+ * @param store L'archivio
+ * @param receiver Chi ha chiesto il file
+ * @param name Il nome del file
+ * @return Il percorso, da liberare con free; NULL se il nome non è valido, se
+ *         non è nell'indice e non ha un link (ENOENT) o non c'è memoria (e
+ *         imposta errno)
+ */
+char* file_store_path(file_store_t* store, const char* receiver, const char* name);
+
+/**
+ * @brief Elimina i contenuti a cui non fa riferimento nessun record
+ * dell'indice
+ *
+ * @param store L'archivio
+ * @return Il numero di contenuti eliminati, < 0 in caso di errore (e imposta
+ *         errno)
+ */
+int file_store_prune(file_store_t* store);
+
+#endif /* CHATTERBOX_FILESTORE_H_ */
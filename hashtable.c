@@ -10,51 +10,379 @@
  *       flavio.ascari@sns.it
  */
 
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "hashtable.h"
+#include "strhash.h"
 
 // ------------------ Funzioni interne ---------------
 
+/**
+ * @brief Hash di una chiave, considerando solo i primi MAX_NAME_LENGTH
+ * caratteri come il confronto tra le chiavi
+ *
+ * @param key la chiave
+ * @return l'hash
+ */
+static uint64_t hash_string(const char* key) {
+	size_t len = 0;
+	while (len < MAX_NAME_LENGTH && key[len] != '\0')
+		++len;
+	return strhash64(key, len);
+}
+
+/**
+ * @brief La partizione di una chiave, scelta con i 32 bit alti dell'hash (i
+ * 32 bassi servono dentro la partizione)
+ */
+static htable_shard_t* shard_of(htable_t* ht, uint64_t hash) {
+	return &(ht->shards[(hash >> 32) & (HTABLE_SHARDS - 1)]);
+}
+
+#define H1(hash) ((hash) >> 7)                 /**< sceglie il gruppo */
+#define H2(hash) ((signed char)((hash) & 0x7F)) /**< va nel byte di controllo */
+
+#ifdef __SSE2__
+/**
+ * I byte di controllo di un gruppo, confrontati tutti insieme con SSE2
+ */
+typedef __m128i group_t;
+
+static inline group_t group_load(const signed char* ctrl) {
+	return _mm_loadu_si128((const __m128i*)ctrl);
+}
+
+/**
+ * @brief Confronta un byte con tutti i byte di controllo di un gruppo
+ *
+ * @return una maschera con un bit per ogni slot del gruppo, a 1 dove il byte
+ *         di controllo è uguale a b
+ */
+static inline unsigned int group_match(group_t g, signed char b) {
+	return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(b)));
+}
+#else
+typedef struct { signed char c[HTABLE_GROUP_SIZE]; } group_t;
+
+static inline group_t group_load(const signed char* ctrl) {
+	group_t g;
+	memcpy(g.c, ctrl, HTABLE_GROUP_SIZE);
+	return g;
+}
+
+static inline unsigned int group_match(group_t g, signed char b) {
+	unsigned int res = 0;
+	for (int i = 0; i < HTABLE_GROUP_SIZE; ++i)
+		res |= (unsigned int)(g.c[i] == b) << i;
+	return res;
+}
+#endif
+
+/**
+ * @brief Alloca un array di slot vuoti
+ *
+ * @param capacity il numero di slot, potenza di 2 multipla di
+ *                 HTABLE_GROUP_SIZE
+ * @return il nuovo array
+ */
+static htable_slots_t* create_slots(int capacity) {
+	htable_slots_t* res = malloc(sizeof(htable_slots_t));
+	res->capacity = capacity;
+	res->used = 0;
+	res->ctrl = malloc(capacity * sizeof(signed char));
+	memset(res->ctrl, HTABLE_CTRL_EMPTY, capacity * sizeof(signed char));
+	res->slots = malloc(capacity * sizeof(htable_slot_t));
+	return res;
+}
+
+/**
+ * @brief true se un array ha raggiunto il numero massimo di slot occupati
+ */
+static bool slots_full(htable_slots_t* t) {
+	return t->used >= t->capacity / HTABLE_MAX_LOAD_DEN * HTABLE_MAX_LOAD_NUM;
+}
+
+/**
+ * @brief Cerca una chiave in un array di slot
+ *
+ * I gruppi vengono visitati con un passo crescente (1, 2, 3...), che con un
+ * numero di gruppi potenza di 2 li tocca tutti. La ricerca si ferma al primo
+ * gruppo che ha uno slot vuoto, perché l'inserimento avrebbe usato quello.
+ *
+ * Può essere chiamata senza lock: i byte di controllo vengono pubblicati con
+ * release dopo aver scritto lo slot.
+ *
+ * @return l'indice dello slot con quella chiave, -1 se non c'è
+ */
+static int slots_find(htable_slots_t* t, const char* key, unsigned int hash) {
+	int ngroups = t->capacity / HTABLE_GROUP_SIZE;
+	int g = H1(hash) & (ngroups - 1);
+	for (int step = 1; step <= ngroups; ++step) {
+		group_t ctrl = group_load(t->ctrl + g * HTABLE_GROUP_SIZE);
+		// gli slot vanno letti dopo i byte di controllo che li pubblicano
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		for (unsigned int m = group_match(ctrl, H2(hash)); m != 0; m &= m - 1) {
+			int i = g * HTABLE_GROUP_SIZE + __builtin_ctz(m);
+			if (t->slots[i].hash == hash
+				&& strncmp(t->slots[i].key, key, MAX_NAME_LENGTH) == 0)
+				return i;
+		}
+		if (group_match(ctrl, HTABLE_CTRL_EMPTY) != 0)
+			return -1;
+		g = (g + step) & (ngroups - 1);
+	}
+	return -1;
+}
+
+/**
+ * @brief Inserisce un elemento nel primo slot vuoto della sua sequenza di
+ * gruppi
+ *
+ * Gli slot degli elementi rimossi non vengono riusati (vedere htable_slots).
+ * L'array non deve essere pieno. Va chiamata con la lock dell'hashtable presa.
+ */
+static void slots_push(htable_slots_t* t, const char* key, unsigned int hash, nickname_t* data) {
+	int ngroups = t->capacity / HTABLE_GROUP_SIZE;
+	int g = H1(hash) & (ngroups - 1);
+	for (int step = 1; ; ++step) {
+		unsigned int m = group_match(group_load(t->ctrl + g * HTABLE_GROUP_SIZE), HTABLE_CTRL_EMPTY);
+		if (m != 0) {
+			int i = g * HTABLE_GROUP_SIZE + __builtin_ctz(m);
+			htable_slot_t* slot = &(t->slots[i]);
+			strncpy(slot->key, key, MAX_NAME_LENGTH);
+			slot->key[MAX_NAME_LENGTH] = '\0';
+			slot->hash = hash;
+			slot->data = data;
+			// lo slot deve essere completo prima di essere visibile a hash_find
+			__atomic_store_n(&(t->ctrl[i]), H2(hash), __ATOMIC_RELEASE);
+			++t->used;
+			return;
+		}
+		g = (g + step) & (ngroups - 1);
+	}
+}
+
+/**
+ * @brief Libera un array di slot, senza i valori degli elementi
+ *
+ * @param t (htable_slots_t*) l'array, void* per poterla passare ad
+ *          epoch_retire
+ */
+static void free_slots(void* t) {
+	free(((htable_slots_t*)t)->ctrl);
+	free(((htable_slots_t*)t)->slots);
+	free(t);
+}
+
+/**
+ * @brief Sposta in cur i prossimi HTABLE_REHASH_STEP gruppi di old
+ *
+ * Ogni elemento viene prima copiato in cur e solo dopo il suo slot in old
+ * viene segnato come rimosso: chi cerca prima in old e poi in cur lo trova
+ * sempre in almeno uno dei due.
+ * Va chiamata con la lock della partizione presa.
+ */
+static void rehash_step(htable_shard_t* sh) {
+	htable_slots_t* old = sh->old;
+	if (old == NULL)
+		return;
+	int ngroups = old->capacity / HTABLE_GROUP_SIZE;
+	for (int n = 0; n < HTABLE_REHASH_STEP && sh->migrated < ngroups; ++n) {
+		int base = (sh->migrated++) * HTABLE_GROUP_SIZE;
+		for (int i = base; i < base + HTABLE_GROUP_SIZE; ++i) {
+			if (old->ctrl[i] >= 0) {
+				slots_push(sh->cur, old->slots[i].key, old->slots[i].hash, old->slots[i].data);
+				__atomic_store_n(&(old->ctrl[i]), HTABLE_CTRL_DELETED, __ATOMIC_RELEASE);
+			}
+		}
+	}
+	if (sh->migrated == ngroups) {
+		__atomic_store_n(&(sh->old), NULL, __ATOMIC_RELEASE);
+		epoch_retire(old, &free_slots);
+		#if defined DEBUG && defined VERBOSE
+			fprintf(stderr, "Hashtable: finito lo spostamento in %d slot\n", sh->cur->capacity);
+		#endif
+	}
+}
+
+/**
+ * @brief Se gli slot occupati sono troppi, o gli elementi troppo pochi,
+ * inizia a spostarli in un array di dimensione adatta
+ *
+ * Il nuovo array è grande abbastanza da essere pieno per meno di metà del
+ * limite, quindi anche quando si riempie di elementi rimossi può servire
+ * ricostruirlo della stessa dimensione.
+ * Finché non è finito lo spostamento precedente non ne inizia un altro.
+ * Va chiamata con la lock della partizione presa.
+ */
+static void check_resize(htable_shard_t* sh) {
+	if (sh->old != NULL)
+		return;
+	int capacity = sh->cur->capacity;
+	if (!slots_full(sh->cur)
+		&& (capacity <= sh->min_capacity || sh->nentries >= capacity / HTABLE_MIN_LOAD_DIV))
+		return;
+	int new_capacity = sh->min_capacity;
+	while (2 * HTABLE_MAX_LOAD_DEN * (long)sh->nentries > (long)new_capacity * HTABLE_MAX_LOAD_NUM)
+		new_capacity *= 2;
+	#if defined DEBUG && defined VERBOSE
+		fprintf(stderr, "Hashtable: da %d a %d slot con %d elementi\n", capacity, new_capacity, sh->nentries);
+	#endif
+	sh->migrated = 0;
+	// hash_find legge prima cur e poi old: quando vede il nuovo cur vede anche
+	// old
+	__atomic_store_n(&(sh->old), sh->cur, __ATOMIC_RELEASE);
+	__atomic_store_n(&(sh->cur), create_slots(new_capacity), __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Libera un array di slot e i valori degli elementi che contiene
+ */
+static void destroy_slots(htable_slots_t* t) {
+	for (int i = 0; i < t->capacity; ++i)
+		if (t->ctrl[i] >= 0)
+			free_nickname(t->slots[i].data);
+	free_slots(t);
+}
 
 // ------- Funzioni esportate --------------
 // Documentate in hashtable.h
 
 htable_t* hash_create(int nbuckets, int history_size) {
 	htable_t* res = malloc(sizeof(htable_t));
-	res->htable = icl_hash_create(nbuckets, NULL, NULL);
+	int n = HTABLE_GROUP_SIZE;
+	while (n * HTABLE_SHARDS < nbuckets)
+		n *= 2;
+	for (int i = 0; i < HTABLE_SHARDS; ++i) {
+		htable_shard_t* sh = &(res->shards[i]);
+		sh->cur = create_slots(n);
+		sh->old = NULL;
+		sh->migrated = 0;
+		sh->nentries = 0;
+		sh->min_capacity = n;
+		pthread_mutex_init(&(sh->mutex), NULL);
+	}
 	res->hist_size = history_size;
-	pthread_mutex_init(&(res->mutex), NULL);
 	return res;
 }
 
 int ts_hash_destroy(htable_t* ht) {
-	error_handling_lock(&(ht->mutex));
-	int res = icl_hash_destroy(ht->htable, &free, &free_nickname);
-	error_handling_unlock(&(ht->mutex));
-	pthread_mutex_destroy(&(ht->mutex));
-	if (res == 0)
-		free(ht);
-	return res;
+	for (int i = 0; i < HTABLE_SHARDS; ++i) {
+		htable_shard_t* sh = &(ht->shards[i]);
+		error_handling_lock(&(sh->mutex));
+		if (sh->old != NULL)
+			destroy_slots(sh->old);
+		destroy_slots(sh->cur);
+		error_handling_unlock(&(sh->mutex));
+		pthread_mutex_destroy(&(sh->mutex));
+	}
+	free(ht);
+	return 0;
 }
 
 nickname_t* hash_find(htable_t* ht, char* key) {
-	return (nickname_t*)icl_hash_find(ht->htable, (void*)key);
+	uint64_t h = hash_string(key);
+	unsigned int hash = (unsigned int)h;
+	htable_shard_t* sh = shard_of(ht, h);
+	htable_slots_t* cur;
+	nickname_t* res = NULL;
+	// Niente di quello che si legge viene liberato prima della fine della
+	// sezione
+	epoch_enter();
+	do {
+		cur = __atomic_load_n(&(sh->cur), __ATOMIC_ACQUIRE);
+		htable_slots_t* old = __atomic_load_n(&(sh->old), __ATOMIC_ACQUIRE);
+		int i = -1;
+		if (old != NULL && (i = slots_find(old, key, hash)) >= 0) {
+			res = old->slots[i].data;
+			break;
+		}
+		if ((i = slots_find(cur, key, hash)) >= 0) {
+			res = cur->slots[i].data;
+			break;
+		}
+		// Se nel frattempo è iniziato un altro ridimensionamento la chiave
+		// potrebbe essere stata spostata dove non si è cercato
+	} while (__atomic_load_n(&(sh->cur), __ATOMIC_ACQUIRE) != cur);
+	epoch_exit();
+	return res;
 }
 
 nickname_t* ts_hash_insert(htable_t* ht, char* key) {
-	nickname_t* val = create_nickname(ht->hist_size);
-	// Duplica la chiave per evitare problemi di deallocazione: questa memoria
-	// verrà liberata quando verrà rimosso l'elemento dall'hashtable.
-	char* new_key = malloc((strlen(key) + 1) * sizeof(char*));
-	strncpy(new_key, key, strlen(key) + 1);
-	error_handling_lock(&(ht->mutex));
-	icl_entry_t* res = icl_hash_insert(ht->htable, new_key, val);
-	error_handling_unlock(&(ht->mutex));
-	return res == NULL ? NULL : res->data;
+	uint64_t h = hash_string(key);
+	unsigned int hash = (unsigned int)h;
+	htable_shard_t* sh = shard_of(ht, h);
+	nickname_t* val = NULL;
+	error_handling_lock(&(sh->mutex));
+	if ((sh->old == NULL || slots_find(sh->old, key, hash) < 0)
+		&& slots_find(sh->cur, key, hash) < 0) {
+		val = create_nickname(ht->hist_size);
+		rehash_step(sh);
+		if (slots_full(sh->cur)) {
+			// L'array nuovo si è riempito prima della fine dello
+			// spostamento: succede solo con molte rimozioni e
+			// inserimenti alternati, e va finito subito
+			while (sh->old != NULL)
+				rehash_step(sh);
+			check_resize(sh);
+		}
+		slots_push(sh->cur, key, hash, val);
+		__atomic_add_fetch(&(sh->nentries), 1, __ATOMIC_RELAXED);
+		check_resize(sh);
+	}
+	error_handling_unlock(&(sh->mutex));
+	return val;
 }
 
 bool ts_hash_remove(htable_t* ht, char* key) {
-	error_handling_lock(&(ht->mutex));
-	int res = icl_hash_delete(ht->htable, (void*)key, &free, &free_nickname);
-	error_handling_unlock(&(ht->mutex));
-	return res == 0;
+	uint64_t h = hash_string(key);
+	unsigned int hash = (unsigned int)h;
+	htable_shard_t* sh = shard_of(ht, h);
+	error_handling_lock(&(sh->mutex));
+	htable_slots_t* t = sh->old;
+	int i = -1;
+	if (t != NULL)
+		i = slots_find(t, key, hash);
+	if (i < 0) {
+		t = sh->cur;
+		i = slots_find(t, key, hash);
+	}
+	if (i >= 0) {
+		nickname_t* data = t->slots[i].data;
+		__atomic_store_n(&(t->ctrl[i]), HTABLE_CTRL_DELETED, __ATOMIC_RELEASE);
+		// chi l'ha trovato con hash_find può usarlo fino alla fine della
+		// sua sezione
+		epoch_retire(data, &free_nickname);
+		__atomic_sub_fetch(&(sh->nentries), 1, __ATOMIC_RELAXED);
+		rehash_step(sh);
+		check_resize(sh);
+	}
+	error_handling_unlock(&(sh->mutex));
+	return i >= 0;
+}
+
+int hash_count(htable_t* ht) {
+	int res = 0;
+	for (int i = 0; i < HTABLE_SHARDS; ++i)
+		res += __atomic_load_n(&(ht->shards[i].nentries), __ATOMIC_RELAXED);
+	return res;
+}
+
+void ts_hash_foreach(htable_t* ht, void (*fun)(char*, nickname_t*, void*), void* arg) {
+	for (int s = 0; s < HTABLE_SHARDS; ++s) {
+		htable_shard_t* sh = &(ht->shards[s]);
+		error_handling_lock(&(sh->mutex));
+		htable_slots_t* arrays[2] = { sh->old, sh->cur };
+		for (int a = 0; a < 2; ++a) {
+			if (arrays[a] == NULL)
+				continue;
+			for (int i = 0; i < arrays[a]->capacity; ++i)
+				if (arrays[a]->ctrl[i] >= 0)
+					fun(arrays[a]->slots[i].key, arrays[a]->slots[i].data, arg);
+		}
+		error_handling_unlock(&(sh->mutex));
+	}
 }
@@ -19,9 +19,66 @@
 #include <pthread.h>
 #include <unistd.h>
 
-#include "icl_hash.h"
+#include "config.h"
 #include "nickname.h"
 #include "lock.h"
+#include "epoch.h"
+
+#define HTABLE_SHARDS 16       /**< numero di partizioni, potenza di 2 */
+#define HTABLE_GROUP_SIZE 16   /**< numero di slot i cui byte di controllo
+                                    vengono confrontati insieme */
+#define HTABLE_MAX_LOAD_NUM 7  /**< gli slot occupati (anche da elementi
+                                    rimossi) sono al più 7/8 del totale */
+#define HTABLE_MAX_LOAD_DEN 8
+#define HTABLE_MIN_LOAD_DIV 16 /**< l'hashtable si restringe quando ha meno di
+                                    un elemento ogni HTABLE_MIN_LOAD_DIV slot */
+#define HTABLE_REHASH_STEP 4   /**< numero di gruppi spostati nella tabella
+                                    nuova ad ogni inserimento o rimozione */
+
+#define HTABLE_CTRL_EMPTY ((signed char)-128) /**< slot mai usato */
+#define HTABLE_CTRL_DELETED ((signed char)-2) /**< slot di un elemento rimosso
+                                                   o spostato */
+
+/**
+ * @struct htable_slot
+ * @brief Uno slot della tabella, con la chiave al suo interno
+ *
+ * @var struct htable_slot::data Il nickname associato alla chiave
+ * @var struct htable_slot::hash L'hash della chiave
+ * @var struct htable_slot::key La chiave
+ */
+typedef struct htable_slot {
+	nickname_t* data;
+	unsigned int hash;
+	char key[MAX_NAME_LENGTH + 1];
+} htable_slot_t;
+
+/**
+ * @struct htable_slots
+ * @brief Array di slot di una certa dimensione
+ *
+ * Ogni slot ha un byte di controllo: HTABLE_CTRL_EMPTY, HTABLE_CTRL_DELETED
+ * oppure, se è occupato, i 7 bit meno significativi dell'hash della chiave.
+ * I byte di controllo sono separati dagli slot, così una ricerca confronta i
+ * 7 bit con un intero gruppo con una sola istruzione SIMD e guarda la chiave
+ * solo negli slot in cui coincidono.
+ *
+ * Uno slot viene scritto una sola volta: gli slot degli elementi rimossi non
+ * vengono riusati finché la tabella non viene ricostruita, così chi legge
+ * senza lock non vede mai una chiave cambiare sotto di sé.
+ *
+ * @var struct htable_slots::capacity Numero di slot, potenza di 2 multipla di
+ *                                    HTABLE_GROUP_SIZE
+ * @var struct htable_slots::used Numero di slot non vuoti (anche rimossi)
+ * @var struct htable_slots::ctrl I byte di controllo
+ * @var struct htable_slots::slots Gli slot
+ */
+typedef struct htable_slots {
+	int capacity;
+	int used;
+	signed char* ctrl;
+	htable_slot_t* slots;
+} htable_slots_t;
 
 /**
  * @struct htable_t
@@ -33,27 +90,72 @@
  *
  * L'hashtable gestisce solo la concorrenza sulle modifiche alla sua struttura.
  * Le modifiche ai valori memorizzati devono essere sincronizzate separatamente.
+ *
+ * È una tabella ad indirizzamento aperto: le chiavi stanno direttamente negli
+ * slot e si scorrono i gruppi di HTABLE_GROUP_SIZE slot (vedere
+ * htable_slots). Quando gli slot occupati superano il limite, o gli elementi
+ * sono troppo pochi, gli elementi vengono spostati in un array nuovo della
+ * dimensione adatta. Lo spostamento non avviene tutto insieme: l'array vecchio
+ * diventa old e ogni inserimento o rimozione ne sposta HTABLE_REHASH_STEP
+ * gruppi in quello nuovo, così nessuna operazione paga da sola il costo di
+ * tutta la copia. Finché lo spostamento non è finito una chiave può trovarsi
+ * in uno qualsiasi dei due array.
+ *
+ * Le chiavi sono divise in HTABLE_SHARDS partizioni indipendenti (vedere
+ * htable_shard), ognuna delle quali è una tabella come quella descritta qui.
+ *
+ * Gli array tolti e i nickname_t rimossi vengono liberati con epoch_retire,
+ * così chi li ha raggiunti senza lock può continuare ad usarli fino alla fine
+ * della sua sezione (vedere epoch.h).
  */
 
+/**
+ * @struct htable_shard
+ * @brief Una partizione dell'hashtable, con la sua lock e i suoi array
+ *
+ * Ogni chiave appartiene ad una sola partizione, scelta con l'hash, e solo la
+ * sua lock serve per inserirla o rimuoverla: inserimenti e rimozioni in
+ * partizioni diverse procedono in parallelo, e ogni partizione si ridimensiona
+ * da sola. Ogni partizione occupa linee di cache sue.
+ *
+ * @var struct htable_shard::cur L'array in cui vengono inseriti gli elementi
+ * @var struct htable_shard::old L'array che si sta svuotando in cur, oppure
+ *                               NULL
+ * @var struct htable_shard::mutex Lock della partizione
+ * @var struct htable_shard::migrated Numero di gruppi di old già spostati
+ * @var struct htable_shard::nentries Numero di elementi della partizione
+ * @var struct htable_shard::min_capacity Sotto questo numero di slot la
+ *                                        partizione non si restringe
+ */
+typedef struct htable_shard {
+	htable_slots_t* cur;
+	htable_slots_t* old;
+	pthread_mutex_t mutex;
+	int migrated;
+	int nentries;
+	int min_capacity;
+	char pad[2 * CACHE_LINE_SIZE - 2 * sizeof(htable_slots_t*)
+	         - sizeof(pthread_mutex_t) - 3 * sizeof(int)];
+} htable_shard_t;
+
 /**
  * @struct htable
  * @brief Implementazione di htable_t
- * @var struct htable::htable L'hashtable senza sincronizzazione
+ * @var struct htable::shards Le partizioni
  * @var struct htable::hist_size La dimensione della history
- * @var struct htable::mutex Mutex interna dell'hashtable per implementare la
- *                           sincronizzazione
  */
 typedef struct htable {
-	icl_hash_t* htable;
+	htable_shard_t shards[HTABLE_SHARDS];
 	int hist_size;
-	pthread_mutex_t mutex;
 } htable_t;
 
 
 /**
  * @brief Inizializza una nuova hashtable vuota
- * @param nbuckets Il numero di buckets per l'hashtable. Consigliato il doppio
- *                 del numero di elementi atteso.
+ * @param nbuckets Il numero iniziale di slot per l'hashtable, diviso tra le
+ *                 partizioni e arrotondato alla potenza di 2 successiva
+ *                 (almeno HTABLE_GROUP_SIZE per partizione). L'hashtable
+ *                 cresce da sola, ma non scende mai sotto questo numero.
  * @param history_size La lunghezza della history da allocare agli elementi.
  * @return La nuova hashtable
  */
@@ -70,8 +172,13 @@ int ts_hash_destroy(htable_t* ht);
  * @brief Cerca una chiave nell'hashtable
  *
  * Questa funzione non è sincronizzata perché, essendo in sola lettura e dato
-   che l'inserimento e la rimozione lasciano SEMPRE l'hashtable in uno stato
-   consistente, non può generare corse critiche con altri thread.
+   che l'inserimento, la rimozione e lo spostamento degli slot lasciano SEMPRE
+   l'hashtable in uno stato consistente, non può generare corse critiche con
+   altri thread.
+ *
+ * Il valore restituito resta valido anche se nel frattempo la chiave viene
+ * rimossa, ma solo fino alla fine della sezione (epoch_enter) in cui si trova
+ * il chiamante: chi vuole usarlo dopo la chiamata deve esserci entrato prima.
  *
  * @param ht L'hashtable in cui cercare la chiave
  * @param key La chiave da cercare
@@ -84,7 +191,7 @@ nickname_t* hash_find(htable_t* ht, char* key);
  * Inserisce la chiave senza nessun dato associato.
  *
  * @param ht L'hashtable in cui inserire la chiave
- * @param key La chiave da inserire
+ * @param key La chiave da inserire (al più MAX_NAME_LENGTH caratteri)
  * @return Un puntatore al nuovo elemento. Se l'elemento era già presente, NULL
  */
 nickname_t* ts_hash_insert(htable_t* ht, char* key);
@@ -92,11 +199,35 @@ nickname_t* ts_hash_insert(htable_t* ht, char* key);
 /**
  * @brief Thread-safe remove
  *
- * Rimuove una chiave
+ * Rimuove una chiave. Il nickname_t associato viene liberato solo quando sono
+ * finite tutte le sezioni che potevano averlo trovato.
  * @param ht L'hashtable da cui eliminare la chiave
  * @param key La chiave da eliminare
  * @return true se la chiave era presente, false altrimenti
  */
 bool ts_hash_remove(htable_t* ht, char* key);
 
+/**
+ * @brief Numero di chiavi presenti nell'hashtable
+ *
+ * Somma i contatori delle partizioni senza prendere le lock: se nel frattempo
+ * ci sono inserimenti o rimozioni il risultato è approssimato.
+ *
+ * @param ht L'hashtable
+ * @return Il numero di chiavi
+ */
+int hash_count(htable_t* ht);
+
+/**
+ * @brief Chiama una funzione su ogni elemento dell'hashtable
+ *
+ * Mentre visita una partizione ne tiene la lock, quindi fun non deve inserire
+ * né rimuovere chiavi.
+ *
+ * @param ht L'hashtable
+ * @param fun La funzione da chiamare, con la chiave, il valore e arg
+ * @param arg Argomento passato a fun
+ */
+void ts_hash_foreach(htable_t* ht, void (*fun)(char*, nickname_t*, void*), void* arg);
+
 #endif /* CHATTERBOX_HASH_H_ */
@@ -10,6 +10,12 @@
  *       flavio.ascari@sns.it
  */
 
+// Serve per syscall()
+#define _GNU_SOURCE
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
 #include "lock.h"
 
 void error_handling_lock(pthread_mutex_t* mutex) {
@@ -30,3 +36,11 @@ void error_handling_unlock(pthread_mutex_t* mutex) {
 		exit(EXIT_FAILURE);
 	}
 }
+
+void futex_wait(int* futex, int val) {
+	syscall(SYS_futex, futex, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+void futex_wake(int* futex, int n) {
+	syscall(SYS_futex, futex, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
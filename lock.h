@@ -43,4 +43,22 @@ void error_handling_lock(pthread_mutex_t* mutex);
 */
 void error_handling_unlock(pthread_mutex_t* mutex);
 
+/**
+* @brief Si blocca sulla futex finché vale ancora val
+*
+* Può ritornare anche senza un risveglio esplicito (ad esempio se la futex è già
+* cambiata o per un segnale), quindi il chiamante deve ricontrollare la
+* condizione che sta aspettando.
+* @param futex La futex su cui attendere
+* @param val Il valore che la futex deve avere per bloccarsi
+*/
+void futex_wait(int* futex, int val);
+
+/**
+* @brief Sveglia al più n thread bloccati sulla futex
+* @param futex La futex
+* @param n Il numero massimo di thread da svegliare
+*/
+void futex_wake(int* futex, int n);
+
 #endif /* CHATTERBOX_LOCK_H_ */
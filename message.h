@@ -42,6 +42,19 @@
                  nickname inesistente)
  * - DISCONNECT_OP: non serve nessuna informazione. Errori: nessuno
  * - USRLIST_OP: non serve nessuna informazione. Errori: nessuno
+ * - USRLIST_SINCE_OP: msg.data.buf contiene un unsigned long, la versione della
+                       lista degli utenti connessi che il client conosce già (0
+                       se non ne conosce nessuna), e msg.data.hdr.len è
+                       sizeof(unsigned long).
+                       Errori: OP_MSG_INVALID (versione mancante)
+ * - PRESENCE_SUB_OP: come USRLIST_SINCE_OP, ma msg.hdr.sender deve essere il
+                      proprio nick (con cui ci si è connessi precedentemente).
+                      Dopo la risposta il client riceve un PRESENCE_MESSAGE per
+                      ogni cambiamento della lista, finché non si disconnette.
+                      Errori: OP_NICK_UNKNOWN (richiesta da nickname
+                      sconosciuto), OP_WRONG_FD (richiesta da un nickname su un
+                      fd su cui non è connesso), OP_MSG_INVALID (versione
+                      mancante)
  * - POSTTXT_OP: msg.hdr.sender deve essere il proprio nick (con cui ci si è
                  connessi precedentemente), msg.data.hdr.receiver è il nick di
                  chi deve ricevere il messaggio, msg.data.hdr.len è la lunghezza
@@ -100,9 +113,38 @@
           All'invio di questa risposta deve seguire l'invio dei messaggi salvati
           nella history.
  * - OP_OK, file: il buffer contiene l'intero file.
+ * - OP_OK, cambiamenti della lista degli utenti connessi (risposta a
+          USRLIST_SINCE_OP e PRESENCE_SUB_OP): il buffer inizia con un
+          presence_hdr_t, seguito da record di PRESENCE_RECORD_SIZE byte, ognuno
+          formato da PRESENCE_JOIN o PRESENCE_LEAVE e da un nome (come nella
+          lista degli utenti connessi). I record vanno applicati in ordine alla
+          lista della versione richiesta; se presence_hdr_t::full è diverso da
+          0 invece i record sono tutti PRESENCE_JOIN e formano l'intera lista.
+ * - PRESENCE_MESSAGE: il buffer ha lo stesso formato, con un solo record. Se
+          la versione non è quella successiva all'ultima ricevuta alcuni
+          cambiamenti sono andati persi (ad esempio perché il client non
+          leggeva) e la lista va richiesta di nuovo con USRLIST_SINCE_OP.
  */
 
 
+/**
+ * @struct presence_hdr_t
+ * @brief Inizio del buffer con i cambiamenti della lista degli utenti connessi
+ *
+ * @var presence_hdr_t::version
+ * versione della lista dopo i cambiamenti
+ * @var presence_hdr_t::full
+ * diverso da 0 se i record sono l'intera lista invece dei cambiamenti
+ */
+typedef struct {
+    unsigned long version;
+    int           full;
+} presence_hdr_t;
+
+#define PRESENCE_JOIN '+'   /**< il nome si è connesso */
+#define PRESENCE_LEAVE '-'  /**< il nome si è disconnesso */
+#define PRESENCE_RECORD_SIZE (MAX_NAME_LENGTH + 2)
+
 /**
  * @struct message_hdr_t
  * @brief Questa struct contiene l'header di un messaggio.
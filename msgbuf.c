@@ -0,0 +1,57 @@
+/**
+ * @file msgbuf.c
+ * @brief Implementazione di msgbuf.h
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+
+#include <string.h>
+
+#include "msgbuf.h"
+
+// ------------------ Funzioni interne ---------------
+
+/**
+ * @brief Risale dal contenuto alla struttura che lo contiene
+ *
+ * @param buf Il contenuto di un msgbuf_t
+ * @return Il msgbuf_t
+ */
+static msgbuf_t* msgbuf_of(char* buf) {
+	return (msgbuf_t*)(buf - offsetof(msgbuf_t, data));
+}
+
+// ------- Funzioni esportate --------------
+// Documentate in msgbuf.h
+
+char* msgbuf_create(const char* src, size_t len) {
+	msgbuf_t* mb = malloc(sizeof(msgbuf_t) + len);
+	if (mb == NULL) {
+		return NULL;
+	}
+	mb->refs = 1;
+	memcpy(mb->data, src, len);
+	return mb->data;
+}
+
+char* msgbuf_ref(char* buf) {
+	// Chi chiama ha già un riferimento, quindi non serve ordinare niente
+	__atomic_add_fetch(&(msgbuf_of(buf)->refs), 1, __ATOMIC_RELAXED);
+	return buf;
+}
+
+void msgbuf_unref(char* buf) {
+	if (buf == NULL) {
+		return;
+	}
+	msgbuf_t* mb = msgbuf_of(buf);
+	// L'ultimo a rilasciare deve vedere tutti gli accessi degli altri
+	if (__atomic_sub_fetch(&(mb->refs), 1, __ATOMIC_ACQ_REL) == 0) {
+		free(mb);
+	}
+}
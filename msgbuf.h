@@ -0,0 +1,65 @@
+/**
+ * @file msgbuf.h
+ * @brief Libreria per i buffer dei messaggi condivisi tra più history
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+#ifndef CHATTERBOX_MSGBUF_H_
+#define CHATTERBOX_MSGBUF_H_
+
+#include <stdlib.h>
+#include <stddef.h>
+
+/**
+ * @struct msgbuf
+ * @brief Body di un messaggio con un contatore di riferimenti
+ *
+ * Il resto del programma vede solo il puntatore a data, che si usa come un
+ * normale char* (ad esempio come message_data_t::buf); il contatore sta subito
+ * prima. Il contenuto non va modificato dopo la creazione, perché lo stesso
+ * buffer può trovarsi in più history e venire inviato da più thread insieme.
+ * Il contatore è atomico, quindi thread diversi possono prendere e rilasciare
+ * riferimenti senza lock.
+ *
+ * @var struct msgbuf::refs Numero di riferimenti al buffer
+ * @var struct msgbuf::data Il contenuto del body
+ */
+typedef struct msgbuf {
+	int refs;
+	char data[];
+} msgbuf_t;
+
+/**
+ * @brief Crea un buffer condiviso con una copia dei dati passati e un solo
+ * riferimento
+ *
+ * @param src I dati da copiare
+ * @param len Il numero di byte da copiare
+ * @return Il puntatore al contenuto del nuovo buffer, NULL se non c'è
+ *         abbastanza memoria
+ */
+char* msgbuf_create(const char* src, size_t len);
+
+/**
+ * @brief Prende un nuovo riferimento ad un buffer condiviso
+ *
+ * @param buf Il buffer, come restituito da msgbuf_create
+ * @return buf stesso
+ */
+char* msgbuf_ref(char* buf);
+
+/**
+ * @brief Rilascia un riferimento ad un buffer condiviso, liberandolo se era
+ * l'ultimo
+ *
+ * @param buf Il buffer, come restituito da msgbuf_create (se è NULL non fa
+ *            niente)
+ */
+void msgbuf_unref(char* buf);
+
+#endif /* CHATTERBOX_MSGBUF_H_ */
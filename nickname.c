@@ -14,6 +14,49 @@
 
 // ------------------ Funzioni interne ---------------
 
+/**
+ * Byte allocati per le history di tutti i nickname_t
+ */
+static long hist_memory = 0;
+
+/**
+ * @brief Byte occupati da una coda circolare con un certo numero di posti
+ */
+static long history_bytes(int capacity) {
+	return capacity * (long)(sizeof(message_t) + sizeof(unsigned long));
+}
+
+/**
+ * @brief Sposta l'history in una nuova coda circolare, con i messaggi dal più
+ * vecchio al più recente a partire dall'indice 0.
+ *
+ * @param nick Il nickname_t
+ * @param capacity La nuova dimensione, non minore di hist_len
+ * @return 0 in caso di successo, < 0 se non c'è abbastanza memoria
+ */
+static int resize_history(nickname_t* nick, int capacity) {
+	message_t* history = malloc(capacity * sizeof(message_t));
+	unsigned long* hist_seq = malloc(capacity * sizeof(unsigned long));
+	if (history == NULL || hist_seq == NULL) {
+		free(history);
+		free(hist_seq);
+		return -1;
+	}
+	for (int k = 0; k < nick->hist_len; ++k) {
+		int pos = (nick->first - k + nick->hist_capacity) % nick->hist_capacity;
+		history[nick->hist_len - 1 - k] = nick->history[pos];
+		hist_seq[nick->hist_len - 1 - k] = nick->hist_seq[pos];
+	}
+	free(nick->history);
+	free(nick->hist_seq);
+	__atomic_add_fetch(&hist_memory, history_bytes(capacity) - history_bytes(nick->hist_capacity), __ATOMIC_RELAXED);
+	nick->history = history;
+	nick->hist_seq = hist_seq;
+	nick->hist_capacity = capacity;
+	nick->first = nick->hist_len - 1;
+	return 0;
+}
+
 // ------- Funzioni esportate --------------
 // Documentate in nickname.h
 
@@ -22,9 +65,12 @@ nickname_t* create_nickname(int history_size) {
 	res->fd = 0;
 	res->first = -1;
 	res->hist_size = history_size;
-	res->history = malloc(history_size * sizeof(message_t));
-	// questo segnala se l'ultimo messaggio è stato mai inizializzato o meno
-	res->history[history_size - 1].hdr.op = OP_FAKE_MSG;
+	res->hist_len = 0;
+	res->hist_capacity = 0;
+	res->history = NULL;
+	res->hist_seq = NULL;
+	res->bcast_cursor = 0;
+	res->removed = false;
 	pthread_mutex_init(&(res->mutex), NULL);
 	return res;
 }
@@ -36,36 +82,67 @@ void free_nickname(void* val) {
 	int i;
 	message_t* msg;
 	history_foreach(tmp, i, msg) {
-		free(msg->data.buf);
+		msgbuf_unref(msg->data.buf);
 	}
 	free(tmp->history);
+	free(tmp->hist_seq);
+	__atomic_sub_fetch(&hist_memory, history_bytes(tmp->hist_capacity), __ATOMIC_RELAXED);
 	error_handling_unlock(&(tmp->mutex));
 	pthread_mutex_destroy(&(tmp->mutex));
 	free(tmp);
 }
 
 bool is_history_full(nickname_t* nick) {
-	return nick->history[nick->hist_size - 1].hdr.op != OP_FAKE_MSG;
+	return nick->hist_len == nick->hist_size;
 }
 
-void add_to_history(nickname_t* nick, message_t msg) {
-	// aggiunta alla coda circolare: aumento l'indice di testa e sostituisco
-	nick->first = ((nick->first) + 1) % nick->hist_size;
-	if (is_history_full(nick)) {
-		// devo liberare la memoria occupata dal vecchio messaggio
-		if (nick->history[nick->first].data.buf != NULL) {
-			#if defined DEBUG && defined VERBOSE
-				fprintf(stderr, "HTABLE: Libero il buffer sovrascrivendo la history %p\n", nick->history[nick->first].data.buf);
-			#endif
-			free(nick->history[nick->first].data.buf);
+void add_to_history(nickname_t* nick, message_t msg, unsigned long seq) {
+	if (nick->hist_len == nick->hist_capacity && nick->hist_capacity < nick->hist_size) {
+		int capacity = nick->hist_capacity == 0 ? HISTORY_MIN_CAPACITY : 2 * nick->hist_capacity;
+		if (resize_history(nick, capacity < nick->hist_size ? capacity : nick->hist_size) < 0
+			&& nick->hist_capacity == 0) {
+			perror("allocando l'history");
+			msgbuf_unref(msg.data.buf);
+			return;
 		}
 	}
+	// aggiunta alla coda circolare: aumento l'indice di testa e sostituisco
+	nick->first = ((nick->first) + 1) % nick->hist_capacity;
+	if (nick->hist_len == nick->hist_capacity) {
+		// devo rilasciare il buffer del vecchio messaggio, che viene
+		// liberato solo se non è più in nessun'altra history
+		#if defined DEBUG && defined VERBOSE
+			fprintf(stderr, "HTABLE: Rilascio il buffer sovrascrivendo la history %p\n", nick->history[nick->first].data.buf);
+		#endif
+		msgbuf_unref(nick->history[nick->first].data.buf);
+	}
+	else {
+		++nick->hist_len;
+	}
 	nick->history[nick->first] = msg;
+	nick->hist_seq[nick->first] = seq;
+}
+
+void shrink_history(nickname_t* nick) {
+	if (nick->hist_len > 0 && nick->hist_len < nick->hist_capacity
+		&& resize_history(nick, nick->hist_len) < 0) {
+		perror("riducendo l'history");
+	}
+}
+
+message_t* history_nth(nickname_t* nick, int k, unsigned long* seq) {
+	if (k >= nick->hist_len) {
+		return NULL;
+	}
+	int pos = (nick->first - k + nick->hist_capacity) % nick->hist_capacity;
+	*seq = nick->hist_seq[pos];
+	return nick->history + pos;
 }
 
 int history_len(nickname_t* nick) {
-	if (is_history_full(nick))
-		return nick->hist_size;
-	else
-		return nick->first + 1;
+	return nick->hist_len;
+}
+
+long history_memory() {
+	return __atomic_load_n(&hist_memory, __ATOMIC_RELAXED);
 }
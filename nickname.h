@@ -21,6 +21,7 @@
 
 #include "lock.h"
 #include "message.h"
+#include "msgbuf.h"
 
 /**
  * @struct nickname
@@ -28,47 +29,62 @@
  * nickname.
  *
  * La history viene gestita con una coda circolare, da scorrere all'indietro per
- * avere i messaggi in ordine cronologico (dal più nuovo). Per controllare se
- * la coda circolare è piena, l'ultimo elemento viene inizializzato con una
- * operazione apposta, OP_FAKE_MSG: quando la coda viene riempita per la prima
- * volta, l'ultimo elemento viene sovrascritto e la sua operazione diventa
- * regolare. La variabile first contiene l'indice dell'ultimo elemento inserito,
- * e viene aumentata (modulo hist_size) ogni volta che si vuole aggiungere un
- * nuovo elemento.
+ * avere i messaggi in ordine cronologico (dal più nuovo). La variabile first
+ * contiene l'indice dell'ultimo elemento inserito, e viene aumentata (modulo
+ * hist_capacity) ogni volta che si vuole aggiungere un nuovo elemento.
+ *
+ * La coda viene allocata solo al primo messaggio, con HISTORY_MIN_CAPACITY
+ * posti, e raddoppia quando è piena fino ad arrivare a hist_size: un nickname
+ * che riceve pochi messaggi occupa poca memoria. Quando il client si
+ * disconnette shrink_history libera i posti non usati, perché un nickname
+ * inattivo non occupi più memoria dei messaggi che ha. La memoria occupata da
+ * tutte le history si legge con history_memory.
  *
  * @var struct nickname::fd Il fd su cui è aperta la connessione con il client
  *                          connesso con quel nickname. Se fd è 0 vuol dire che
  *                          nessun client è connesso con quel nickname
  * @var struct nickname::first Indice di inizio della coda circolare
  *                             dell'history
- * @var struct nickname::hist_size Dimensione dell'history
- * @var struct nickname::history Array di messaggi che rappresentano la history
+ * @var struct nickname::hist_size Dimensione massima dell'history
+ * @var struct nickname::hist_len Numero di messaggi nell'history
+ * @var struct nickname::hist_capacity Dimensione della coda circolare allocata
+ * @var struct nickname::history Array di messaggi che rappresentano la
+ *                               history, NULL se non ne ha mai ricevuti
+ * @var struct nickname::hist_seq Numero di sequenza di ogni messaggio
+ *                                dell'history
+ * @var struct nickname::bcast_cursor Primo numero di sequenza dei messaggi a
+ *                                    tutti che riguardano questo nickname
+ *                                    (quelli inviati dopo la registrazione),
+ *                                    vedere broadcast.h
+ * @var struct nickname::removed true se il nickname è stato deregistrato:
+ *                               viene impostato, con la lock presa, prima di
+ *                               toglierlo dall'hashtable, e da quel momento
+ *                               nessun client si può più connettere con esso
  */
 typedef struct nickname {
-	int fd, first, hist_size;
+	int fd, first, hist_size, hist_len, hist_capacity;
 	message_t* history;
+	unsigned long* hist_seq;
+	unsigned long bcast_cursor;
+	bool removed;
 	pthread_mutex_t mutex;
 } nickname_t;
 
+#define HISTORY_MIN_CAPACITY 2 /**< posti allocati al primo messaggio */
+
 /**
- * @brief Itera su tutta l'history. Si aspetta che il lock su nick->mutex sia
- * già stato acquisito.
- *
- * Questa macro funziona pensando l'array circolare come replicato dagli indici
- * [0; hist_size) e [hist_size; 2 * hist_size), e scorre da (first + hist_size)
- * a (first + 1) scendendo. Se la history non è piena si ferma a hist_size.
- *
- * \image html immagine_history_foreach.png
+ * @brief Itera su tutta l'history, dal messaggio più recente. Si aspetta che il
+ * lock su nick->mutex sia già stato acquisito.
  *
  * @param nick (nickname_t*) Il nickname sulla cui history si vuole iterare.
- * @param i (int) L'indice nella history, va usato sempre modulo hist_size (si
-                  consiglia di usare direttamente l'elemento msg invece di i).
+ * @param i (int) Quanti messaggi più recenti sono già stati visitati.
  * @param msg (message_t*) Puntatore all'elemento corrente della history.
  */
 #define history_foreach(nick, i, msg) \
-	for(msg = &(nick->history[(i = nick->first + nick->hist_size) % nick->hist_size]); \
-		i > (is_history_full(nick) ? nick->first : nick->hist_size - 1); \
-		msg = &(nick->history[(--i) % nick->hist_size]))
+	for(i = 0; \
+		i < nick->hist_len \
+			&& (msg = &(nick->history[(nick->first - i + nick->hist_capacity) % nick->hist_capacity])); \
+		++i)
 
 
 /**
@@ -83,10 +99,10 @@ nickname_t* create_nickname(int history_size);
 /**
  * @brief Elimina un nickname_t, liberando tutta la memoria che aveva allocato.
  * Questa funzione si occupa anche di liberare la memoria occupata dalla
- * history e dai messaggi che conteneva.
+ * history e di rilasciare i buffer dei messaggi che conteneva.
  *
  * Il parametro è di tipo void* per evitare warnings quando viene passata ad
- * icl_hash_remove e icl_hash_destroy.
+ * le funzioni di liberazione della memoria.
  *
  * @param val (nickname_t*) il nickname da eliminare.
  */
@@ -101,15 +117,48 @@ void free_nickname(void* val);
 bool is_history_full(nickname_t* nick);
 
 /**
- * @brief Aggiunge un messaggio alla history. Libera la memoria quando serve.
+ * @brief Aggiunge un messaggio alla history. Alloca e libera la memoria quando
+ * serve.
+ *
+ * Si aspetta che sia già stato acquisito il lock su nick->mutex. Se la coda è
+ * piena ma può ancora crescere e non c'è abbastanza memoria per farlo, il
+ * messaggio prende il posto del più vecchio.
  *
- * Si aspetta che sia già stato acquisito il lock su nick->mutex.
+ * Il buffer del messaggio deve essere stato creato con msgbuf_create: la
+ * history prende il riferimento di chi chiama e lo rilascia quando il
+ * messaggio viene sovrascritto o il nickname eliminato. Per mettere lo stesso
+ * buffer in più history serve un riferimento per ognuna (msgbuf_ref).
  *
  * @param nick Il nickname_t a cui aggiungere il messaggio
  * @param msg Il messaggio da aggiungere (il messaggio viene copiato, il
               il puntatore al buffer però rimane lo stesso)
+ * @param seq Il numero di sequenza del messaggio, maggiore di quelli già
+ *            inseriti
  */
-void add_to_history(nickname_t* nick, message_t msg);
+void add_to_history(nickname_t* nick, message_t msg, unsigned long seq);
+
+/**
+ * @brief Riduce la coda circolare dell'history al numero di messaggi che
+ * contiene, liberando i posti non usati. Si aspetta che il lock su
+ * nick->mutex sia già stato acquisito.
+ *
+ * I messaggi restano tutti: se ne arrivano altri la coda torna a crescere come
+ * in add_to_history. Se non c'è abbastanza memoria la coda resta com'è.
+ *
+ * @param nick Il nickname_t
+ */
+void shrink_history(nickname_t* nick);
+
+/**
+ * @brief Restituisce uno dei messaggi dell'history, a partire dal più recente.
+ * Si aspetta che il lock su nick->mutex sia già stato acquisito.
+ *
+ * @param nick Il nickname_t
+ * @param k Quanti messaggi più recenti saltare (0 per il più recente)
+ * @param seq Puntatore su cui viene scritto il numero di sequenza del messaggio
+ * @return Il messaggio, NULL se l'history ne contiene meno di k + 1
+ */
+message_t* history_nth(nickname_t* nick, int k, unsigned long* seq);
 
 /**
  * @brief Calcola la lunghezza della history. Si aspetta che il lock su
@@ -120,4 +169,12 @@ void add_to_history(nickname_t* nick, message_t msg);
  */
 int history_len(nickname_t* nick);
 
+/**
+ * @brief Memoria occupata in questo momento dalle history di tutti i
+ * nickname_t, senza contare i buffer dei messaggi
+ *
+ * @return Il numero di byte
+ */
+long history_memory();
+
 #endif /* CHATTERBOX_NICKNAME_H_ */
@@ -0,0 +1,159 @@
+/**
+ * @file online.c
+ * @brief Implementazione di online.h
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+
+#include "online.h"
+
+// ------------------ Funzioni interne ---------------
+
+/**
+ * @brief Copia l'elenco in una nuova snapshot. Va chiamata con la lock presa.
+ *
+ * @param list L'elenco
+ * @return La nuova snapshot, NULL se non c'è abbastanza memoria
+ */
+static online_snapshot_t* build_snapshot(online_list_t* list) {
+	size_t len = (size_t)list->count * (MAX_NAME_LENGTH + 1);
+	online_snapshot_t* snap = malloc(sizeof(online_snapshot_t) + len);
+	if (snap == NULL) {
+		return NULL;
+	}
+	snap->version = list->version;
+	snap->count = list->count;
+	memcpy(snap->names, list->names, len);
+	return snap;
+}
+
+/**
+ * @brief Registra il cambiamento che porta alla versione successiva. Va
+ * chiamata con la lock presa, prima di aumentare la versione.
+ *
+ * @param list L'elenco
+ * @param op PRESENCE_JOIN o PRESENCE_LEAVE
+ * @param name Il nickname
+ */
+static void log_change(online_list_t* list, char op, const char* name) {
+	char* record = list->log[list->version % list->size].record;
+	record[0] = op;
+	memcpy(record + 1, name, MAX_NAME_LENGTH + 1);
+}
+
+// ------- Funzioni esportate --------------
+// Documentate in online.h
+
+int create_online_list(online_list_t* list, int size) {
+	list->names = malloc(size * sizeof(*(list->names)));
+	list->refs = malloc(size * sizeof(int*));
+	list->count = 0;
+	list->size = size;
+	list->version = 0;
+	list->snapshot = NULL;
+	list->log = malloc(size * sizeof(online_change_t));
+	if (list->names == NULL || list->refs == NULL || list->log == NULL
+		|| (list->snapshot = build_snapshot(list)) == NULL) {
+		free(list->names);
+		free(list->refs);
+		free(list->log);
+		return -1;
+	}
+	pthread_mutex_init(&(list->mutex), NULL);
+	return 0;
+}
+
+void clear_online_list(online_list_t* list) {
+	free(list->names);
+	free(list->refs);
+	free(list->snapshot);
+	free(list->log);
+	pthread_mutex_destroy(&(list->mutex));
+}
+
+unsigned long online_add(online_list_t* list, const char* name, int* ref) {
+	error_handling_lock(&(list->mutex));
+	strncpy(list->names[list->count], name, MAX_NAME_LENGTH);
+	list->names[list->count][MAX_NAME_LENGTH] = '\0';
+	list->refs[list->count] = ref;
+	*ref = list->count;
+	log_change(list, PRESENCE_JOIN, list->names[list->count]);
+	++list->count;
+	unsigned long version = __atomic_add_fetch(&(list->version), 1, __ATOMIC_RELEASE);
+	error_handling_unlock(&(list->mutex));
+	return version;
+}
+
+unsigned long online_remove(online_list_t* list, int* ref) {
+	error_handling_lock(&(list->mutex));
+	int pos = *ref;
+	int last = --list->count;
+	log_change(list, PRESENCE_LEAVE, list->names[pos]);
+	if (pos != last) {
+		memcpy(list->names[pos], list->names[last], MAX_NAME_LENGTH + 1);
+		list->refs[pos] = list->refs[last];
+		*(list->refs[pos]) = pos;
+	}
+	*ref = -1;
+	unsigned long version = __atomic_add_fetch(&(list->version), 1, __ATOMIC_RELEASE);
+	error_handling_unlock(&(list->mutex));
+	return version;
+}
+
+online_snapshot_t* online_snapshot(online_list_t* list) {
+	online_snapshot_t* snap = __atomic_load_n(&(list->snapshot), __ATOMIC_ACQUIRE);
+	if (snap->version == __atomic_load_n(&(list->version), __ATOMIC_ACQUIRE)) {
+		return snap;
+	}
+	error_handling_lock(&(list->mutex));
+	// Un altro thread potrebbe averla appena ricostruita
+	snap = list->snapshot;
+	if (snap->version != list->version) {
+		online_snapshot_t* fresh = build_snapshot(list);
+		if (fresh == NULL) {
+			error_handling_unlock(&(list->mutex));
+			return NULL;
+		}
+		__atomic_store_n(&(list->snapshot), fresh, __ATOMIC_RELEASE);
+		// Chi l'ha appena letta può continuare ad usarla
+		epoch_retire(snap, &free);
+		snap = fresh;
+	}
+	error_handling_unlock(&(list->mutex));
+	return snap;
+}
+
+char* online_since(online_list_t* list, unsigned long version, unsigned int* len) {
+	error_handling_lock(&(list->mutex));
+	unsigned long changes = list->version - version;
+	// Le versioni più vecchie di size cambiamenti non sono più nel registro
+	bool full = version > list->version || changes > (unsigned long)list->size
+		|| changes >= (unsigned long)list->count;
+	unsigned long nrecords = full ? (unsigned long)list->count : changes;
+	*len = sizeof(presence_hdr_t) + nrecords * PRESENCE_RECORD_SIZE;
+	char* buf = malloc(*len);
+	if (buf != NULL) {
+		presence_hdr_t hdr;
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.version = list->version;
+		hdr.full = full;
+		memcpy(buf, &hdr, sizeof(hdr));
+		char* record = buf + sizeof(hdr);
+		for (unsigned long i = 0; i < nrecords; ++i, record += PRESENCE_RECORD_SIZE) {
+			if (full) {
+				record[0] = PRESENCE_JOIN;
+				memcpy(record + 1, list->names[i], MAX_NAME_LENGTH + 1);
+			}
+			else {
+				memcpy(record, list->log[(version + i) % list->size].record, PRESENCE_RECORD_SIZE);
+			}
+		}
+	}
+	error_handling_unlock(&(list->mutex));
+	return buf;
+}
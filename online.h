@@ -0,0 +1,158 @@
+/**
+ * @file online.h
+ * @brief Libreria per l'elenco dei nickname connessi
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+#ifndef CHATTERBOX_ONLINE_H_
+#define CHATTERBOX_ONLINE_H_
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "message.h"
+#include "lock.h"
+#include "epoch.h"
+
+/**
+ * @struct online_snapshot
+ * @brief Copia dell'elenco dei connessi, già nel formato della risposta
+ *
+ * Una volta pubblicata non viene più modificata: chi la legge non ha bisogno
+ * di lock, solo di restare nella sua sezione (vedere epoch.h).
+ *
+ * @var struct online_snapshot::version La versione dell'elenco copiata
+ * @var struct online_snapshot::count Numero di nickname
+ * @var struct online_snapshot::names I nickname, ognuno in MAX_NAME_LENGTH + 1
+ *                                    byte
+ */
+typedef struct online_snapshot {
+	unsigned long version;
+	int count;
+	char names[];
+} online_snapshot_t;
+
+/**
+ * @struct online_change
+ * @brief Un cambiamento dell'elenco, già nel formato di USRLIST_SINCE_OP
+ *
+ * @var struct online_change::record PRESENCE_JOIN o PRESENCE_LEAVE seguito dal
+ *                                   nickname
+ */
+typedef struct online_change {
+	char record[PRESENCE_RECORD_SIZE];
+} online_change_t;
+
+/**
+ * @struct online_list
+ * @brief Elenco dei nickname connessi, per USRLIST_OP, CONNECT_OP e
+ * REGISTER_OP
+ *
+ * I nickname stanno uno dopo l'altro in names, senza buchi: un inserimento li
+ * aggiunge in fondo e una rimozione sposta l'ultimo al posto di quello rimosso,
+ * quindi entrambi costano O(1). Per ritrovare la propria posizione dopo gli
+ * spostamenti ogni elemento ha un puntatore all'intero in cui il proprietario
+ * la conserva (refs).
+ *
+ * Ogni modifica aumenta version. L'elenco già pronto da inviare è snapshot:
+ * finché la versione non cambia viene riusato da tutti senza prendere la
+ * lock, altrimenti il primo che lo chiede lo ricostruisce e sostituisce il
+ * vecchio, che viene liberato con epoch_retire.
+ *
+ * Gli ultimi size cambiamenti restano in log, così a chi conosce già una
+ * versione recente si possono inviare solo i cambiamenti successivi (vedere
+ * online_since). Il cambiamento che ha portato alla versione v si trova in
+ * log[(v - 1) % size].
+ *
+ * @var struct online_list::mutex Lock per le modifiche
+ * @var struct online_list::names I nickname connessi
+ * @var struct online_list::refs Dove il proprietario di ogni nickname conserva
+ *                               la sua posizione
+ * @var struct online_list::count Numero di nickname
+ * @var struct online_list::size Numero massimo di nickname
+ * @var struct online_list::version Numero di modifiche fatte finora
+ * @var struct online_list::snapshot L'ultima copia pubblicata
+ * @var struct online_list::log Registro circolare degli ultimi cambiamenti
+ */
+typedef struct online_list {
+	pthread_mutex_t mutex;
+	char (*names)[MAX_NAME_LENGTH + 1];
+	int** refs;
+	int count;
+	int size;
+	unsigned long version;
+	online_snapshot_t* snapshot;
+	online_change_t* log;
+} online_list_t;
+
+/**
+ * @brief Inizializza un elenco vuoto
+ *
+ * @param list L'elenco da inizializzare
+ * @param size Il numero massimo di nickname connessi, che è anche il numero di
+ *             cambiamenti conservati
+ * @return 0 in caso di successo, < 0 se non c'è abbastanza memoria
+ */
+int create_online_list(online_list_t* list, int size);
+
+/**
+ * @brief Libera la memoria occupata da un elenco
+ *
+ * @param list L'elenco da eliminare
+ */
+void clear_online_list(online_list_t* list);
+
+/**
+ * @brief Aggiunge un nickname all'elenco
+ *
+ * @param list L'elenco
+ * @param name Il nickname
+ * @param ref Dove viene scritta (e aggiornata quando cambia) la posizione del
+ *            nickname, finché non viene rimosso
+ * @return La versione dell'elenco dopo l'aggiunta
+ */
+unsigned long online_add(online_list_t* list, const char* name, int* ref);
+
+/**
+ * @brief Rimuove un nickname dall'elenco
+ *
+ * @param list L'elenco
+ * @param ref Il puntatore passato a online_add per quel nickname
+ * @return La versione dell'elenco dopo la rimozione
+ */
+unsigned long online_remove(online_list_t* list, int* ref);
+
+/**
+ * @brief Restituisce l'elenco aggiornato, pronto da inviare
+ *
+ * Va chiamata dentro una sezione (epoch_enter): la copia restituita resta
+ * valida fino alla fine della sezione e non va modificata né liberata.
+ *
+ * @param list L'elenco
+ * @return La copia, NULL se non c'è abbastanza memoria
+ */
+online_snapshot_t* online_snapshot(online_list_t* list);
+
+/**
+ * @brief Prepara la risposta a USRLIST_SINCE_OP (vedere message.h)
+ *
+ * Se i cambiamenti dalla versione data sono ancora tutti nel registro e sono
+ * meno dei nickname connessi contiene solo quelli, altrimenti l'intero elenco.
+ *
+ * @param list L'elenco
+ * @param version La versione che il client conosce già
+ * @param len Puntatore su cui viene scritta la lunghezza della risposta
+ * @return La risposta, da liberare con free; NULL se non c'è abbastanza
+ *         memoria
+ */
+char* online_since(online_list_t* list, unsigned long version, unsigned int* len);
+
+#endif /* CHATTERBOX_ONLINE_H_ */
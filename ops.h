@@ -44,6 +44,9 @@ typedef enum {
     ADDGROUP_OP      = 11,  /// richiesta di aggiunta ad un gruppo
     DELGROUP_OP      = 12,  /// richiesta di rimozione da un gruppo
 
+    USRLIST_SINCE_OP = 13,  /// richiesta dei cambiamenti della lista degli utenti connessi da una versione
+    PRESENCE_SUB_OP  = 14,  /// richiesta di ricevere i cambiamenti della lista degli utenti connessi appena avvengono
+
 
     /* NOTA: la richiesta di cancellazione di un gruppo e' lasciata come task opzionale */
 
@@ -58,6 +61,7 @@ typedef enum {
     OP_OK           = 20,  // operazione eseguita con successo
     TXT_MESSAGE     = 21,  // notifica di messaggio testuale
     FILE_MESSAGE    = 22,  // notifica di messaggio "file disponibile"
+    PRESENCE_MESSAGE = 23, // notifica di un cambiamento della lista degli utenti connessi
 
     OP_FAIL         = 25,  // generico messaggio di fallimento
     OP_NICK_ALREADY = 26,  // nickname o groupname gia' registrato
@@ -75,7 +79,6 @@ typedef enum {
     /*
      * aggiungere qui altri messaggi di ritorno che possono servire
      */
-    OP_FAKE_MSG     = 80, // usata internamente dal server per la history
 
     OP_END          = 100 // limite superiore agli id usati per le operazioni
 
@@ -0,0 +1,62 @@
+/**
+ * @file sha256.h
+ * @brief Libreria per l'hash SHA-256, usato per dare un nome ai file in base
+ * al loro contenuto
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+#ifndef CHATTERBOX_SHA256_H_
+#define CHATTERBOX_SHA256_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Dimensione in byte di un hash SHA-256
+ */
+#define SHA256_SIZE 32
+
+/**
+ * @struct sha256
+ * @brief Lo stato di un hash SHA-256 calcolato un pezzo alla volta
+ *
+ * @var struct sha256::state Lo stato dopo i blocchi già elaborati
+ * @var struct sha256::len Numero di byte ricevuti
+ * @var struct sha256::buf Il blocco incompleto ricevuto
+ */
+typedef struct sha256 {
+	uint32_t state[8];
+	uint64_t len;
+	unsigned char buf[64];
+} sha256_t;
+
+/**
+ * @brief Inizializza lo stato per un nuovo hash
+ *
+ * @param ctx Lo stato
+ */
+void sha256_init(sha256_t* ctx);
+
+/**
+ * @brief Aggiunge dei dati all'hash
+ *
+ * @param ctx Lo stato
+ * @param data I dati
+ * @param len La lunghezza dei dati in byte
+ */
+void sha256_update(sha256_t* ctx, const void* data, size_t len);
+
+/**
+ * @brief Termina l'hash e lo scrive in digest
+ *
+ * @param ctx Lo stato, da reinizializzare prima di riusarlo
+ * @param digest Dove scrivere l'hash
+ */
+void sha256_final(sha256_t* ctx, unsigned char digest[SHA256_SIZE]);
+
+#endif /* CHATTERBOX_SHA256_H_ */
@@ -0,0 +1,68 @@
+/**
+ * @file spsc.c
+ * @brief Implementazione di spsc.h
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+
+#include "spsc.h"
+
+// ------- Funzioni esportate --------------
+// Documentate in spsc.h
+
+int create_spsc(spsc_t* q, size_t capacity) {
+	size_t size = 1;
+	while (size < capacity) {
+		size <<= 1;
+	}
+	if ((q->buf = malloc(size * sizeof(SPSC_TYPE_T))) == NULL) {
+		return -1;
+	}
+	q->mask = size - 1;
+	q->head = q->tail = 0;
+	return 0;
+}
+
+void clear_spsc(spsc_t* q) {
+	free(q->buf);
+	q->buf = NULL;
+}
+
+bool spsc_push(spsc_t* q, SPSC_TYPE_T v) {
+	size_t tail = q->tail; // scritto solo da questo thread
+	if (tail - __atomic_load_n(&(q->head), __ATOMIC_ACQUIRE) > q->mask) {
+		return false;
+	}
+	q->buf[tail & q->mask] = v;
+	// La release rende visibile l'elemento prima del nuovo indice
+	__atomic_store_n(&(q->tail), tail + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+bool spsc_pop(spsc_t* q, SPSC_TYPE_T* v) {
+	size_t head = q->head; // scritto solo da questo thread
+	if (head == __atomic_load_n(&(q->tail), __ATOMIC_ACQUIRE)) {
+		return false;
+	}
+	*v = q->buf[head & q->mask];
+	// La release impedisce al produttore di sovrascrivere l'elemento prima
+	// che sia stato letto
+	__atomic_store_n(&(q->head), head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+size_t spsc_size(spsc_t* q) {
+	// head non supera mai tail, quindi va letto per primo
+	size_t head = __atomic_load_n(&(q->head), __ATOMIC_ACQUIRE);
+	return __atomic_load_n(&(q->tail), __ATOMIC_ACQUIRE) - head;
+}
+
+bool spsc_is_empty(spsc_t* q) {
+	return __atomic_load_n(&(q->head), __ATOMIC_ACQUIRE)
+		== __atomic_load_n(&(q->tail), __ATOMIC_ACQUIRE);
+}
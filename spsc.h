@@ -0,0 +1,103 @@
+/**
+ * @file spsc.h
+ * @brief Libreria per una coda circolare lock-free a un produttore e un
+ * consumatore
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+#ifndef CHATTERBOX_SPSC_H_
+#define CHATTERBOX_SPSC_H_
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <config.h>
+
+#define SPSC_TYPE_T int /**< il tipo degli elementi della coda */
+
+/**
+ * @struct spsc
+ * @brief Coda circolare limitata, sicura senza lock se usata da esattamente un
+ * thread che inserisce e un thread che estrae.
+ *
+ * head viene scritto solo dal consumatore e tail solo dal produttore; i due
+ * indici stanno su linee di cache diverse per non farle rimbalzare tra i due
+ * thread. Gli indici crescono sempre e vengono ridotti modulo la capacità
+ * (una potenza di 2) solo per accedere a buf.
+ *
+ * @var struct spsc::buf Array circolare degli elementi
+ * @var struct spsc::mask Capacità della coda meno 1
+ * @var struct spsc::head Indice del prossimo elemento da estrarre
+ * @var struct spsc::tail Indice della prossima posizione libera
+ */
+typedef struct spsc {
+	SPSC_TYPE_T* buf;
+	size_t mask;
+	char pad0[CACHE_LINE_SIZE];
+	size_t head;
+	char pad1[CACHE_LINE_SIZE - sizeof(size_t)];
+	size_t tail;
+	char pad2[CACHE_LINE_SIZE - sizeof(size_t)];
+} spsc_t;
+
+/**
+ * @brief Inizializza una nuova coda vuota
+ * @param q La coda da inizializzare
+ * @param capacity Il numero minimo di elementi che la coda deve poter contenere
+ *                 (viene arrotondato alla potenza di 2 successiva)
+ * @return 0 in caso di successo, < 0 se non c'è abbastanza memoria
+ */
+int create_spsc(spsc_t* q, size_t capacity);
+
+/**
+ * @brief Libera la memoria occupata da una coda
+ * @param q la coda da svuotare
+ */
+void clear_spsc(spsc_t* q);
+
+/**
+ * @brief Inserisce un elemento in fondo alla coda. Può essere chiamata solo dal
+ * thread produttore.
+ *
+ * @param q La coda in cui inserire l'elemento
+ * @param v L'elemento da inserire
+ * @return true se l'elemento è stato inserito, false se la coda è piena
+ */
+bool spsc_push(spsc_t* q, SPSC_TYPE_T v);
+
+/**
+ * @brief Estrae il primo elemento della coda. Può essere chiamata solo dal
+ * thread consumatore.
+ *
+ * @param q La coda da cui estrarre l'elemento
+ * @param v Puntatore su cui viene scritto l'elemento estratto
+ * @return true se è stato estratto un elemento, false se la coda era vuota
+ */
+bool spsc_pop(spsc_t* q, SPSC_TYPE_T* v);
+
+/**
+ * @brief Controlla se la coda è vuota. Può essere chiamata da qualsiasi thread,
+ * ma se la coda viene usata in contemporanea il risultato è solo indicativo.
+ *
+ * @param q La coda da controllare
+ * @return true se la coda è vuota
+ */
+bool spsc_is_empty(spsc_t* q);
+
+/**
+ * @brief Numero di elementi nella coda. Può essere chiamata da qualsiasi
+ * thread, ma se la coda viene usata in contemporanea il risultato è solo
+ * indicativo.
+ *
+ * @param q La coda
+ * @return il numero di elementi presenti
+ */
+size_t spsc_size(spsc_t* q);
+
+#endif /* CHATTERBOX_SPSC_H_ */
@@ -0,0 +1,96 @@
+/**
+ * @file strhash.c
+ * @brief Implementazione di strhash.h
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+
+#include <string.h>
+
+#include "strhash.h"
+
+// ------------------ Funzioni interne ---------------
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+/**
+ * Costanti di mescolamento (le stesse di wyhash)
+ */
+static const uint64_t secret[4] = {
+	0xa0761d6478bd642full, 0xe7037ed1a0b428dbull,
+	0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull
+};
+
+/**
+ * @brief Moltiplica a e b a 128 bit e restituisce la xor delle due metà
+ */
+static inline uint64_t mix(uint64_t a, uint64_t b) {
+	uint128_t r = (uint128_t)a * b;
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t read8(const char* p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t read4(const char* p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/**
+ * @brief Legge da 1 a 3 byte (il primo, quello centrale e l'ultimo)
+ */
+static inline uint64_t read3(const char* p, size_t len) {
+	return ((uint64_t)(unsigned char)p[0] << 16)
+	       | ((uint64_t)(unsigned char)p[len >> 1] << 8)
+	       | (unsigned char)p[len - 1];
+}
+
+// ------- Funzioni esportate --------------
+// Documentate in strhash.h
+
+uint64_t strhash64(const char* key, size_t len) {
+	uint64_t seed = mix(secret[0], secret[1]);
+	uint64_t a, b;
+	if (len <= 16) {
+		if (len >= 4) {
+			// due letture da 4 byte all'inizio e due alla fine, che per
+			// le chiavi da 8 a 16 byte coprono tutto
+			size_t off = (len >> 3) << 2;
+			a = (read4(key) << 32) | read4(key + off);
+			b = (read4(key + len - 4) << 32) | read4(key + len - 4 - off);
+		}
+		else if (len > 0) {
+			a = read3(key, len);
+			b = 0;
+		}
+		else {
+			a = b = 0;
+		}
+	}
+	else {
+		size_t i = len;
+		const char* p = key;
+		for (; i > 16; i -= 16, p += 16)
+			seed = mix(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+		a = read8(p + i - 16);
+		b = read8(p + i - 8);
+	}
+	uint128_t r = (uint128_t)(a ^ secret[1]) * (b ^ seed);
+	a = (uint64_t)r;
+	b = (uint64_t)(r >> 64);
+	return mix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+unsigned int strhash(void* key) {
+	return (unsigned int)strhash64((const char*)key, strlen((const char*)key));
+}
@@ -0,0 +1,42 @@
+/**
+ * @file strhash.h
+ * @brief Funzione di hash per i nickname
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+#ifndef CHATTERBOX_STRHASH_H_
+#define CHATTERBOX_STRHASH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Hash a 64 bit di una stringa corta, della famiglia di wyhash
+ *
+ * Legge la chiave 8 byte alla volta (4 per le chiavi fino a 16 byte) e mescola
+ * i blocchi con una moltiplicazione 64x64 -> 128 bit, quindi un nickname di al
+ * più MAX_NAME_LENGTH caratteri richiede al più tre moltiplicazioni. Non legge
+ * mai oltre len byte, quindi la chiave non deve avere spazio dopo la fine.
+ *
+ * @param key la chiave
+ * @param len la lunghezza della chiave in byte
+ * @return l'hash
+ */
+uint64_t strhash64(const char* key, size_t len);
+
+/**
+ * @brief strhash64 di una stringa terminata da \0, ridotto a unsigned int
+ *
+ * Ha la firma delle funzioni di hash di icl_hash_create.
+ *
+ * @param key (char*) la stringa
+ * @return l'hash
+ */
+unsigned int strhash(void* key);
+
+#endif /* CHATTERBOX_STRHASH_H_ */
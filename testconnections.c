@@ -16,15 +16,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/socket.h>
 
 #include "connections.h"
+#include "writer.h"
 
 #define SOCKET_PATH "/tmp/chatty-test-connections.sock"
 #define TEST_OP GETPREVMSGS_OP
 #define TEST_SENDER "cusu"
 #define TEST_RECEIVER "mano"
 #define TEST_LEN 150
+#define BIG_LEN (1 << 20) /**< più grande del buffer del socket, per avere
+                              scritture parziali */
+#define BATCH_N 3
 #define TEST_CONTENT "abcd1abcd2abcd3abcd4abcd5abcd6abcd7abcd8abcd9abcd0abcd1abcd2abcd3abcd4abcd5abcd6abcd7abcd8abcd9abcd0abcd1abcd2abcd3abcd4abcd5abcd6abcd7abcd8abcd9abcd0"
 
 #define SYSCALL(r, c, e) if ((r = c) < 0) { perror(e); exit(errno); }
@@ -55,6 +61,13 @@ int main(int argc, char** argv) {
 	for (int i = 0; strlen(TEST_CONTENT) * i < TEST_LEN; ++i)
 		strncpy(buff + strlen(TEST_CONTENT) * i, TEST_CONTENT, strlen(TEST_CONTENT));
 	setData(&(message.data), TEST_RECEIVER, buff, TEST_LEN);
+	message_t big;
+	setHeader(&(big.hdr), TEST_OP, TEST_SENDER);
+	char* bigbuff = malloc(BIG_LEN * sizeof(char));
+	for (int i = 0; i < BIG_LEN; ++i)
+		bigbuff[i] = 'a' + i % 26;
+	setData(&(big.data), TEST_RECEIVER, bigbuff, BIG_LEN);
+	message_t* batch[BATCH_N] = { &message, &big, &message };
 
 
 	if (strncmp(argv[1], "server", 6) == 0) {
@@ -104,6 +117,38 @@ int main(int argc, char** argv) {
 			myquit();
 		}
 
+		// prova di lettura di sendRequests, con un messaggio che non sta
+		// nel buffer del socket, con readMsg
+		for (int i = 0; i < BATCH_N; ++i) {
+			readMsg(asfd, &reqMsg);
+			if (reqMsg.hdr.op != batch[i]->hdr.op || !equalData(reqMsg.data, batch[i]->data)) {
+				fprintf(stderr, "Errore nel messaggio %d inviato con sendRequests\n", i);
+				myquit();
+			}
+			free(reqMsg.data.buf);
+		}
+
+		// prova di lettura dello stesso batch con readMsgNonBlocking: i
+		// messaggi arrivano a pezzi e vanno ricomposti nel buffer. Il batch
+		// successivo è inviato con sendMsgsNonBlocking: la parte messa in
+		// coda deve arrivare dopo quella scritta subito
+		msg_reader_t reader;
+		memset(&reader, 0, sizeof(reader));
+		fcntl(asfd, F_SETFL, O_NONBLOCK);
+		for (int i = 0; i < 2 * BATCH_N; ++i) {
+			int res;
+			while ((res = readMsgNonBlocking(asfd, &reader, &reqMsg)) < 0 && errno == EAGAIN) {
+				struct pollfd pfd = { asfd, POLLIN, 0 };
+				poll(&pfd, 1, -1);
+			}
+			if (res <= 0 || reqMsg.hdr.op != batch[i % BATCH_N]->hdr.op
+				|| !equalData(reqMsg.data, batch[i % BATCH_N]->data)) {
+				fprintf(stderr, "Errore nel messaggio %d letto con readMsgNonBlocking\n", i);
+				myquit();
+			}
+		}
+		resetReader(&reader);
+
 		// verifica che sul socket non ci sia più niente da leggere
 		// Ignora SIGPIPE
 		struct sigaction s;
@@ -114,6 +159,8 @@ int main(int argc, char** argv) {
 			return -1;
 		}
 		char buf[1];
+		struct pollfd pfd = { asfd, POLLIN, 0 };
+		poll(&pfd, 1, -1);
 		if (read(asfd, buf, 1) != 0) {
 			fprintf(stderr, "Errore: socket non vuoto dopo la lettura del messaggio\n");
 			myquit();
@@ -126,10 +173,32 @@ int main(int argc, char** argv) {
 		sendHeader(csfd, &message.hdr);
 		sendData(csfd, &message.data);
 		sendRequest(csfd, &message);
+		sendRequests(csfd, batch, BATCH_N);
+		sendRequests(csfd, batch, BATCH_N);
+		// il messaggio grande non sta nel socket, quindi una parte va in coda
+		msg_writer_t writer;
+		memset(&writer, 0, sizeof(writer));
+		fcntl(csfd, F_SETFL, O_NONBLOCK);
+		ssize_t pending = sendMsgsNonBlocking(csfd, &writer, batch, BATCH_N);
+		if (pending <= 0) {
+			fprintf(stderr, "Errore: sendMsgsNonBlocking non ha messo niente in coda\n");
+			exit(EXIT_FAILURE);
+		}
+		while (pending > 0) {
+			struct pollfd pfd = { csfd, POLLOUT, 0 };
+			poll(&pfd, 1, -1);
+			pending = flushWriter(csfd, &writer);
+		}
+		if (pending < 0 || writer.head != NULL) {
+			fprintf(stderr, "Errore svuotando la coda di invio\n");
+			exit(EXIT_FAILURE);
+		}
+		resetWriter(&writer);
 	}
 
 	unlink(SOCKET_PATH);
 	free(buff);
+	free(bigbuff);
 
 	return 0;
 }
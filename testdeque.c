@@ -0,0 +1,98 @@
+/**
+ * @brief Test per il file deque.h
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "deque.h"
+
+#define CAPACITY 100
+#define K 1000000
+#define THIEVES 4
+
+static deque_t deque;
+static int taken[K];
+static bool owner_done = false;
+
+void* thief(void* arg){
+	int v;
+	while (!__atomic_load_n(&owner_done, __ATOMIC_ACQUIRE) || deque_size(&deque) > 0) {
+		if (deque_steal(&deque, &v)) {
+			__atomic_add_fetch(taken + v, 1, __ATOMIC_RELAXED);
+		}
+		else {
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+int main(int argc, char** argv) {
+	int v;
+	assert(create_deque(&deque, CAPACITY) == 0);
+	assert(deque.mask + 1 == 128);
+
+	// test di base, a thread singolo: il proprietario vede gli elementi in
+	// ordine LIFO, i ladri in ordine FIFO
+	assert(!deque_pop(&deque, &v));
+	assert(!deque_steal(&deque, &v));
+	for (int i = 0; i < 128; ++i) {
+		assert(deque_push(&deque, i));
+	}
+	assert(!deque_push(&deque, 128));
+	assert(deque_size(&deque) == 128);
+	for (int i = 0; i < 64; ++i) {
+		assert(deque_steal(&deque, &v) && v == i);
+	}
+	for (int i = 127; i >= 64; --i) {
+		assert(deque_pop(&deque, &v) && v == i);
+	}
+	assert(!deque_pop(&deque, &v));
+	assert(!deque_steal(&deque, &v));
+	assert(deque_size(&deque) == 0);
+	printf("Superati test di base\n");
+
+	// un proprietario che inserisce ed estrae e alcuni ladri: ogni elemento
+	// deve essere preso esattamente una volta
+	pthread_t tid[THIEVES];
+	for (int i = 0; i < THIEVES; ++i) {
+		pthread_create(tid + i, NULL, &thief, NULL);
+	}
+	for (int i = 0; i < K; ++i) {
+		while (!deque_push(&deque, i)) {
+			// deque piena: il proprietario aiuta a svuotarla
+			if (deque_pop(&deque, &v)) {
+				__atomic_add_fetch(taken + v, 1, __ATOMIC_RELAXED);
+			}
+		}
+		if (i % 3 == 0 && deque_pop(&deque, &v)) {
+			__atomic_add_fetch(taken + v, 1, __ATOMIC_RELAXED);
+		}
+	}
+	__atomic_store_n(&owner_done, true, __ATOMIC_RELEASE);
+	for (int i = 0; i < THIEVES; ++i) {
+		pthread_join(tid[i], NULL);
+	}
+	for (int i = 0; i < K; ++i) {
+		if (taken[i] != 1) {
+			fprintf(stderr, "ERROR: elemento %d preso %d volte\n", i, taken[i]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	printf("Superato test proprietario-ladri\n");
+
+	clear_deque(&deque);
+	return 0;
+}
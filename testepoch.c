@@ -0,0 +1,134 @@
+/**
+ * @brief Test per il file epoch.h
+ *
+ * Alcuni thread registrano e deregistrano di continuo un piccolo insieme di
+ * nickname, mentre altri cercano gli stessi nickname e aggiungono messaggi
+ * alla loro history, come fa un worker con POSTTXT_OP. Un nickname_t
+ * deregistrato mentre un altro thread lo sta usando deve restare valido fino
+ * alla fine della sua sezione (compilando con -fsanitize=address un errore
+ * viene segnalato subito).
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "hashtable.h"
+#include "epoch.h"
+
+#define NICKS 64
+#define REGISTERERS 2
+#define SENDERS 4
+#define OPS 200000
+#define HIST_SIZE 4
+#define TEST_CONTENT "ciao"
+
+static htable_t* ht;
+static unsigned long seq = 0;
+static long removed = 0;
+
+/**
+ * @brief Generatore pseudocasuale (xorshift), uno stato per thread
+ */
+static unsigned int next_rand(unsigned int* state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+static void random_nick(unsigned int* state, char* nick) {
+	snprintf(nick, MAX_NAME_LENGTH + 1, "utente%d", next_rand(state) % NICKS);
+}
+
+/**
+ * Registra i nickname che non ci sono e deregistra quelli che ci sono
+ */
+void* registerer(void* arg) {
+	unsigned int state = 1 + *(int*)arg;
+	char nick[MAX_NAME_LENGTH + 1];
+	for (int i = 0; i < OPS; ++i) {
+		random_nick(&state, nick);
+		epoch_enter();
+		if (ts_hash_insert(ht, nick) == NULL && ts_hash_remove(ht, nick))
+			__atomic_add_fetch(&removed, 1, __ATOMIC_RELAXED);
+		epoch_exit();
+	}
+	return NULL;
+}
+
+/**
+ * Invia messaggi ai nickname, se in quel momento sono registrati
+ */
+void* sender(void* arg) {
+	unsigned int state = 1000 + *(int*)arg;
+	char nick[MAX_NAME_LENGTH + 1];
+	for (int i = 0; i < OPS; ++i) {
+		random_nick(&state, nick);
+		epoch_enter();
+		nickname_t* receiver = hash_find(ht, nick);
+		if (receiver != NULL) {
+			error_handling_lock(&(receiver->mutex));
+			assert(receiver->hist_size == HIST_SIZE);
+			message_t msg;
+			setHeader(&msg.hdr, POSTTXT_OP, "mittente");
+			setData(&msg.data, nick, msgbuf_create(TEST_CONTENT, strlen(TEST_CONTENT) + 1), strlen(TEST_CONTENT) + 1);
+			add_to_history(receiver, msg, __atomic_add_fetch(&seq, 1, __ATOMIC_RELAXED));
+			error_handling_unlock(&(receiver->mutex));
+		}
+		epoch_exit();
+	}
+	return NULL;
+}
+
+int main(int argc, char** argv) {
+	// sezioni annidate e liberazione senza nessun altro thread
+	char* p = malloc(1);
+	epoch_enter();
+	epoch_enter();
+	epoch_retire(p, &free);
+	epoch_exit();
+	epoch_collect();
+	assert(epoch_pending() == 1);
+	epoch_exit();
+	for (int i = 0; i < 3 && epoch_pending() > 0; ++i)
+		epoch_collect();
+	assert(epoch_pending() == 0);
+
+	printf("Superati test di base\n");
+
+	ht = hash_create(NICKS, HIST_SIZE);
+	pthread_t tids[REGISTERERS + SENDERS];
+	int ids[REGISTERERS + SENDERS];
+	for (int i = 0; i < REGISTERERS + SENDERS; ++i) {
+		ids[i] = i;
+		pthread_create(&tids[i], NULL, i < REGISTERERS ? &registerer : &sender, &ids[i]);
+	}
+	for (int i = 0; i < REGISTERERS + SENDERS; ++i)
+		pthread_join(tids[i], NULL);
+
+	// la memoria deve essere stata liberata anche durante il test, non solo
+	// alla fine
+	long pending = epoch_pending();
+	fprintf(stderr, "nickname rimossi: %ld, oggetti ancora da liberare: %ld\n", removed, pending);
+	assert(removed > 0 && pending < removed);
+	for (int i = 0; i < 3 && epoch_pending() > 0; ++i)
+		epoch_collect();
+	assert(epoch_pending() == 0);
+	ts_hash_destroy(ht);
+	epoch_cleanup();
+
+	printf("Superato test con registrazioni e invii concorrenti\n");
+
+	// se ci fossero stati problemi il processo sarebbe già terminato con EXIT_FAILURE
+	return 0;
+}
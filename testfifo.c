@@ -1,6 +1,10 @@
 /**
  * @brief Test per il file fifo.h
  *
+ * Controlla che ogni elemento inserito venga estratto esattamente una volta e
+ * misura il throughput della coda con diversi numeri di produttori e
+ * consumatori in contesa.
+ *
  * Si dichiara che il contenuto di questo file è in ogni sua parte opera
  * originale dell'autore.
  *
@@ -18,14 +22,15 @@
 
 #include "fifo.h"
 
-#define M 30
-#define N 100
+#define MAX_THREADS 128
 #define K 100000
 #define MAX_MSG 10000
+#define CAPACITY 64
+#define STOP -1 /**< fa terminare un consumatore */
 
 static fifo_t buffer;
-static int k = K, k1 = K;
-static pthread_mutex_t mutex_k, mutex_n, mutex_k1;
+static int k, k1;
+static pthread_mutex_t mutex_k, mutex_k1;
 
 static int prodotti[K], consumati[K];
 
@@ -48,8 +53,7 @@ void* producer(void* arg){
 
 void* consumer(void* arg){
 	int v;
-	while (1) {
-		v = ts_pop(&buffer);
+	while ((v = ts_pop(&buffer)) != STOP) {
 		// printf("Consumato %d\n", v);
 		pthread_mutex_lock(&mutex_k1);
 		consumati[--k1] = v;
@@ -63,30 +67,39 @@ int cmpfunc(const void * a, const void * b) {
 	return *(int*)a - *(int*)b;
 }
 
-int main(int argc, char** argv) {
-	buffer = create_fifo();
-	pthread_mutex_init(&mutex_k, NULL);
-	pthread_mutex_init(&mutex_n, NULL);
-	srand(time(NULL));
-
-	pthread_t tid[M];
-	pthread_t tid_temp;
-	for (int i = 0; i < M; ++i) {
-		pthread_create(tid + i, NULL, &producer, NULL);
+/**
+ * @brief Esegue un giro con m produttori e n consumatori, controlla il
+ * risultato e stampa il throughput
+ */
+static void run(int m, int n) {
+	pthread_t prod[MAX_THREADS], cons[MAX_THREADS];
+	struct timespec start, end;
+	k = k1 = K;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < n; ++i) {
+		pthread_create(cons + i, NULL, &consumer, NULL);
 	}
-	for (int i = 0; i < N; ++i) {
-		pthread_create(&tid_temp, NULL, &consumer, NULL);
+	for (int i = 0; i < m; ++i) {
+		pthread_create(prod + i, NULL, &producer, NULL);
 	}
-
-	for (int i = 0; i < M; ++i)
-		pthread_join(tid[i], NULL);
-	// questa soluzione non è thread safe, ma va benissimo per fare il test
-	sleep(3);
+	for (int i = 0; i < m; ++i)
+		pthread_join(prod[i], NULL);
+	for (int i = 0; i < n; ++i)
+		ts_push(&buffer, STOP);
+	for (int i = 0; i < n; ++i)
+		pthread_join(cons[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
 
 	// controllo del risultato
-	printf("Inizio controllo del risultato\n");
-	if (!ts_is_empty(buffer))
+	if (!ts_is_empty(&buffer)) {
 		fprintf(stderr, "Errore: %d rimasto nel buffer\n", ts_pop(&buffer));
+		exit(EXIT_FAILURE);
+	}
+	if (k1 != 0) {
+		fprintf(stderr, "Errore: %d elementi non consumati\n", k1);
+		exit(EXIT_FAILURE);
+	}
 	qsort(prodotti, K, sizeof(int), cmpfunc);
 	qsort(consumati, K, sizeof(int), cmpfunc);
 	for (int i = 0; i < K; ++i){
@@ -97,5 +110,46 @@ int main(int argc, char** argv) {
 		}
 	}
 
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%3d produttori, %3d consumatori: %8.3f ms, %10.0f op/s\n",
+	       m, n, secs * 1e3, K / secs);
+}
+
+int main(int argc, char** argv) {
+	// capacità piccola, così si prova anche il blocco quando la coda è piena
+	buffer = create_fifo(CAPACITY);
+	if (buffer.buf == NULL) {
+		perror("create_fifo");
+		exit(EXIT_FAILURE);
+	}
+	pthread_mutex_init(&mutex_k, NULL);
+	pthread_mutex_init(&mutex_k1, NULL);
+	srand(time(NULL));
+
+	// dimensione, a thread singolo
+	for (int i = 0; i < CAPACITY; ++i) {
+		if (ts_size(&buffer) != i) {
+			fprintf(stderr, "Errore: dimensione %zu invece di %d\n", ts_size(&buffer), i);
+			exit(EXIT_FAILURE);
+		}
+		ts_push(&buffer, i);
+	}
+	for (int i = CAPACITY; i > 0; --i) {
+		ts_pop(&buffer);
+		if (ts_size(&buffer) != i - 1) {
+			fprintf(stderr, "Errore: dimensione %zu invece di %d\n", ts_size(&buffer), i - 1);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	run(1, 1);
+	run(1, 8);
+	run(8, 1);
+	run(4, 4);
+	run(8, 8);
+	run(30, 100);
+	printf("Superati tutti i test\n");
+
+	clear_fifo(&buffer);
 	return 0;
 }
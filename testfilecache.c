@@ -0,0 +1,104 @@
+/**
+ * @brief Test per il file filecache.h
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "filecache.h"
+
+#define MINFD 100
+#define NFILES 3
+
+static char paths[NFILES][64];
+
+/**
+ * @brief Crea un file con il contenuto dato
+ */
+static void write_file(const char* path, const char* content) {
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	assert(fd >= 0);
+	assert(write(fd, content, strlen(content)) == (ssize_t)strlen(content));
+	close(fd);
+}
+
+/**
+ * @brief Controlla che il fd di un file sia aperto e contenga il testo dato
+ */
+static void check_entry(file_entry_t* e, const char* content) {
+	char buf[64];
+	assert(e->fd >= MINFD);
+	assert(e->st.st_size == (off_t)strlen(content));
+	assert(pread(e->fd, buf, sizeof(buf), 0) == (ssize_t)strlen(content));
+	assert(memcmp(buf, content, strlen(content)) == 0);
+}
+
+int main(int argc, char** argv) {
+	for (int i = 0; i < NFILES; ++i) {
+		snprintf(paths[i], sizeof(paths[i]), "/tmp/testfilecache%d_%d", (int)getpid(), i);
+		write_file(paths[i], i == 0 ? "zero" : i == 1 ? "uno" : "due");
+	}
+	file_cache_t cache;
+	create_file_cache(&cache, 2, MINFD);
+
+	// un file già aperto viene ritrovato
+	file_entry_t* e0 = file_cache_open(&cache, paths[0]);
+	assert(e0 != NULL);
+	check_entry(e0, "zero");
+	assert(file_cache_open(&cache, paths[0]) == e0 && e0->refs == 2);
+	file_cache_release(&cache, e0);
+	file_cache_release(&cache, e0);
+	assert(cache.count == 1);
+	// un file inesistente non entra nella cache
+	assert(file_cache_open(&cache, "/tmp/testfilecache_inesistente") == NULL && errno == ENOENT);
+	assert(cache.count == 1);
+	printf("Superati test di base\n");
+
+	// oltre size file viene tolto il meno recente, che resta utilizzabile
+	// finché qualcuno lo usa
+	e0 = file_cache_open(&cache, paths[0]);
+	file_entry_t* e1 = file_cache_open(&cache, paths[1]);
+	file_cache_release(&cache, e1);
+	// e1 ora è il più recente, e0 viene tolto ma è ancora in uso
+	file_entry_t* e2 = file_cache_open(&cache, paths[2]);
+	file_cache_release(&cache, e2);
+	assert(cache.count == 2 && e0->evicted);
+	check_entry(e0, "zero");
+	file_cache_release(&cache, e0);
+	// e1 è ancora nella cache
+	assert(file_cache_open(&cache, paths[1]) == e1);
+	check_entry(e1, "uno");
+	file_cache_release(&cache, e1);
+	printf("Superato test sulla sostituzione LRU\n");
+
+	// dopo invalidate il file viene riaperto con la nuova dimensione
+	write_file(paths[1], "uno, ma piu' lungo");
+	file_cache_invalidate(&cache, paths[1]);
+	assert(cache.count == 1);
+	e1 = file_cache_open(&cache, paths[1]);
+	check_entry(e1, "uno, ma piu' lungo");
+	file_cache_release(&cache, e1);
+	printf("Superato test su file_cache_invalidate\n");
+
+	clear_file_cache(&cache);
+	for (int i = 0; i < NFILES; ++i) {
+		unlink(paths[i]);
+	}
+
+	// se ci fossero stati problemi il processo sarebbe già terminato con EXIT_FAILURE
+	return 0;
+}
@@ -0,0 +1,236 @@
+/**
+ * @brief Test per i file filestore.h e sha256.h
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "filestore.h"
+
+#define MINFD 100
+
+static char dir[64];
+
+/**
+ * @brief Controlla lo SHA-256 di una stringa, passata in pezzi di step byte
+ */
+static void check_sha256(const char* data, size_t step, const char* expected) {
+	sha256_t ctx;
+	unsigned char digest[SHA256_SIZE];
+	char hex[2 * SHA256_SIZE + 1];
+	sha256_init(&ctx);
+	for (size_t p = 0; p < strlen(data); p += step) {
+		sha256_update(&ctx, data + p, strlen(data) - p < step ? strlen(data) - p : step);
+	}
+	sha256_final(&ctx, digest);
+	for (int i = 0; i < SHA256_SIZE; ++i) {
+		sprintf(hex + 2 * i, "%02x", digest[i]);
+	}
+	assert(strcmp(hex, expected) == 0);
+}
+
+/**
+ * @brief Riceve un file nello slot dato e lo aggiunge all'archivio
+ */
+static void upload(file_store_t* store, int slot, const char* receiver, const char* name, const char* content) {
+	int fd = file_store_open_tmp(store, slot);
+	assert(fd >= 0);
+	assert(write(fd, content, strlen(content)) == (ssize_t)strlen(content));
+	close(fd);
+	sha256_t ctx;
+	unsigned char digest[SHA256_SIZE];
+	sha256_init(&ctx);
+	sha256_update(&ctx, content, strlen(content));
+	sha256_final(&ctx, digest);
+	assert(file_store_commit(store, slot, digest, receiver, name) == 0);
+}
+
+/**
+ * @brief Controlla che il file inviato a receiver con quel nome abbia il
+ * contenuto dato
+ */
+static void check_download(file_store_t* store, const char* receiver, const char* name, const char* content) {
+	char buf[64];
+	char* path = file_store_path(store, receiver, name);
+	assert(path != NULL);
+	int fd = open(path, O_RDONLY);
+	assert(fd >= 0);
+	assert(read(fd, buf, sizeof(buf)) == (ssize_t)strlen(content));
+	assert(memcmp(buf, content, strlen(content)) == 0);
+	close(fd);
+	free(path);
+}
+
+/**
+ * @brief Conta i file in una directory dell'archivio
+ *
+ * @param blobs true per i contenuti, false per i file con nome
+ */
+static int count_files(bool blobs) {
+	char path[128];
+	snprintf(path, sizeof(path), "%s%s", dir, blobs ? BLOBS_DIR : "");
+	DIR* d = opendir(path);
+	assert(d != NULL);
+	int n = 0;
+	struct dirent* ent;
+	while ((ent = readdir(d)) != NULL) {
+		if (ent->d_name[0] != '.') {
+			++n;
+		}
+	}
+	closedir(d);
+	return n;
+}
+
+/**
+ * @brief Elimina la directory dell'archivio
+ */
+static void remove_dir(const char* path) {
+	DIR* d = opendir(path);
+	if (d == NULL) {
+		return;
+	}
+	struct dirent* ent;
+	while ((ent = readdir(d)) != NULL) {
+		if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0) {
+			char child[strlen(path) + NAME_MAX + 2];
+			snprintf(child, sizeof(child), "%s/%s", path, ent->d_name);
+			struct stat st;
+			if (lstat(child, &st) == 0 && S_ISDIR(st.st_mode)) {
+				remove_dir(child);
+			}
+			else {
+				unlink(child);
+			}
+		}
+	}
+	closedir(d);
+	rmdir(path);
+}
+
+int main(int argc, char** argv) {
+	// vettori di prova di FIPS 180-4, anche divisi in pezzi
+	check_sha256("", 1, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+	check_sha256("abc", 1, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+	const char* two_blocks = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	const char* two_blocks_hash = "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1";
+	for (size_t step = 1; step <= strlen(two_blocks); step += 7) {
+		check_sha256(two_blocks, step, two_blocks_hash);
+	}
+	printf("Superati test su SHA-256\n");
+
+	snprintf(dir, sizeof(dir), "/tmp/testfilestore%d/", (int)getpid());
+	file_store_t store;
+	assert(create_file_store(&store, dir, MINFD) == 0);
+	assert(store.indexfd >= MINFD);
+
+	// lo stesso contenuto viene salvato una volta sola
+	upload(&store, 0, "pippo", "a.txt", "contenuto");
+	upload(&store, 1, "pluto", "b.txt", "contenuto");
+	assert(count_files(true) == 1);
+	check_download(&store, "pippo", "a.txt", "contenuto");
+	check_download(&store, "pluto", "b.txt", "contenuto");
+	// DirName/<nome> resta disponibile
+	assert(count_files(false) == 2);
+	printf("Superato test sulla deduplicazione\n");
+
+	// file con lo stesso nome per utenti diversi non si sovrascrivono
+	upload(&store, 0, "pluto", "a.txt", "altro contenuto");
+	assert(count_files(true) == 2);
+	check_download(&store, "pippo", "a.txt", "contenuto");
+	check_download(&store, "pluto", "a.txt", "altro contenuto");
+	// un file non nell'indice viene cercato in DirName
+	check_download(&store, "minni", "a.txt", "altro contenuto");
+	// senza riferimenti non viene eliminato niente
+	assert(file_store_prune(&store) == 0);
+	// i "./" iniziali vengono ignorati
+	upload(&store, 1, "minni", "./c.txt", "contenuto");
+	check_download(&store, "minni", "c.txt", "contenuto");
+	assert(count_files(true) == 2);
+	// i nomi con directory o che iniziano con '.' si possono usare, ma il link
+	// in DirName prende solo l'ultimo componente e non inizia mai con '.':
+	// l'indice e i contenuti restano irraggiungibili
+	const char* names[] = { "sub/d.txt", ".bashrc", ".index", ".blobs/x", "../e.txt" };
+	const char* links[] = { "d.txt", NULL, NULL, "x", "e.txt" };
+	for (int i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+		assert(file_store_valid_name(names[i]));
+		upload(&store, 2, "pippo", names[i], "contenuto");
+		check_download(&store, "pippo", names[i], "contenuto");
+		char* path = file_store_named_path(&store, names[i]);
+		if (links[i] == NULL) {
+			assert(path == NULL && errno == ENOENT);
+			// senza link si trova solo nell'indice
+			assert(file_store_path(&store, "minni", names[i]) == NULL && errno == ENOENT);
+		}
+		else {
+			char expected[128];
+			snprintf(expected, sizeof(expected), "%s%s", dir, links[i]);
+			assert(path != NULL && strcmp(path, expected) == 0);
+			check_download(&store, "minni", names[i], "contenuto");
+		}
+		free(path);
+	}
+	assert(count_files(true) == 2 && count_files(false) == 6);
+	// i nomi vuoti, anche dopo aver tolto i "./", non sono validi
+	const char* invalid[] = { "./", "" };
+	for (int i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+		assert(!file_store_valid_name(invalid[i]));
+		int fd = file_store_open_tmp(&store, 2);
+		assert(fd >= 0);
+		close(fd);
+		unsigned char digest[SHA256_SIZE] = { 0 };
+		assert(file_store_commit(&store, 2, digest, "pippo", invalid[i]) < 0 && errno == EINVAL);
+		file_store_discard(&store, 2);
+		assert(file_store_path(&store, "pippo", invalid[i]) == NULL);
+		assert(file_store_named_path(&store, invalid[i]) == NULL);
+	}
+	assert(count_files(true) == 2 && count_files(false) == 6);
+	printf("Superato test sui nomi\n");
+
+	// l'indice sopravvive alla chiusura, e all'apertura i contenuti non più
+	// usati vengono eliminati
+	upload(&store, 0, "pippo", "a.txt", "nuovo");
+	upload(&store, 0, "pluto", "b.txt", "nuovo");
+	upload(&store, 0, "minni", "c.txt", "nuovo");
+	for (int i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+		upload(&store, 0, "pippo", names[i], "nuovo");
+	}
+	assert(count_files(true) == 3);
+	clear_file_store(&store);
+	assert(create_file_store(&store, dir, MINFD) == 0);
+	assert(count_files(true) == 2);
+	check_download(&store, "pippo", "a.txt", "nuovo");
+	check_download(&store, "pluto", "b.txt", "nuovo");
+	check_download(&store, "pluto", "a.txt", "altro contenuto");
+	check_download(&store, "pippo", ".index", "nuovo");
+	check_download(&store, "pippo", "sub/d.txt", "nuovo");
+	// un file temporaneo scartato non resta
+	int fd = file_store_open_tmp(&store, 3);
+	assert(fd >= 0);
+	close(fd);
+	file_store_discard(&store, 3);
+	clear_file_store(&store);
+	printf("Superato test sulla persistenza\n");
+
+	remove_dir(dir);
+
+	// se ci fossero stati problemi il processo sarebbe già terminato con EXIT_FAILURE
+	return 0;
+}
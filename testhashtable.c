@@ -20,12 +20,57 @@
 #include "hashtable.h"
 
 #define ITEMS 1000
-#define MAX_KEYS_LENGTH 4
+#define MAX_KEYS_LENGTH 8
 #define HIST_SIZE 1
+#define INITIAL_BUCKETS (HTABLE_SHARDS * HTABLE_GROUP_SIZE)
+#define STABLE_KEYS 64
+#define RESIZE_ROUNDS 20
 #define TEST_KEY "cusu"
 
+/**
+ * Somma degli slot delle partizioni, -1 se qualcuna si sta ridimensionando
+ */
+int capacity(htable_t* ht) {
+	int res = 0;
+	for (int i = 0; i < HTABLE_SHARDS; ++i) {
+		if (ht->shards[i].old != NULL)
+			return -1;
+		res += ht->shards[i].cur->capacity;
+	}
+	return res;
+}
+
+void markDisconnected(char* key, nickname_t* val, void* arg) {
+	if (val->fd == 0)
+		val->fd = -1;
+	++*(int*)arg;
+}
+
+/**
+ * Thread che cerca continuamente delle chiavi che non vengono mai rimosse,
+ * mentre il main fa crescere e restringere l'hashtable
+ */
+void* reader(void* arg) {
+	htable_t* ht = arg;
+	char key[MAX_KEYS_LENGTH + 1];
+	for (int round = 0; round < 200 * RESIZE_ROUNDS; ++round) {
+		epoch_enter();
+		for (int i = 0; i < STABLE_KEYS; ++i) {
+			snprintf(key, MAX_KEYS_LENGTH + 1, "s%d", i);
+			nickname_t* val = hash_find(ht, key);
+			if (val == NULL || val->fd != i) {
+				fprintf(stderr, "Chiave %s non trovata durante il ridimensionamento\n", key);
+				exit(EXIT_FAILURE);
+			}
+		}
+		epoch_exit();
+		sched_yield();
+	}
+	return NULL;
+}
+
 int main(int argc, char** argv) {
-	htable_t* ht = hash_create(2 * ITEMS, HIST_SIZE);
+	htable_t* ht = hash_create(INITIAL_BUCKETS, HIST_SIZE);
 
 	// inserimento
 	nickname_t* insert_item = ts_hash_insert(ht, TEST_KEY);
@@ -43,27 +88,76 @@ int main(int argc, char** argv) {
 
 	printf("Superati test di base\n");
 
-	// inserimento di 100 elementi
+	// inserimento di ITEMS elementi: l'hashtable deve crescere
 	for (int i = 0; i < ITEMS; ++i) {
-		char* key = malloc((MAX_KEYS_LENGTH + 1) * sizeof(char));
+		char key[MAX_KEYS_LENGTH + 1];
 		snprintf(key, MAX_KEYS_LENGTH + 1, "%d", i);
 		ts_hash_insert(ht, key);
 		nickname_t* tmp = hash_find(ht, key);
+		assert(tmp != NULL);
 		tmp->fd = i % 2 == 0 ? 0 : i;
+		// tutte le chiavi inserite prima devono essere ancora raggiungibili,
+		// anche a metà di uno spostamento
+		for (int j = 0; j <= i; j += 37) {
+			snprintf(key, MAX_KEYS_LENGTH + 1, "%d", j);
+			assert(hash_find(ht, key) != NULL);
+		}
 	}
-	int i;
-	icl_entry_t* j;
-	char* key;
-	nickname_t* val;
-	icl_hash_foreach((ht->htable), i, j, key, val) {
-		// fprintf(stderr, "Iterazione: %d. Chiave: %s. fd: %d\n", i, key, val->fd);
-		if (val->fd == 0)
-			val->first = 1;
-	}
-	assert(hash_find(ht, "2")->first == 1);
+	assert(hash_count(ht) == ITEMS);
+	assert(capacity(ht) != INITIAL_BUCKETS);
+	int visited = 0;
+	ts_hash_foreach(ht, &markDisconnected, &visited);
+	assert(visited == ITEMS);
+	assert(hash_find(ht, "2")->fd == -1);
 
 	printf("Superato test sull'iterazione\n");
 
+	// rimozione: l'hashtable deve tornare alla dimensione iniziale
+	for (int i = 0; i < ITEMS; ++i) {
+		char key[MAX_KEYS_LENGTH + 1];
+		snprintf(key, MAX_KEYS_LENGTH + 1, "%d", i);
+		assert(ts_hash_remove(ht, key));
+		assert(hash_find(ht, key) == NULL);
+	}
+	// gli ultimi spostamenti finiscono con le prossime operazioni su ogni
+	// partizione
+	for (int i = 0; i < 100 * ITEMS && capacity(ht) != INITIAL_BUCKETS; ++i) {
+		char key[MAX_KEYS_LENGTH + 1];
+		snprintf(key, MAX_KEYS_LENGTH + 1, "%d", i % ITEMS);
+		ts_hash_insert(ht, key);
+		ts_hash_remove(ht, key);
+	}
+	assert(hash_count(ht) == 0);
+	assert(capacity(ht) == INITIAL_BUCKETS);
+
+	printf("Superato test sul ridimensionamento\n");
+
+	// ricerche concorrenti mentre l'hashtable cresce e si restringe
+	for (int i = 0; i < STABLE_KEYS; ++i) {
+		char key[MAX_KEYS_LENGTH + 1];
+		snprintf(key, MAX_KEYS_LENGTH + 1, "s%d", i);
+		ts_hash_insert(ht, key)->fd = i;
+	}
+	pthread_t tid;
+	pthread_create(&tid, NULL, &reader, ht);
+	for (int round = 0; round < RESIZE_ROUNDS; ++round) {
+		char key[MAX_KEYS_LENGTH + 1];
+		for (int i = 0; i < ITEMS; ++i) {
+			snprintf(key, MAX_KEYS_LENGTH + 1, "%d", i);
+			ts_hash_insert(ht, key);
+		}
+		for (int i = 0; i < ITEMS; ++i) {
+			snprintf(key, MAX_KEYS_LENGTH + 1, "%d", i);
+			ts_hash_remove(ht, key);
+		}
+	}
+	pthread_join(tid, NULL);
+	assert(hash_count(ht) == STABLE_KEYS);
+	ts_hash_destroy(ht);
+	epoch_cleanup();
+
+	printf("Superato test sulle ricerche concorrenti\n");
+
 	// se ci fossero stati problemi il processo sarebbe già terminato con EXIT_FAILURE
 	return 0;
 }
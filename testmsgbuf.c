@@ -0,0 +1,72 @@
+/**
+ * @brief Test per il file msgbuf.h
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "msgbuf.h"
+
+#define THREADS 8
+#define K 1000000
+#define TEST_CONTENT "ciao a tutti"
+
+static char* shared;
+
+static int refs_of(char* buf) {
+	return __atomic_load_n(&(((msgbuf_t*)(buf - offsetof(msgbuf_t, data)))->refs), __ATOMIC_ACQUIRE);
+}
+
+void* worker(void* arg) {
+	for (int i = 0; i < K; ++i) {
+		char* mine = msgbuf_ref(shared);
+		assert(mine == shared);
+		if (i % 1024 == 0) {
+			assert(strcmp(mine, TEST_CONTENT) == 0);
+		}
+		msgbuf_unref(mine);
+	}
+	return NULL;
+}
+
+int main(int argc, char** argv) {
+	// test di base
+	shared = msgbuf_create(TEST_CONTENT, strlen(TEST_CONTENT) + 1);
+	assert(shared != NULL);
+	assert(strcmp(shared, TEST_CONTENT) == 0);
+	assert(refs_of(shared) == 1);
+	assert(msgbuf_ref(shared) == shared);
+	assert(refs_of(shared) == 2);
+	msgbuf_unref(shared);
+	assert(refs_of(shared) == 1);
+	msgbuf_unref(NULL);
+	printf("Superati test di base\n");
+
+	// più thread prendono e rilasciano riferimenti insieme: alla fine deve
+	// restare solo quello iniziale
+	pthread_t tid[THREADS];
+	for (int i = 0; i < THREADS; ++i) {
+		pthread_create(tid + i, NULL, &worker, NULL);
+	}
+	for (int i = 0; i < THREADS; ++i) {
+		pthread_join(tid[i], NULL);
+	}
+	if (refs_of(shared) != 1) {
+		fprintf(stderr, "ERROR: %d riferimenti invece di 1\n", refs_of(shared));
+		exit(EXIT_FAILURE);
+	}
+	printf("Superato test concorrente\n");
+
+	msgbuf_unref(shared);
+	return 0;
+}
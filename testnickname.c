@@ -0,0 +1,109 @@
+/**
+ * @brief Test per il file nickname.h
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nickname.h"
+
+#define HIST_SIZE 12
+#define MSGS 40
+
+/**
+ * @brief Aggiunge all'history un messaggio che contiene il suo numero di
+ * sequenza
+ */
+static void add_numbered(nickname_t* nick, unsigned long seq) {
+	char content[32];
+	snprintf(content, sizeof(content), "%lu", seq);
+	message_t msg;
+	setHeader(&msg.hdr, TXT_MESSAGE, "mittente");
+	setData(&msg.data, "destinatario", msgbuf_create(content, strlen(content) + 1), strlen(content) + 1);
+	add_to_history(nick, msg, seq);
+}
+
+/**
+ * @brief Controlla che l'history contenga, dal più recente, i messaggi da last
+ * scendendo
+ */
+static void check_history(nickname_t* nick, unsigned long last, int len) {
+	assert(history_len(nick) == len);
+	for (int k = 0; k < len; ++k) {
+		unsigned long seq;
+		message_t* msg = history_nth(nick, k, &seq);
+		assert(msg != NULL && seq == last - k);
+		assert(strtoul(msg->data.buf, NULL, 10) == seq);
+	}
+	unsigned long seq;
+	assert(history_nth(nick, len, &seq) == NULL);
+}
+
+int main(int argc, char** argv) {
+	// un nickname senza messaggi non occupa memoria per l'history
+	long before = history_memory();
+	nickname_t* nick = create_nickname(HIST_SIZE);
+	assert(nick->history == NULL && history_memory() == before);
+	check_history(nick, 0, 0);
+	free_nickname(nick);
+	printf("Superati test di base\n");
+
+	// l'history cresce un po' alla volta fino a HIST_SIZE, poi sovrascrive i
+	// più vecchi
+	nick = create_nickname(HIST_SIZE);
+	int last_capacity = 0;
+	for (unsigned long seq = 1; seq <= MSGS; ++seq) {
+		add_numbered(nick, seq);
+		int len = seq < HIST_SIZE ? seq : HIST_SIZE;
+		assert(nick->hist_capacity >= len && nick->hist_capacity <= HIST_SIZE);
+		assert(nick->hist_capacity >= last_capacity);
+		last_capacity = nick->hist_capacity;
+		check_history(nick, seq, len);
+		assert(is_history_full(nick) == (len == HIST_SIZE));
+	}
+	assert(nick->hist_capacity == HIST_SIZE);
+	assert(history_memory() == before + HIST_SIZE * (long)(sizeof(message_t) + sizeof(unsigned long)));
+	free_nickname(nick);
+	assert(history_memory() == before);
+	printf("Superato test sulla crescita dell'history\n");
+
+	// ridotta, l'history occupa solo i posti dei messaggi che contiene, e
+	// torna a crescere se ne arrivano altri
+	const long entry = sizeof(message_t) + sizeof(unsigned long);
+	nick = create_nickname(HIST_SIZE);
+	for (unsigned long seq = 1; seq <= 5; ++seq) {
+		add_numbered(nick, seq);
+	}
+	assert(nick->hist_capacity > 5);
+	long grown = history_memory();
+	shrink_history(nick);
+	assert(nick->hist_capacity == 5);
+	assert(history_memory() == before + 5 * entry && history_memory() < grown);
+	check_history(nick, 5, 5);
+	shrink_history(nick);
+	assert(nick->hist_capacity == 5);
+	for (unsigned long seq = 6; seq <= MSGS; ++seq) {
+		add_numbered(nick, seq);
+		check_history(nick, seq, seq < HIST_SIZE ? seq : HIST_SIZE);
+	}
+	assert(nick->hist_capacity == HIST_SIZE);
+	// piena non ha posti da liberare
+	shrink_history(nick);
+	assert(nick->hist_capacity == HIST_SIZE);
+	assert(history_memory() == before + HIST_SIZE * entry);
+	free_nickname(nick);
+	assert(history_memory() == before);
+	printf("Superato test sulla riduzione dell'history\n");
+
+	// se ci fossero stati problemi il processo sarebbe già terminato con EXIT_FAILURE
+	return 0;
+}
@@ -0,0 +1,204 @@
+/**
+ * @brief Test per il file online.h
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "online.h"
+
+#define SIZE 64
+#define READERS 4
+#define K 200000
+
+static online_list_t list;
+static int pos[SIZE];
+static int writer_done = 0;
+
+/**
+ * @brief Controlla che una copia contenga esattamente i nickname dati
+ */
+static void check_snapshot(online_snapshot_t* snap, bool* present) {
+	int expected = 0;
+	for (int i = 0; i < SIZE; ++i) {
+		expected += present[i];
+	}
+	assert(snap->count == expected);
+	for (int i = 0; i < snap->count; ++i) {
+		int n;
+		assert(sscanf(snap->names + i * (MAX_NAME_LENGTH + 1), "utente%d", &n) == 1);
+		assert(n >= 0 && n < SIZE && present[n]);
+	}
+}
+
+/**
+ * @brief Controlla la risposta di online_since
+ *
+ * @param version La versione richiesta
+ * @param full Il valore atteso di presence_hdr_t::full
+ * @param records I record attesi, ognuno come "+nome" o "-nome" con nomi di
+ *                un carattere
+ */
+static void check_since(unsigned long version, int full, const char* records) {
+	unsigned int len;
+	char* buf = online_since(&list, version, &len);
+	assert(buf != NULL);
+	presence_hdr_t hdr;
+	memcpy(&hdr, buf, sizeof(hdr));
+	assert(hdr.version == list.version && hdr.full == full);
+	int n = strlen(records) / 2;
+	assert(len == sizeof(hdr) + n * PRESENCE_RECORD_SIZE);
+	for (int i = 0; i < n; ++i) {
+		char* record = buf + sizeof(hdr) + i * PRESENCE_RECORD_SIZE;
+		assert(record[0] == (records[2 * i] == '+' ? PRESENCE_JOIN : PRESENCE_LEAVE));
+		assert(record[1] == records[2 * i + 1] && record[2] == '\0');
+	}
+	free(buf);
+}
+
+/**
+ * Connette e disconnette di continuo i nickname
+ */
+void* writer(void* arg) {
+	bool present[SIZE] = { false };
+	char name[MAX_NAME_LENGTH + 1];
+	unsigned int state = 1;
+	for (int i = 0; i < K; ++i) {
+		state = state * 1103515245 + 12345;
+		int n = (state >> 16) % SIZE;
+		if (present[n]) {
+			online_remove(&list, pos + n);
+		}
+		else {
+			snprintf(name, MAX_NAME_LENGTH + 1, "utente%d", n);
+			online_add(&list, name, pos + n);
+		}
+		present[n] = !present[n];
+	}
+	__atomic_store_n(&writer_done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/**
+ * Legge l'elenco mentre cambia: ogni copia deve essere coerente
+ */
+void* reader(void* arg) {
+	while (!__atomic_load_n(&writer_done, __ATOMIC_ACQUIRE)) {
+		epoch_enter();
+		online_snapshot_t* snap = online_snapshot(&list);
+		assert(snap != NULL && snap->count >= 0 && snap->count <= SIZE);
+		for (int i = 0; i < snap->count; ++i) {
+			assert(strncmp(snap->names + i * (MAX_NAME_LENGTH + 1), "utente", 6) == 0);
+		}
+		epoch_exit();
+	}
+	return NULL;
+}
+
+int main(int argc, char** argv) {
+	// test di base
+	bool present[SIZE] = { false };
+	char name[MAX_NAME_LENGTH + 1];
+	assert(create_online_list(&list, SIZE) == 0);
+	epoch_enter();
+	online_snapshot_t* empty = online_snapshot(&list);
+	assert(empty->count == 0);
+	assert(online_snapshot(&list) == empty);
+	for (int i = 0; i < SIZE; ++i) {
+		snprintf(name, MAX_NAME_LENGTH + 1, "utente%d", i);
+		online_add(&list, name, pos + i);
+		present[i] = true;
+		assert(pos[i] == i);
+	}
+	// la copia vecchia resta valida fino alla fine della sezione
+	online_snapshot_t* full = online_snapshot(&list);
+	assert(full != empty && empty->count == 0);
+	check_snapshot(full, present);
+	assert(online_snapshot(&list) == full);
+	epoch_exit();
+
+	// rimozioni in mezzo: l'ultimo prende il posto di quello rimosso
+	epoch_enter();
+	online_remove(&list, pos + 3);
+	present[3] = false;
+	assert(pos[3] == -1 && pos[SIZE - 1] == 3);
+	online_remove(&list, pos + SIZE - 1);
+	present[SIZE - 1] = false;
+	online_remove(&list, pos + 0);
+	present[0] = false;
+	for (int i = 0; i < SIZE; ++i) {
+		if (present[i]) {
+			snprintf(name, MAX_NAME_LENGTH + 1, "utente%d", i);
+			assert(strcmp(list.names[pos[i]], name) == 0);
+		}
+	}
+	check_snapshot(online_snapshot(&list), present);
+	epoch_exit();
+	for (int i = 0; i < SIZE; ++i) {
+		if (present[i]) {
+			online_remove(&list, pos + i);
+		}
+	}
+	clear_online_list(&list);
+	printf("Superati test di base\n");
+
+	// cambiamenti da una versione: solo se sono pochi e ancora nel registro
+	assert(create_online_list(&list, 8) == 0);
+	online_add(&list, "a", pos + 0);
+	assert(online_add(&list, "b", pos + 1) == 2);
+	check_since(0, 1, "+a+b");
+	check_since(2, 0, "");
+	online_remove(&list, pos + 0);
+	online_add(&list, "c", pos + 2);
+	online_add(&list, "d", pos + 3);
+	online_add(&list, "e", pos + 4);
+	assert(online_add(&list, "f", pos + 5) == 7);
+	check_since(4, 0, "+d+e+f");
+	check_since(3, 0, "+c+d+e+f");
+	check_since(2, 1, "+b+c+d+e+f");
+	check_since(100, 1, "+b+c+d+e+f");
+	for (int i = 0; i < 5; ++i) {
+		online_remove(&list, pos + 5);
+		online_add(&list, "f", pos + 5);
+	}
+	check_since(15, 0, "-f+f");
+	check_since(6, 1, "+b+c+d+e+f");
+	clear_online_list(&list);
+	for (int i = 0; i < 3 && epoch_pending() > 0; ++i) {
+		epoch_collect();
+	}
+	printf("Superati test sui cambiamenti\n");
+
+	// un thread modifica l'elenco mentre altri lo leggono
+	assert(create_online_list(&list, SIZE) == 0);
+	pthread_t wtid, rtid[READERS];
+	pthread_create(&wtid, NULL, &writer, NULL);
+	for (int i = 0; i < READERS; ++i) {
+		pthread_create(rtid + i, NULL, &reader, NULL);
+	}
+	pthread_join(wtid, NULL);
+	for (int i = 0; i < READERS; ++i) {
+		pthread_join(rtid[i], NULL);
+	}
+	for (int i = 0; i < 3 && epoch_pending() > 0; ++i) {
+		epoch_collect();
+	}
+	assert(epoch_pending() == 0);
+	clear_online_list(&list);
+	epoch_cleanup();
+	printf("Superato test con letture e modifiche concorrenti\n");
+
+	// se ci fossero stati problemi il processo sarebbe già terminato con EXIT_FAILURE
+	return 0;
+}
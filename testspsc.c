@@ -0,0 +1,74 @@
+/**
+ * @brief Test per il file spsc.h
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "spsc.h"
+
+#define CAPACITY 100
+#define K 1000000
+
+static spsc_t ring;
+
+void* producer(void* arg){
+	for (int i = 0; i < K; ++i) {
+		while (!spsc_push(&ring, i)) {
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+int main(int argc, char** argv) {
+	int v;
+	assert(create_spsc(&ring, CAPACITY) == 0);
+	// la capacità viene arrotondata alla potenza di 2 successiva
+	assert(ring.mask + 1 == 128);
+
+	// test di base, a thread singolo
+	assert(!spsc_pop(&ring, &v));
+	for (int i = 0; i < 128; ++i) {
+		assert(spsc_size(&ring) == i);
+		assert(spsc_push(&ring, i));
+	}
+	assert(!spsc_push(&ring, 128));
+	for (int i = 0; i < 128; ++i) {
+		assert(spsc_pop(&ring, &v) && v == i);
+		assert(spsc_size(&ring) == 127 - i);
+	}
+	assert(!spsc_pop(&ring, &v));
+	printf("Superati test di base\n");
+
+	// un produttore e un consumatore: gli elementi devono arrivare tutti e
+	// nello stesso ordine
+	pthread_t tid;
+	pthread_create(&tid, NULL, &producer, NULL);
+	for (int i = 0; i < K; ++i) {
+		while (!spsc_pop(&ring, &v)) {
+			sched_yield();
+		}
+		if (v != i) {
+			fprintf(stderr, "ERROR: atteso %d, estratto %d\n", i, v);
+			exit(EXIT_FAILURE);
+		}
+	}
+	pthread_join(tid, NULL);
+	assert(!spsc_pop(&ring, &v));
+	printf("Superato test produttore-consumatore\n");
+
+	clear_spsc(&ring);
+	return 0;
+}
@@ -0,0 +1,170 @@
+/**
+ * @file uring.c
+ * @brief Implementazione di uring.h
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+// ------------------ Funzioni interne ---------------
+
+/**
+ * @brief Mappa una delle aree condivise con il kernel
+ *
+ * @return L'indirizzo dell'area, NULL in caso di errore (e imposta errno)
+ */
+static void* map_ring(int fd, size_t size, off_t offset) {
+	void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+	return p == MAP_FAILED ? NULL : p;
+}
+
+/**
+ * @brief Toglie la mappatura delle aree già mappate, ignorando quelle NULL
+ */
+static void unmap_rings(uring_t* ring) {
+	if (ring->sqes != NULL) {
+		munmap(ring->sqes, ring->sqes_size);
+	}
+	if (ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring) {
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+	if (ring->sq_ring != NULL) {
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	}
+}
+
+// ------- Funzioni esportate --------------
+// Documentate in uring.h
+
+int create_uring(uring_t* ring, unsigned entries) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	memset(ring, 0, sizeof(uring_t));
+	#ifdef __NR_io_uring_setup
+		ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+	#else
+		ring->fd = -1;
+		errno = ENOSYS;
+	#endif
+	if (ring->fd < 0) {
+		return -1;
+	}
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		// Le due code stanno nella stessa area
+		if (ring->cq_ring_size > ring->sq_ring_size) {
+			ring->sq_ring_size = ring->cq_ring_size;
+		}
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+	ring->sq_ring = map_ring(ring->fd, ring->sq_ring_size, IORING_OFF_SQ_RING);
+	if (ring->sq_ring != NULL) {
+		ring->cq_ring = p.features & IORING_FEAT_SINGLE_MMAP ? ring->sq_ring
+			: map_ring(ring->fd, ring->cq_ring_size, IORING_OFF_CQ_RING);
+	}
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	if (ring->cq_ring != NULL) {
+		ring->sqes = map_ring(ring->fd, ring->sqes_size, IORING_OFF_SQES);
+	}
+	if (ring->sqes == NULL) {
+		int err = errno;
+		unmap_rings(ring);
+		close(ring->fd);
+		errno = err;
+		return -1;
+	}
+	char* sq = ring->sq_ring;
+	ring->sq_head = (unsigned*)(sq + p.sq_off.head);
+	ring->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+	ring->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+	char* cq = ring->cq_ring;
+	ring->cq_head = (unsigned*)(cq + p.cq_off.head);
+	ring->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+	ring->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+	return 0;
+}
+
+void clear_uring(uring_t* ring) {
+	unmap_rings(ring);
+	close(ring->fd);
+}
+
+struct io_uring_sqe* uring_get_sqe(uring_t* ring) {
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	unsigned tail = *(ring->sq_tail) + ring->to_submit;
+	if (tail - head > *(ring->sq_mask)) {
+		return NULL;
+	}
+	unsigned index = tail & *(ring->sq_mask);
+	struct io_uring_sqe* sqe = ring->sqes + index;
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	ring->sq_array[index] = index;
+	++ring->to_submit;
+	return sqe;
+}
+
+void uring_prep_poll(struct io_uring_sqe* sqe, int fd, unsigned events, unsigned long long user_data) {
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	sqe->user_data = user_data;
+}
+
+void uring_prep_accept(struct io_uring_sqe* sqe, int fd, unsigned long long user_data) {
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = fd;
+	sqe->user_data = user_data;
+}
+
+int uring_submit(uring_t* ring, unsigned wait_nr) {
+	// Rende visibili al kernel gli SQE preparati
+	__atomic_store_n(ring->sq_tail, *(ring->sq_tail) + ring->to_submit, __ATOMIC_RELEASE);
+	unsigned to_submit = ring->to_submit;
+	ring->to_submit = 0;
+	int res;
+	do {
+		res = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr,
+			wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		// Se la syscall viene interrotta gli SQE non ancora letti restano
+		// nella coda: vanno contati solo quelli già letti dal kernel
+		if (res >= 0 || errno != EINTR) {
+			break;
+		}
+		unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+		to_submit = *(ring->sq_tail) - head;
+	} while (true);
+	return res;
+}
+
+unsigned uring_reap(uring_t* ring, uring_event_t* events, unsigned max) {
+	unsigned head = *(ring->cq_head);
+	unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	unsigned n = 0;
+	while (head != tail && n < max) {
+		struct io_uring_cqe* cqe = ring->cqes + (head & *(ring->cq_mask));
+		events[n].user_data = cqe->user_data;
+		events[n].res = cqe->res;
+		++n;
+		++head;
+	}
+	// Libera i posti letti
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	return n;
+}
@@ -0,0 +1,154 @@
+/**
+ * @file uring.h
+ * @brief Libreria minima per usare io_uring senza liburing
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ *
+ * Le richieste (SQE) vengono preparate nella coda di sottomissione condivisa
+ * con il kernel senza syscall, e inviate tutte insieme da uring_submit, che
+ * nella stessa syscall può anche aspettare i completamenti (CQE). I
+ * completamenti si leggono poi dalla loro coda, anche questi senza syscall.
+ *
+ * Le funzioni non sono thread safe: ogni ring va usato da un solo thread.
+ */
+#ifndef CHATTERBOX_URING_H_
+#define CHATTERBOX_URING_H_
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <linux/io_uring.h>
+
+/**
+ * @struct uring
+ * @brief Un io_uring con le sue code mappate in memoria
+ *
+ * I puntatori sq_* e cq_* puntano ai campi delle code condivise con il
+ * kernel, che vanno letti e scritti con operazioni atomiche.
+ *
+ * @var struct uring::fd Il fd restituito da io_uring_setup
+ * @var struct uring::sq_head Primo SQE non ancora letto dal kernel
+ * @var struct uring::sq_tail Primo posto libero della coda di sottomissione
+ * @var struct uring::sq_mask Maschera per gli indici della coda di
+ *                            sottomissione
+ * @var struct uring::sq_array Indici degli SQE nella coda di sottomissione
+ * @var struct uring::sqes Gli SQE
+ * @var struct uring::cq_head Primo CQE non ancora letto
+ * @var struct uring::cq_tail Primo posto libero della coda dei completamenti
+ * @var struct uring::cq_mask Maschera per gli indici della coda dei
+ *                            completamenti
+ * @var struct uring::cqes I CQE
+ * @var struct uring::to_submit SQE preparati ma non ancora inviati
+ * @var struct uring::sq_ring Memoria mappata della coda di sottomissione
+ * @var struct uring::sq_ring_size Dimensione di sq_ring
+ * @var struct uring::cq_ring Memoria mappata della coda dei completamenti
+ *                            (uguale a sq_ring se il kernel le unisce)
+ * @var struct uring::cq_ring_size Dimensione di cq_ring
+ * @var struct uring::sqes_size Dimensione della memoria mappata per sqes
+ */
+typedef struct uring {
+	int fd;
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	struct io_uring_sqe* sqes;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	struct io_uring_cqe* cqes;
+	unsigned to_submit;
+	void* sq_ring;
+	size_t sq_ring_size;
+	void* cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+} uring_t;
+
+/**
+ * @struct uring_event
+ * @brief Il contenuto di un completamento
+ *
+ * @var struct uring_event::user_data Il valore dato alla preparazione
+ *                                    dell'SQE
+ * @var struct uring_event::res Il risultato dell'operazione (-errno in caso di
+ *                              errore)
+ */
+typedef struct uring_event {
+	unsigned long long user_data;
+	int res;
+} uring_event_t;
+
+/**
+ * @brief Crea un io_uring
+ *
+ * @param ring Il ring da inizializzare
+ * @param entries Numero di posti della coda di sottomissione (quella dei
+ *                completamenti ne ha il doppio)
+ * @return 0 in caso di successo, < 0 se il kernel non supporta io_uring o in
+ *         caso di errore (e imposta errno)
+ */
+int create_uring(uring_t* ring, unsigned entries);
+
+/**
+ * @brief Chiude un io_uring e libera la memoria mappata
+ *
+ * @param ring Il ring da eliminare
+ */
+void clear_uring(uring_t* ring);
+
+/**
+ * @brief Prende il prossimo SQE libero, azzerato
+ *
+ * @param ring Il ring
+ * @return L'SQE, NULL se la coda di sottomissione è piena (va chiamata prima
+ *         uring_submit)
+ */
+struct io_uring_sqe* uring_get_sqe(uring_t* ring);
+
+/**
+ * @brief Prepara un SQE che aspetta che un fd sia pronto (una sola volta)
+ *
+ * @param sqe L'SQE da riempire
+ * @param fd Il fd da controllare
+ * @param events Gli eventi da aspettare, come per poll
+ * @param user_data Il valore restituito nel CQE
+ */
+void uring_prep_poll(struct io_uring_sqe* sqe, int fd, unsigned events, unsigned long long user_data);
+
+/**
+ * @brief Prepara un SQE che accetta una connessione
+ *
+ * Il risultato del CQE è il fd della nuova connessione.
+ *
+ * @param sqe L'SQE da riempire
+ * @param fd Il socket in ascolto
+ * @param user_data Il valore restituito nel CQE
+ */
+void uring_prep_accept(struct io_uring_sqe* sqe, int fd, unsigned long long user_data);
+
+/**
+ * @brief Invia al kernel gli SQE preparati e aspetta dei completamenti, con
+ * una sola syscall
+ *
+ * @param ring Il ring
+ * @param wait_nr Numero minimo di completamenti da aspettare (anche 0)
+ * @return Il numero di SQE inviati, < 0 in caso di errore (e imposta errno)
+ */
+int uring_submit(uring_t* ring, unsigned wait_nr);
+
+/**
+ * @brief Estrae i completamenti disponibili, senza syscall
+ *
+ * @param ring Il ring
+ * @param events Dove copiare i completamenti
+ * @param max Numero massimo di completamenti da estrarre
+ * @return Il numero di completamenti estratti
+ */
+unsigned uring_reap(uring_t* ring, uring_event_t* events, unsigned max);
+
+#endif /* CHATTERBOX_URING_H_ */
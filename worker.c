@@ -45,6 +45,149 @@
 	fdclose = sendHdrResponse(fd, &response.hdr); \
 	increaseStat(nerrors)
 
+/**
+ * @brief Registra un fd in OUT_EPOLLFD perché il listener invii la sua coda di
+ * uscita appena il socket torna scrivibile. Va chiamata con la lock della coda.
+ *
+ * @param fd Il fd del client
+ * @param q La coda di uscita del client
+ */
+static void armOutQueue(int fd, out_queue_t* q) {
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLOUT | EPOLLONESHOT;
+	ev.data.fd = fd;
+	if (epoll_ctl(OUT_EPOLLFD, q->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) < 0) {
+		perror("registrando un fd nell'epoll di uscita");
+	}
+	else {
+		q->registered = true;
+	}
+}
+
+/**
+ * @brief Chiude il fd di un client, scartando i suoi buffer di ricezione e di
+ * invio.
+ *
+ * Prima di scartare la coda di uscita prova un'ultima volta ad inviarla, così
+ * l'ultima risposta (ad esempio quella ad UNREGISTER_OP) arriva al client se il
+ * socket ha posto. Chiudere il fd lo toglie anche da OUT_EPOLLFD.
+ *
+ * @param fd Il fd da chiudere
+ */
+static void closeClientFd(int fd) {
+	out_queue_t* q = fd_outqueues + fd;
+	error_handling_lock(&(q->mutex));
+	flushWriter(fd, &(q->writer));
+	resetWriter(&(q->writer));
+	q->registered = false;
+	q->congested = false;
+	q->park_requested = false;
+	q->parked = false;
+	error_handling_unlock(&(q->mutex));
+	resetReader(fd_readers + fd);
+	close(fd);
+}
+
+/**
+ * @brief Consegna un messaggio ad un client connesso diverso da quello che
+ * ha fatto la richiesta.
+ *
+ * Va chiamata con la lock del destinatario presa, che garantisce che il fd non
+ * venga chiuso. Il messaggio non viene mai aspettato: se il client ha
+ * superato OutQueueHighWater byte in coda (e non è ancora sceso sotto
+ * OutQueueLowWater) viene applicata OutQueuePolicy.
+ *
+ * @param receiver Il destinatario
+ * @param msg Il messaggio da consegnare
+ * @return true se il messaggio è stato inviato o messo in coda, false se è
+ *         stato scartato
+ */
+static bool deliverMsg(nickname_t* receiver, message_t* msg) {
+	int fd = receiver->fd;
+	out_queue_t* q = fd_outqueues + fd;
+	bool delivered = false;
+	error_handling_lock(&(q->mutex));
+	if (q->writer.pending > (size_t)OutQueueHighWater * OUT_QUEUE_SIZE_FACTOR) {
+		q->congested = true;
+	}
+	else if (q->writer.pending <= (size_t)OutQueueLowWater * OUT_QUEUE_SIZE_FACTOR) {
+		q->congested = false;
+	}
+	if (!q->congested) {
+		// Non fa gestione dell'errore perché se non riesce ad inviare è un
+		// problema del client, il server se lo tiene nell'history e poi sarà
+		// il client a chiedergli di nuovo il messaggio.
+		if (sendMsgsNonBlocking(fd, &(q->writer), &msg, 1) > 0) {
+			armOutQueue(fd, q);
+		}
+		delivered = true;
+	}
+	else if (OutQueuePolicy == OUT_POLICY_DISCONNECT) {
+		// Il fd appartiene a chi serve il client: shutdown gli fa leggere la
+		// fine della connessione, e la chiusura segue la strada normale
+		#ifdef DEBUG
+			fprintf(stderr, "Il client su fd %d non legge, lo disconnetto\n", fd);
+		#endif
+		shutdown(fd, SHUT_RDWR);
+	}
+	error_handling_unlock(&(q->mutex));
+	return delivered;
+}
+
+/**
+ * @brief Invia un cambiamento della lista dei connessi a chi ha fatto
+ * PRESENCE_SUB_OP. Va chiamata con connected_mutex presa.
+ *
+ * Come i messaggi a tutti, il cambiamento non viene mai aspettato: a chi non
+ * legge si applica OutQueuePolicy, e dal salto di versione il client capisce
+ * di dover chiedere di nuovo la lista.
+ *
+ * @param op PRESENCE_JOIN o PRESENCE_LEAVE
+ * @param name Il nickname che si è connesso o disconnesso (MAX_NAME_LENGTH + 1
+ *             byte)
+ * @param version La versione di online_users dopo il cambiamento
+ */
+static void notifyPresence(char op, const char* name, unsigned long version) {
+	if (num_presence_subs == 0) {
+		return;
+	}
+	presence_hdr_t hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.version = version;
+	char buf[sizeof(presence_hdr_t) + PRESENCE_RECORD_SIZE];
+	memcpy(buf, &hdr, sizeof(hdr));
+	buf[sizeof(hdr)] = op;
+	memcpy(buf + sizeof(hdr) + 1, name, MAX_NAME_LENGTH + 1);
+	message_t msg;
+	setHeader(&msg.hdr, PRESENCE_MESSAGE, "");
+	setData(&msg.data, "", buf, sizeof(buf));
+	for (int i = 0; i < num_presence_subs; ++i) {
+		nickname_t* sub = fd_sessions[presence_subs[i]].nick;
+		error_handling_lock(&(sub->mutex));
+		if (sub->fd > 0) {
+			deliverMsg(sub, &msg);
+		}
+		error_handling_unlock(&(sub->mutex));
+	}
+}
+
+/**
+ * @brief Toglie un client da chi riceve i cambiamenti della lista dei
+ * connessi, se c'era. Va chiamata con connected_mutex presa.
+ *
+ * @param session La sessione del client
+ */
+static void unsubscribePresence(client_session_t* session) {
+	if (!session->presence_sub) {
+		return;
+	}
+	int last = presence_subs[--num_presence_subs];
+	presence_subs[session->presence_pos] = last;
+	fd_sessions[last].presence_pos = session->presence_pos;
+	session->presence_sub = false;
+}
+
 /**
  * @brief Modifica le strutture dati necessarie alla disconnessione di un client
  * dal fd passato. Se il fd passato non ha associato nessun client, viene
@@ -56,23 +199,30 @@
  * @param fd Il fd su cui lavorare
  */
 void disconnectClient(int fd) {
-	if (fd_to_nickname[fd] == NULL) {
-		close(fd);
+	client_session_t* session = fd_sessions + fd;
+	if (session->nick == NULL) {
+		error_handling_lock(&connected_mutex);
+		--num_clients;
+		error_handling_unlock(&connected_mutex);
+		closeClientFd(fd);
 		return;
 	}
 	#ifdef DEBUG
-		fprintf(stderr, "Un client si è disconnesso (fd %d, nick \"%s\") :c\n", fd, fd_to_nickname[fd]);
+		fprintf(stderr, "Un client si è disconnesso (fd %d, nick \"%s\") :c\n", fd, session->name);
 	#endif
-	nickname_t* client = hash_find(nickname_htable, fd_to_nickname[fd]);
-	error_handling_lock(&(client->mutex));
-	client->fd = 0;
-	error_handling_unlock(&(client->mutex));
+	error_handling_lock(&(session->nick->mutex));
+	session->nick->fd = 0;
+	// Finché non si riconnette l'history cambia solo se riceve messaggi
+	shrink_history(session->nick);
+	error_handling_unlock(&(session->nick->mutex));
 	error_handling_lock(&connected_mutex);
 	--num_connected;
-	free(fd_to_nickname[fd]);
-	fd_to_nickname[fd] = NULL;
+	--num_clients;
+	session->nick = NULL;
+	unsubscribePresence(session);
+	notifyPresence(PRESENCE_LEAVE, session->name, online_remove(&online_users, &(session->online_pos)));
 	error_handling_unlock(&connected_mutex);
-	close(fd);
+	closeClientFd(fd);
 }
 
 /**
@@ -87,66 +237,162 @@ void disconnectClient(int fd) {
  *                  nickname_htable.
  */
 void connectClient(char* nick, int fd, nickname_t* nick_data) {
+	client_session_t* session = fd_sessions + fd;
+	if (session->nick != NULL) {
+		// Il client era già connesso con un altro nickname, che resta libero
+		error_handling_lock(&(session->nick->mutex));
+		session->nick->fd = 0;
+		shrink_history(session->nick);
+		error_handling_unlock(&(session->nick->mutex));
+		notifyPresence(PRESENCE_LEAVE, session->name, online_remove(&online_users, &(session->online_pos)));
+		--num_connected;
+	}
 	error_handling_lock(&(nick_data->mutex));
 	nick_data->fd = fd;
 	error_handling_unlock(&(nick_data->mutex));
-	fd_to_nickname[fd] = malloc((strlen(nick) + 1) * sizeof(char*));
-	strncpy(fd_to_nickname[fd], nick, strlen(nick) + 1);
+	session->nick = nick_data;
+	strncpy(session->name, nick, MAX_NAME_LENGTH + 1);
+	session->name[MAX_NAME_LENGTH] = '\0';
+	notifyPresence(PRESENCE_JOIN, session->name, online_add(&online_users, session->name, &(session->online_pos)));
 	++num_connected;
 }
 
 /**
  * @brief Crea un messaggio contenente l'elenco dei nickname connessi da usare
- * come risposta per un client. Si aspetta che sia già stata acquisita la lock
- * connected_mutex.
+ * come risposta per un client.
+ *
+ * Il body è la copia condivisa di online_users, che resta valida fino alla fine
+ * della sezione del chiamante: non va liberato. Non serve nessuna lock.
  *
  * @param msg Puntatore al messaggio che verrà poi spedito come risposta.
+ * @return true in caso di successo, false se non c'è abbastanza memoria
  */
-void responseConnectedList(message_t* msg) {
-	int p = 0;
-	char* conn_list = malloc(num_connected * sizeof(char) * (MAX_NAME_LENGTH + 1));
-	for (int i = 0; i < MaxConnections; ++i) {
-		if (fd_to_nickname[i] != NULL) {
-			strncpy(conn_list + p * (MAX_NAME_LENGTH + 1), fd_to_nickname[i], MAX_NAME_LENGTH + 1);
-			++p;
-		}
+bool responseConnectedList(message_t* msg) {
+	online_snapshot_t* snap = online_snapshot(&online_users);
+	if (snap == NULL) {
+		return false;
 	}
-	#ifdef DEBUG
-		#ifdef VERBOSE
-			fprintf(stderr, "p: %d, num_connected: %d\n", p, num_connected);
-		#endif
-		assert(p == num_connected);
+	#if defined DEBUG && defined VERBOSE
+		fprintf(stderr, "connessi: %d (versione %lu)\n", snap->count, snap->version);
 	#endif
 	setHeader(&(msg->hdr), OP_OK, "");
-	setData(&(msg->data), "", conn_list, num_connected * (MAX_NAME_LENGTH + 1));
+	setData(&(msg->data), "", snap->names, snap->count * (MAX_NAME_LENGTH + 1));
+	return true;
 }
 
 /**
- * @brief Invia un messaggio come risposta ad una richiesta di un client.
+ * @brief Invia dei messaggi ad un client passando dalla sua coda di uscita.
  *
- * @param fd Il fd su cui inviare la risposta.
- * @param res Il messaggio da inviare come risposta.
+ * @param fd Il fd del client
+ * @param msgs Array di puntatori ai messaggi da inviare
+ * @param n Numero di messaggi da inviare
+ * @return Il numero di byte rimasti in coda, < 0 in caso di errore
+ */
+static ssize_t queueMsgs(int fd, message_t** msgs, int n) {
+	out_queue_t* q = fd_outqueues + fd;
+	error_handling_lock(&(q->mutex));
+	ssize_t pending = sendMsgsNonBlocking(fd, &(q->writer), msgs, n);
+	if (pending > 0) {
+		armOutQueue(fd, q);
+	}
+	error_handling_unlock(&(q->mutex));
+	return pending;
+}
+
+/**
+ * @brief Invia un header ad un client passando dalla sua coda di uscita.
+ *
+ * @param fd Il fd del client
+ * @param hdr L'header da inviare
+ * @return Il numero di byte rimasti in coda, < 0 in caso di errore
+ */
+static ssize_t queueHdr(int fd, message_hdr_t* hdr) {
+	out_queue_t* q = fd_outqueues + fd;
+	error_handling_lock(&(q->mutex));
+	ssize_t pending = sendHeaderNonBlocking(fd, &(q->writer), hdr);
+	if (pending > 0) {
+		armOutQueue(fd, q);
+	}
+	error_handling_unlock(&(q->mutex));
+	return pending;
+}
+
+/**
+ * @brief Invia un messaggio con un file come body ad un client passando dalla
+ * sua coda di uscita.
+ *
+ * @param fd Il fd del client
+ * @param msg Il messaggio, con data.hdr.len uguale alla dimensione del file
+ * @param filefd Il fd del file
+ * @return Il numero di byte rimasti in coda, < 0 in caso di errore
+ */
+static ssize_t queueFile(int fd, message_t* msg, int filefd) {
+	out_queue_t* q = fd_outqueues + fd;
+	error_handling_lock(&(q->mutex));
+	ssize_t pending = sendFileNonBlocking(fd, &(q->writer), msg, filefd);
+	if (pending > 0) {
+		armOutQueue(fd, q);
+	}
+	error_handling_unlock(&(q->mutex));
+	return pending;
+}
+
+/**
+ * @brief Gestisce il risultato dell'invio di una risposta ad un client.
+ *
+ * Le risposte non vengono mai scartate né aspettate: se la coda di uscita
+ * supera OutQueueHighWater, con OutQueuePolicy disconnect il client viene
+ * disconnesso, altrimenti alla fine della richiesta smette di essere servito
+ * finché non si mette in pari (vedere parkClient).
+ *
+ * @param fd Il fd su cui è stata inviata la risposta.
+ * @param pending Il valore restituito da queueMsgs o queueHdr.
  * @return Il valore da assegnare a fdclose (true se il client si è disconnesso,
-           false altrimenti). Se ritorna true, sendMsgResponse disconnette anche
-		   il client.
+           false altrimenti). Se ritorna true disconnette anche il client.
  */
-bool sendMsgResponse(int fd, message_t* res) {
-	#if defined DEBUG && defined VERBOSE
-		fprintf(stderr, "Invio risposta (msg) al client\n");
-	#endif
-	if (sendRequest(fd, res) < 0) {
+static bool handleResponse(int fd, ssize_t pending) {
+	if (pending > (ssize_t)OutQueueHighWater * OUT_QUEUE_SIZE_FACTOR) {
+		if (OutQueuePolicy == OUT_POLICY_DISCONNECT) {
+			// Come in deliverMsg: la chiusura segue la strada normale quando
+			// si legge la fine della connessione
+			#ifdef DEBUG
+				fprintf(stderr, "Il client su fd %d non legge le risposte, lo disconnetto\n", fd);
+			#endif
+			shutdown(fd, SHUT_RDWR);
+		}
+		else {
+			fd_outqueues[fd].park_requested = true;
+		}
+	}
+	if (pending < 0) {
 		if (errno == EPIPE) {
 			// Client disconnesso
 			disconnectClient(fd);
 			return true;
 		}
 		else {
-			perror("inviando un messaggio");
+			perror("inviando una risposta");
 		}
 	}
 	return false;
 }
 
+/**
+ * @brief Invia un messaggio come risposta ad una richiesta di un client.
+ *
+ * @param fd Il fd su cui inviare la risposta.
+ * @param res Il messaggio da inviare come risposta.
+ * @return Il valore da assegnare a fdclose (true se il client si è disconnesso,
+           false altrimenti). Se ritorna true, sendMsgResponse disconnette anche
+		   il client.
+ */
+bool sendMsgResponse(int fd, message_t* res) {
+	#if defined DEBUG && defined VERBOSE
+		fprintf(stderr, "Invio risposta (msg) al client\n");
+	#endif
+	return handleResponse(fd, queueMsgs(fd, &res, 1));
+}
+
 /**
  * @brief Invia un header come risposta ad una richiesta di un client.
  *
@@ -160,17 +406,7 @@ bool sendHdrResponse(int fd, message_hdr_t* res) {
 	#if defined DEBUG && defined VERBOSE
 		fprintf(stderr, "Invio risposta (hdr) al client\n");
 	#endif
-	if (sendHeader(fd, res) < 0) {
-		if (errno == EPIPE) {
-			// Client disconnesso
-			disconnectClient(fd);
-			return true;
-		}
-		else {
-			perror("inviando un messaggio");
-		}
-	}
-	return false;
+	return handleResponse(fd, queueHdr(fd, res));
 }
 
 /**
@@ -182,29 +418,33 @@ bool sendHdrResponse(int fd, message_hdr_t* res) {
  * richieste dal fd su cui è stata fatta una CONNECT_OP con quel nickname. Per
  * nickname del client si intende quello ricevuto come msg.hdr.sender.
  *
+ * Per un client regolare basta confrontare il nickname con quello della sua
+ * sessione; l'hashtable viene consultata solo per scegliere l'errore.
+ *
  * @param nick Il nickname da cui arriva la richiesta (msg.hdr.sender)
  * @param fd Il fd da cui arriva la richiesta
- * @param nick_data Il nickname_t associato al nickname passato
- * @return true se il client è regolare, altrimenti false
+ * @return Il nickname_t del client se è regolare, altrimenti NULL
  */
-bool checkConnected(char* nick, int fd, nickname_t* nick_data) {
+nickname_t* checkConnected(char* nick, int fd) {
+	client_session_t* session = fd_sessions + fd;
+	if (session->nick != NULL
+		&& strncmp(session->name, nick, MAX_NAME_LENGTH + 1) == 0) {
+		return session->nick;
+	}
 	message_t response;
-	if (nick_data == NULL) {
+	if (hash_find(nickname_htable, nick) == NULL) {
 		// nickname sconosciuto
 		#ifdef DEBUG
 			fprintf(stderr, "Richiesta di operazione da un nickname inesistente\n");
 		#endif
 		sendFatalFailResponse(response, fd, OP_NICK_UNKNOWN);
-		return false;
-	}
-	if (nick_data->fd != fd) {
-		#ifdef DEBUG
-			fprintf(stderr, "Richiesta su un fd diverso da quello del nickname\n");
-		#endif
-		sendFatalFailResponse(response, fd, OP_WRONG_FD);
-		return false;
+		return NULL;
 	}
-	return true;
+	#ifdef DEBUG
+		fprintf(stderr, "Richiesta su un fd diverso da quello del nickname\n");
+	#endif
+	sendFatalFailResponse(response, fd, OP_WRONG_FD);
+	return NULL;
 }
 
 /**
@@ -214,284 +454,717 @@ bool checkConnected(char* nick, int fd, nickname_t* nick_data) {
  * @return true se il messaggio è regolare, altrimenti false
  */
 bool checkMsg(message_t* msg) {
-	if (msg->data.hdr.len == (strlen(msg->data.buf) + 1))
-		return true;
-	else
-		return false;
+	// Equivale a len == strlen(buf) + 1, ma non legge oltre il body: il
+	// buffer punta dentro il buffer di ricezione e non è terminato
+	unsigned int len = msg->data.hdr.len;
+	return len > 0 && msg->data.buf[len - 1] == '\0'
+		&& memchr(msg->data.buf, '\0', len - 1) == NULL;
 }
 
-// ------------------------- funzioni esportate -----------------------
+/**
+ * @brief Copia un messaggio ricevuto perché possa essere conservato
+ *
+ * Il body dei messaggi letti con readMsgNonBlocking punta dentro il buffer di
+ * ricezione del client, quindi va copiato prima di inserirlo nell'history.
+ *
+ * @param msg Il messaggio da copiare
+ * @return Un messaggio uguale con una copia del body in un buffer condiviso
+ *         (vedere msgbuf.h), con un solo riferimento
+ */
+message_t copyMsg(message_t* msg) {
+	message_t copy = *msg;
+	copy.data.buf = msgbuf_create(msg->data.buf, msg->data.hdr.len);
+	return copy;
+}
 
-// Documentata in worker.h
-void* worker_thread(void* arg) {
-	int workerNumber = *(int*)arg;
+/**
+ * @brief Prende il prossimo numero di sequenza per un messaggio da salvare.
+ *
+ * @return Il numero di sequenza, maggiore di tutti quelli presi prima
+ */
+static unsigned long nextSeq() {
+	return __atomic_fetch_add(&msg_seq, 1, __ATOMIC_RELAXED);
+}
 
-	while(threads_continue) {
-		int localfd = ts_pop(&queue);
-		if (localfd == TERMINATION_FD) {
-			// Ha ricevuto il fd falso passato dal signal_handler_thread
-			break;
+/**
+ * @brief Risponde ad una USRLIST_SINCE_OP o PRESENCE_SUB_OP con i cambiamenti
+ * della lista dei connessi dalla versione richiesta.
+ *
+ * Chi si iscrive viene aggiunto a presence_subs mentre la risposta viene messa
+ * in coda, con connected_mutex presa: tutti i cambiamenti successivi alla
+ * versione della risposta gli arrivano come PRESENCE_MESSAGE, e nessuno prima.
+ *
+ * @param fd Il fd del client
+ * @param msg La richiesta
+ * @param subscribe true per PRESENCE_SUB_OP
+ * @return Il valore da assegnare a fdclose
+ */
+static bool respondPresence(int fd, message_t* msg, bool subscribe) {
+	message_t response;
+	bool fdclose;
+	unsigned long version;
+	if (msg->data.hdr.len != sizeof(version)) {
+		sendSoftFailResponse(response, fd, OP_MSG_INVALID, fdclose);
+		return fdclose;
+	}
+	memcpy(&version, msg->data.buf, sizeof(version));
+	if (subscribe) {
+		error_handling_lock(&connected_mutex);
+	}
+	unsigned int len;
+	char* changes = online_since(&online_users, version, &len);
+	if (changes == NULL) {
+		if (subscribe) {
+			error_handling_unlock(&connected_mutex);
 		}
-		message_t msg;
-		msg.data.buf = NULL;
-		bool fdclose = false;
-		// Le comunicazioni iniziano sempre con un messaggio
-		int readResult = readMsg(localfd, &msg);
-		if (readResult < 0) {
-			if (errno == ECONNRESET) {
-				#ifdef DEBUG
-					fprintf(stderr, "%d: un client è crashato (fd %d)\n", workerNumber, localfd);
-				#endif
-				disconnectClient(localfd);
-				fdclose = true;
+		sendSoftFailResponse(response, fd, OP_FAIL, fdclose);
+		return fdclose;
+	}
+	setHeader(&response.hdr, OP_OK, "");
+	setData(&response.data, "", changes, len);
+	message_t* res = &response;
+	ssize_t pending = queueMsgs(fd, &res, 1);
+	if (subscribe) {
+		client_session_t* session = fd_sessions + fd;
+		if (!session->presence_sub) {
+			session->presence_sub = true;
+			session->presence_pos = num_presence_subs;
+			presence_subs[num_presence_subs++] = fd;
+		}
+		error_handling_unlock(&connected_mutex);
+	}
+	free(changes);
+	return handleResponse(fd, pending);
+}
+
+/**
+ * @brief Riceve il body di un file un pezzo alla volta e lo scrive su disco
+ *
+ * Il file non viene mai tenuto tutto in memoria: ogni pezzo di al più
+ * UPLOAD_CHUNK_SIZE byte viene scritto prima di leggere il successivo. Anche se
+ * la scrittura fallisce il resto del body viene letto, perché la connessione
+ * resti allineata al protocollo. Mentre lo riceve ne calcola l'hash, che serve
+ * all'archivio dei file.
+ *
+ * @param fd Il fd del client
+ * @param outfd Il fd su cui scrivere il file, < 0 per scartarlo
+ * @param len La lunghezza del body
+ * @param hash L'hash a cui aggiungere il contenuto, NULL se non serve
+ * @param written Puntatore su cui viene scritto se il file è stato scritto
+ *                tutto
+ * @return 1 se il body è stato ricevuto tutto, 0 se il client si è
+ *         disconnesso, < 0 in caso di errore
+ */
+static int receiveFile(int fd, int outfd, size_t len, sha256_t* hash, bool* written) {
+	char chunk[UPLOAD_CHUNK_SIZE];
+	*written = outfd >= 0;
+	while (len > 0) {
+		ssize_t byte_read = readChunkBuffered(fd, fd_readers + fd, chunk,
+			len < UPLOAD_CHUNK_SIZE ? len : UPLOAD_CHUNK_SIZE);
+		if (byte_read <= 0) {
+			return byte_read;
+		}
+		len -= byte_read;
+		if (hash != NULL) {
+			sha256_update(hash, chunk, byte_read);
+		}
+		for (ssize_t p = 0; *written && p < byte_read; ) {
+			ssize_t byte_written = write(outfd, chunk + p, byte_read - p);
+			if (byte_written < 0 && errno != EINTR) {
+				perror("writing to output file");
+				*written = false;
 			}
-			else {
-				perror("leggendo un messaggio");
+			else if (byte_written > 0) {
+				p += byte_written;
 			}
 		}
-		else if (readResult == 0) {
-			// Client disconnesso
-			disconnectClient(localfd);
-			fdclose = true;
+	}
+	return 1;
+}
+
+/**
+ * @brief Esegue una POSTFILE_OP di un client regolare, ricevendo il file.
+ *
+ * Va chiamata all'interno di una sezione (vedere epoch.h), da cui esce mentre
+ * riceve il file: un client fermo a metà di un upload non deve impedire di
+ * liberare la memoria. I nickname_t trovati dal chiamante prima della
+ * chiamata non sono quindi più validi dopo.
+ *
+ * @param fd Il fd del client
+ * @param msg La richiesta
+ * @param slotfd Il fd su cui aprire il file temporaneo, riservato al thread
+ *               chiamante (il suo numero distingue anche il file temporaneo)
+ * @return Il valore da assegnare a fdclose
+ */
+static bool postFile(int fd, message_t* msg, int slotfd) {
+	message_t response;
+	bool fdclose = false;
+	nickname_t* receiver = hash_find(nickname_htable, msg->data.hdr.receiver);
+	if (receiver == NULL) {
+		// Destinatario inesistente
+		sendSoftFailResponse(response, fd, OP_DEST_UNKNOWN, fdclose);
+	}
+	else {
+		// Situazione normale
+		// Fino alla fine della ricezione il thread è fuori dalla sezione:
+		// receiver va poi ricercato, perché potrebbe essere stato
+		// deregistrato e liberato nel frattempo
+		epoch_exit();
+		// La dimensione si conosce dall'header del body: un file troppo
+		// grosso viene rifiutato prima di riceverlo
+		message_data_hdr_t file_hdr;
+		bool written;
+		if (readDataHdrBuffered(fd, fd_readers + fd, &file_hdr) <= 0) {
+			perror("scaricando un file");
+			sendSoftFailResponse(response, fd, OP_FAIL, fdclose);
+		}
+		else if (file_hdr.len > MaxFileSize * FILE_SIZE_FACTOR) {
+			// File troppo grosso: va comunque tolto dal socket, ma senza
+			// tenerlo in memoria
+			sendSoftFailResponse(response, fd, OP_MSG_TOOLONG, fdclose);
+			if (!fdclose && receiveFile(fd, -1, file_hdr.len, NULL, &written) <= 0) {
+				perror("scartando un file");
+			}
+		}
+		else if (!checkMsg(msg) || !file_store_valid_name(msg->data.buf)) {
+			// Nome non valido: come sopra, il file viene scartato senza
+			// scriverlo
+			sendSoftFailResponse(response, fd, OP_FAIL, fdclose);
+			if (!fdclose && receiveFile(fd, -1, file_hdr.len, NULL, &written) <= 0) {
+				perror("scartando un file");
+			}
 		}
 		else {
-			message_t response;
-			nickname_t* sender;
-			switch (msg.hdr.op) {
-				case REGISTER_OP: {
-					#ifdef DEBUG
-						fprintf(stderr, "%d: Ricevuta REGISTER_OP\n", workerNumber);
-					#endif
-					if ((sender = ts_hash_insert(nickname_htable, msg.hdr.sender)) == NULL) {
-						// Nickname già esistente
-						#ifdef DEBUG
-							fprintf(stderr, "%d: Nickname %s già esistente!\n", workerNumber, msg.hdr.sender);
-						#endif
-						sendFatalFailResponse(response, localfd, OP_NICK_ALREADY);
-						fdclose = true;
-					}
-					else {
-						// Situazione normale
-						#ifdef DEBUG
-							fprintf(stderr, "%d: Registrato il nickname \"%s\"\n", workerNumber, msg.hdr.sender);
-						#endif
-						pthread_mutex_lock(&connected_mutex);
-						connectClient(msg.hdr.sender, localfd, sender);
-						responseConnectedList(&response);
-						pthread_mutex_unlock(&connected_mutex);
-						fdclose = sendMsgResponse(localfd, &response);
-						free(response.data.buf);
-					}
+			// Il body del messaggio (il nome del file) sta nel buffer di
+			// ricezione: va copiato prima di leggere il file
+			message_t stored = copyMsg(msg);
+			stored.hdr.op = FILE_MESSAGE;
+			// NULL se il nome non ha un link in DirName
+			char* full_filename = file_store_named_path(&file_store, stored.data.buf);
+			#ifdef DEBUG
+				fprintf(stderr, "salvo il file \"%s\"\n", full_filename);
+			#endif
+			// Il file viene ricevuto in un file temporaneo, che poi entra
+			// nell'archivio in base al suo contenuto
+			int outfd = -1;
+			int filefd = file_store_open_tmp(&file_store, slotfd);
+			if (filefd < 0
+				|| dup2(filefd, slotfd) < 0) {
+				perror("aprendo il file");
+			}
+			else {
+				outfd = slotfd;
+			}
+			if (filefd >= 0) {
+				close(filefd);
+			}
+			// Scarica il file
+			sha256_t hash;
+			unsigned char digest[SHA256_SIZE];
+			sha256_init(&hash);
+			int received = receiveFile(fd, outfd, file_hdr.len, &hash, &written);
+			if (outfd >= 0) {
+				close(outfd);
+			}
+			sha256_final(&hash, digest);
+			if (received <= 0) {
+				perror("scaricando un file");
+				file_store_discard(&file_store, slotfd);
+				sendSoftFailResponse(response, fd, OP_FAIL, fdclose);
+			}
+			else if (!written) {
+				file_store_discard(&file_store, slotfd);
+				sendSoftFailResponse(response, fd, OP_FAIL, fdclose);
+			}
+			else {
+				// Sezione breve per salvare il file e consegnarlo
+				epoch_enter();
+				receiver = hash_find(nickname_htable, msg->data.hdr.receiver);
+				if (receiver == NULL) {
+					// Destinatario deregistrato durante la ricezione
+					file_store_discard(&file_store, slotfd);
+					sendSoftFailResponse(response, fd, OP_DEST_UNKNOWN, fdclose);
 				}
-				break;
-				case UNREGISTER_OP: {
-					#ifdef DEBUG
-						fprintf(stderr, "%d: Ricevuta UNREGISTER_OP\n", workerNumber);
-					#endif
-					fdclose = !checkConnected(msg.hdr.sender, localfd, hash_find(nickname_htable, msg.hdr.sender));
-					if (!fdclose) {
-						// Client regolare
-						#ifdef DEBUG
-							fprintf(stderr, "%d: Deregistro il nickname \"%s\"\n", workerNumber, msg.hdr.sender);
-						#endif
-						setHeader(&response.hdr, OP_OK, "");
-						sendHdrResponse(localfd, &response.hdr);
-						// Un client che deregistra un nick non può restare
-						// connesso con quel nickname
-						disconnectClient(localfd);
-						fdclose = true;
-						ts_hash_remove(nickname_htable, msg.hdr.sender);
-					}
+				else if (file_store_commit(&file_store, slotfd, digest,
+					msg->data.hdr.receiver, stored.data.buf) < 0) {
+					perror("salvando un file nell'archivio");
+					file_store_discard(&file_store, slotfd);
+					sendSoftFailResponse(response, fd, OP_FAIL, fdclose);
 				}
-				break;
-				case CONNECT_OP: {
-					#ifdef DEBUG
-						fprintf(stderr, "%d: Ricevuta CONNECT_OP\n", workerNumber);
-					#endif
-					if ((sender = hash_find(nickname_htable, msg.hdr.sender)) != NULL) {
-						error_handling_lock(&(sender->mutex));
-						if (sender->fd != 0) {
-							// Nickname già connesso
-							error_handling_unlock(&(sender->mutex));
-							#ifdef DEBUG
-								fprintf(stderr, "%d: Nick \"%s\" già connesso!\n", workerNumber, msg.hdr.sender);
-							#endif
-							sendFatalFailResponse(response, localfd, OP_NICK_CONN);
-							fdclose = true;
-						}
-						else {
-							// Situazione normale
-							error_handling_unlock(&(sender->mutex));
-							#ifdef DEBUG
-								fprintf(stderr, "%d: Connesso \"%s\" (fd %d)\n", workerNumber, msg.hdr.sender, localfd);
-							#endif
-							error_handling_lock(&connected_mutex);
-							connectClient(msg.hdr.sender, localfd, sender);
-							responseConnectedList(&response);
-							error_handling_unlock(&connected_mutex);
-							fdclose = sendMsgResponse(localfd, &response);
-							free(response.data.buf);
-						}
+				else {
+					// È andato tutto bene
+					// DirName/<nome> è cambiato: se era in cache va riaperto
+					if (full_filename != NULL) {
+						file_cache_invalidate(&file_cache, full_filename);
 					}
-					else {
-						// Nickname inesistente
-						#ifdef DEBUG
-							fprintf(stderr, "%d: Richiesta di connessione di un nickname inesistente\n", workerNumber);
-						#endif
-						sendFatalFailResponse(response, localfd, OP_NICK_UNKNOWN);
-						fdclose = true;
+					error_handling_lock(&(receiver->mutex));
+					add_to_history(receiver, stored, nextSeq());
+					if (receiver->fd > 0 && deliverMsg(receiver, &stored)) {
+						// Non aumenta i file consegnati perché viene fatto
+						// quando finisce GETFILE_OP
+						error_handling_unlock(&(receiver->mutex));
 					}
-				}
-				break;
-				case DISCONNECT_OP: {
-					#ifdef DEBUG
-						fprintf(stderr, "%d: Ricevuta DISCONNECT_OP\n", workerNumber);
-						fprintf(stderr, "%d: Disconnessione fd %d (\"%s\")\n", workerNumber, localfd, fd_to_nickname[localfd]);
-					#endif
-					disconnectClient(localfd);
-					fdclose = true;
-				}
-				break;
-				case USRLIST_OP: {
-					#ifdef DEBUG
-						fprintf(stderr, "%d: Ricevuta USRLIST_OP\n", workerNumber);
-					#endif
-					pthread_mutex_lock(&connected_mutex);
-					responseConnectedList(&response);
-					pthread_mutex_unlock(&connected_mutex);
-					fdclose = sendMsgResponse(localfd, &response);
-					free(response.data.buf);
-				}
-				break;
-				case POSTTXT_OP: {
-					#ifdef DEBUG
-						fprintf(stderr, "%d: Ricevuta POSTTXT_OP\n", workerNumber);
-					#endif
-					fdclose = !checkConnected(msg.hdr.sender, localfd, hash_find(nickname_htable, msg.hdr.sender));
-					if (!fdclose) {
-						// Client regolare
-						if (!checkMsg(&msg)) {
-							// Messaggio invalido
-							sendSoftFailResponse(response, localfd, OP_MSG_INVALID, fdclose);
-						}
-						else if (msg.data.hdr.len > MaxMsgSize) {
-							// Messaggio troppo lungo
-							sendSoftFailResponse(response, localfd, OP_MSG_TOOLONG, fdclose);
-						}
-						else {
-							nickname_t* receiver = hash_find(nickname_htable, msg.data.hdr.receiver);
-							if (receiver == NULL) {
-								// Destinatario inesistente
-								sendSoftFailResponse(response, localfd, OP_DEST_UNKNOWN, fdclose);
-							}
-							else {
-								// Situazione normale
-								msg.hdr.op = TXT_MESSAGE;
-								error_handling_lock(&(receiver->mutex));
-								add_to_history(receiver, msg);
-								if (receiver->fd > 0) {
-									// Non fa gestione dell'errore perché se non
-									// riesce ad inviare è un problema del client,
-									// il server se lo tiene nell'history e poi sarà
-									// il client a chiedergli di nuovo il messaggio.
-									sendRequest(receiver->fd, &msg);
-									error_handling_unlock(&(receiver->mutex));
-									increaseStat(ndelivered);
-								}
-								else {
-									error_handling_unlock(&(receiver->mutex));
-									increaseStat(nnotdelivered);
-								}
-								// Mette a NULL in modo che non venga deallocato
-								msg.data.buf = NULL;
-								setHeader(&response.hdr, OP_OK, "");
-								fdclose = sendHdrResponse(localfd, &response.hdr);
-							}
-						}
+					else {
+						error_handling_unlock(&(receiver->mutex));
+						increaseStat(nfilenotdelivered);
 					}
+					// Ora il buffer appartiene all'history
+					stored.data.buf = NULL;
+					setHeader(&response.hdr, OP_OK, "");
+					fdclose = sendHdrResponse(fd, &response.hdr);
 				}
-				break;
-				case POSTTXTALL_OP: {
-					#ifdef DEBUG
-					fprintf(stderr, "%d: Ricevuta POSTTXTALL_OP\n", workerNumber);
-					#endif
-					fdclose = !checkConnected(msg.hdr.sender, localfd, sender = hash_find(nickname_htable, msg.hdr.sender));
-					if (!fdclose) {
-						// Client regolare
-						if (!checkMsg(&msg)) {
-							// Messaggio invalido
-							sendSoftFailResponse(response, localfd, OP_MSG_INVALID, fdclose);
-						}
-						else {
-							// Situazione normale
-							msg.hdr.op = TXT_MESSAGE;
-							int i;
-							icl_entry_t* j;
-							char* key;
-							nickname_t* val;
-							char* original_buffer = msg.data.buf;
-							icl_hash_foreach(nickname_htable->htable, i, j, key, val) {
-								// Copia il buffer perché ogni history può
-								// cancellare il messaggio (con conseguente free
-								// del buffer) separatamente, quindi deve essere
-								// un puntatore diverso.
-								// TODO: implementare un puntatore
-								// multiriferimento che fa la free solo quando
-								// viene cancellato l'ultimo
-								msg.data.buf = malloc(msg.data.hdr.len * sizeof(char));
-								strncpy(msg.data.buf, original_buffer, msg.data.hdr.len);
-								error_handling_lock(&(val->mutex));
-								add_to_history(val, msg);
-								if (val->fd > 0) {
-									sendRequest(val->fd, &msg);
-									error_handling_unlock(&(val->mutex));
-									increaseStat(ndelivered);
-								}
-								else {
-									error_handling_unlock(&(val->mutex));
-									increaseStat(nnotdelivered);
-								}
-							}
-							msg.data.buf = original_buffer;
-							setHeader(&response.hdr, OP_OK, "");
-							fdclose = sendHdrResponse(localfd, &response.hdr);
+				epoch_exit();
+			}
+			free(full_filename);
+			msgbuf_unref(stored.data.buf);
+		}
+		// Il chiamante si aspetta di essere ancora nella sezione
+		epoch_enter();
+	}
+	return fdclose;
+}
+
+/**
+ * @brief Esegue una GETFILE_OP di un client regolare, inviando il file.
+ *
+ * @param fd Il fd del client
+ * @param msg La richiesta
+ * @return Il valore da assegnare a fdclose
+ */
+static bool getFile(int fd, message_t* msg) {
+	message_t response;
+	bool fdclose = false;
+	// Il file inviato a chi lo chiede, dall'archivio
+	char* full_filename = file_store_path(&file_store, msg->hdr.sender, msg->data.buf);
+	#ifdef DEBUG
+		fprintf(stderr, "apro il file \"%s\"\n", full_filename);
+	#endif
+	// Apre il file passando dalla cache. I contenuti dell'archivio non
+	// cambiano mai, quindi quelli in cache restano validi
+	file_entry_t* file = full_filename == NULL ? NULL
+		: file_cache_open(&file_cache, full_filename);
+	if (file == NULL) {
+		if (errno == EACCES) {
+			// File inesistente
+			#ifdef DEBUG
+				fprintf(stderr, "il file richiesto non esiste (fd %d)\n", fd);
+			#endif
+			sendSoftFailResponse(response, fd, OP_NO_SUCH_FILE, fdclose);
+		}
+		else {
+			perror("aprendo il file");
+			sendSoftFailResponse(response, fd, OP_FAIL, fdclose);
+		}
+	}
+	else {
+		if (!S_ISREG(file->st.st_mode)) {
+			fprintf(stderr, "ERRORE: il file %s non e' un file regolare\n", msg->data.buf);
+			sendSoftFailResponse(response, fd, OP_FAIL, fdclose);
+		}
+		else {
+			// È andato tutto bene: il file viene inviato senza passare
+			// dalla memoria del processo
+			setHeader(&response.hdr, OP_OK, "");
+			setData(&response.data, "", NULL, file->st.st_size);
+			fdclose = handleResponse(fd, queueFile(fd, &response, file->fd));
+			increaseStat(nfiledelivered);
+		}
+		file_cache_release(&file_cache, file);
+	}
+	free(full_filename);
+	return fdclose;
+}
+
+/**
+ * @brief Registra l'ingresso di una richiesta in una classe
+ */
+static void classEnter(op_class_stats_t* cls) {
+	__atomic_add_fetch(&(cls->pending), 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Registra la fine di una richiesta entrata in una classe in start
+ */
+static void classExit(op_class_stats_t* cls, struct timespec* start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long usec = (now.tv_sec - start->tv_sec) * 1000000L
+		+ (now.tv_nsec - start->tv_nsec) / 1000;
+	__atomic_add_fetch(&(cls->total_usec), usec, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&(cls->served), 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&(cls->pending), 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Passa un'operazione su file ad un thread di I/O.
+ *
+ * Da qui il fd appartiene al thread di I/O: in modalità reactor viene tolto
+ * dalla epoll del worker, che altrimenti continuerebbe a servirlo.
+ *
+ * @param fd Il fd del client
+ * @param workerNumber Il numero del worker
+ * @param msg La richiesta
+ * @param start Quando la richiesta è stata letta
+ */
+static void handOffFile(int fd, int workerNumber, message_t* msg, struct timespec* start) {
+	if (DispatchMode == DISPATCH_REACTOR) {
+		if (epoll_ctl(WORKER_EPOLLFD(workerNumber), EPOLL_CTL_DEL, fd, NULL) < 0) {
+			perror("togliendo un client dalla epoll del worker");
+		}
+		__atomic_sub_fetch(worker_load + workerNumber, 1, __ATOMIC_RELAXED);
+	}
+	file_jobs[fd].msg = *msg;
+	file_jobs[fd].start = *start;
+	#if defined DEBUG && defined VERBOSE
+		fprintf(stderr, "%d: fd %d passato ai thread di I/O\n", workerNumber, fd);
+	#endif
+	ts_push(&file_queue, fd);
+}
+
+/**
+ * @brief Restituisce al listener un fd che il worker ha finito di servire.
+ *
+ * Il fd viene inserito nella coda del worker e il listener viene svegliato
+ * tramite il suo eventfd solo se non c'è già un risveglio in sospeso, così più
+ * restituzioni ravvicinate costano una sola write.
+ *
+ * @param workerNumber Il numero del worker che restituisce il fd (per i thread
+ *                     di I/O, ThreadsInPool più il loro numero)
+ * @param fd Il fd da restituire
+ */
+static void returnFd(int workerNumber, int fd) {
+	// L'eventfd del listener è sempre su fd 4
+	const int wakeupfd = 4;
+	// Non può fallire: ogni fd si trova al più in una coda alla volta e
+	// ognuna ha almeno MaxConnections posti
+	bool pushed = spsc_push(returned_fds + workerNumber, fd);
+	assert(pushed);
+	(void)pushed;
+	if (__atomic_exchange_n(&listener_wakeup_pending, 1, __ATOMIC_SEQ_CST) == 0) {
+		while (eventfd_write(wakeupfd, 1) < 0) {
+			perror("write, svegliando il listener, riprovo");
+		}
+	}
+}
+
+/**
+ * @brief Inserisce un fd in fondo alla deque del worker in modalità stealing
+ *
+ * Se nella deque c'è altro lavoro oltre a quello che il worker sta per
+ * prendere, sveglia un worker addormentato perché venga a rubarlo.
+ *
+ * @param workerNumber Il numero del worker proprietario della deque
+ * @param fd Il fd da inserire
+ */
+static void pushOwnFd(int workerNumber, int fd) {
+	worker_queues_t* self = worker_queues + workerNumber;
+	// Non può fallire per lo stesso motivo di returnFd
+	bool pushed = deque_push(&(self->deque), fd);
+	assert(pushed);
+	(void)pushed;
+	__atomic_add_fetch(worker_load + workerNumber, 1, __ATOMIC_RELAXED);
+	if (deque_size(&(self->deque)) > 1) {
+		for (int i = 1; i < ThreadsInPool; ++i) {
+			if (wake_worker((workerNumber + i) % ThreadsInPool)) {
+				break;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Cerca un fd da servire per un worker in modalità stealing
+ *
+ * Sposta nella deque i fd arrivati dal listener, poi estrae dal fondo della
+ * propria deque (ogni STEALING_FAIRNESS_INTERVAL volte dalla cima) e, se è
+ * vuota, prova a rubare dagli altri worker.
+ *
+ * @param workerNumber Il numero del worker
+ * @param served Numero di fd serviti finora dal worker
+ * @param fd Puntatore su cui viene scritto il fd trovato
+ * @return true se ha trovato un fd da servire
+ */
+static bool findWork(int workerNumber, unsigned int served, int* fd) {
+	worker_queues_t* self = worker_queues + workerNumber;
+	int newfd;
+	while (spsc_pop(&(self->inbox), &newfd)) {
+		// Il carico è già stato contato dal listener
+		__atomic_sub_fetch(worker_load + workerNumber, 1, __ATOMIC_RELAXED);
+		pushOwnFd(workerNumber, newfd);
+	}
+	if ((served % STEALING_FAIRNESS_INTERVAL == STEALING_FAIRNESS_INTERVAL - 1
+			&& deque_steal(&(self->deque), fd))
+		|| deque_pop(&(self->deque), fd)) {
+		__atomic_sub_fetch(worker_load + workerNumber, 1, __ATOMIC_RELAXED);
+		return true;
+	}
+	for (int i = 1; i < ThreadsInPool; ++i) {
+		int victim = (workerNumber + i) % ThreadsInPool;
+		if (deque_steal(&(worker_queues[victim].deque), fd)) {
+			__atomic_sub_fetch(worker_load + victim, 1, __ATOMIC_RELAXED);
+			#if defined DEBUG && defined VERBOSE
+				fprintf(stderr, "%d: rubato fd %d dal worker %d\n", workerNumber, *fd, victim);
+			#endif
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Addormenta un worker in modalità stealing finché non c'è lavoro
+ *
+ * Il worker si segna come addormentato prima di ricontrollare le code: chi
+ * rende disponibile del lavoro dopo quel controllo vede il flag e lo sveglia
+ * (vedere wake_worker).
+ *
+ * @param workerNumber Il numero del worker
+ */
+static void waitForWork(int workerNumber) {
+	worker_queues_t* self = worker_queues + workerNumber;
+	int key = __atomic_load_n(&(self->wake_seq), __ATOMIC_ACQUIRE);
+	__atomic_store_n(&(self->sleeping), 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	bool work = !__atomic_load_n(&threads_continue, __ATOMIC_RELAXED)
+		|| !spsc_is_empty(&(self->inbox));
+	for (int i = 0; i < ThreadsInPool && !work; ++i) {
+		work = deque_size(&(worker_queues[i].deque)) > 0;
+	}
+	if (!work) {
+		futex_wait(&(self->wake_seq), key);
+	}
+	__atomic_store_n(&(self->sleeping), 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Legge una richiesta da un client e la esegue, rispondendo al client.
+ *
+ * Il fd passato deve essere gestito in esclusiva dal worker chiamante per
+ * tutta la durata della funzione. Se la richiesta non è ancora arrivata tutta
+ * la parte letta resta in fd_readers e la funzione ritorna senza bloccarsi.
+ *
+ * @param localfd Il fd del client da cui leggere la richiesta
+ * @param workerNumber Il numero del worker che esegue la richiesta
+ * @return CLIENT_CLOSED se la connessione con il client è stata chiusa,
+ *         CLIENT_BUSY se ha eseguito una richiesta, CLIENT_IDLE se non c'era
+ *         una richiesta completa da leggere
+ */
+static client_state_t serveRequest(int localfd, int workerNumber) {
+	message_t msg;
+	msg.data.buf = NULL;
+	bool fdclose = false;
+	// Le comunicazioni iniziano sempre con un messaggio
+	int readResult = readMsgNonBlocking(localfd, fd_readers + localfd, &msg);
+	if (readResult < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return CLIENT_IDLE;
+		}
+		else if (errno == ECONNRESET) {
+			#ifdef DEBUG
+				fprintf(stderr, "%d: un client è crashato (fd %d)\n", workerNumber, localfd);
+			#endif
+			disconnectClient(localfd);
+			fdclose = true;
+		}
+		else {
+			perror("leggendo un messaggio");
+			return CLIENT_IDLE;
+		}
+	}
+	else if (readResult == 0) {
+		// Client disconnesso
+		disconnectClient(localfd);
+		fdclose = true;
+	}
+	else {
+		message_t response;
+		nickname_t* sender;
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		op_class_stats_t* cls = msg.hdr.op == POSTFILE_OP || msg.hdr.op == GETFILE_OP
+			? &file_class_stats : &msg_class_stats;
+		classEnter(cls);
+		switch (msg.hdr.op) {
+			case REGISTER_OP: {
+				#ifdef DEBUG
+					fprintf(stderr, "%d: Ricevuta REGISTER_OP\n", workerNumber);
+				#endif
+				if ((sender = ts_hash_insert(nickname_htable, msg.hdr.sender)) == NULL) {
+					// Nickname già esistente
+					#ifdef DEBUG
+						fprintf(stderr, "%d: Nickname %s già esistente!\n", workerNumber, msg.hdr.sender);
+					#endif
+					sendFatalFailResponse(response, localfd, OP_NICK_ALREADY);
+					fdclose = true;
+				}
+				else {
+					// Appena inserito il nickname è visibile a tutti: va
+					// occupato come in CONNECT_OP, perché un altro client
+					// potrebbe essersi già connesso (o averlo deregistrato)
+					error_handling_lock(&(sender->mutex));
+					// I messaggi a tutti inviati prima della registrazione
+					// non lo riguardano
+					sender->bcast_cursor = __atomic_load_n(&msg_seq, __ATOMIC_RELAXED);
+					if (sender->removed || sender->fd != 0) {
+						error_handling_unlock(&(sender->mutex));
+						#ifdef DEBUG
+							fprintf(stderr, "%d: Nickname %s occupato da un altro client!\n", workerNumber, msg.hdr.sender);
+						#endif
+						sendFatalFailResponse(response, localfd, OP_NICK_ALREADY);
+						fdclose = true;
+					}
+					else {
+						// Situazione normale
+						sender->fd = localfd;
+						error_handling_unlock(&(sender->mutex));
+						#ifdef DEBUG
+							fprintf(stderr, "%d: Registrato il nickname \"%s\"\n", workerNumber, msg.hdr.sender);
+						#endif
+						error_handling_lock(&connected_mutex);
+						connectClient(msg.hdr.sender, localfd, sender);
+						error_handling_unlock(&connected_mutex);
+						if (responseConnectedList(&response)) {
+							fdclose = sendMsgResponse(localfd, &response);
+						}
+						else {
+							sendSoftFailResponse(response, localfd, OP_FAIL, fdclose);
 						}
 					}
 				}
-				break;
-				case GETPREVMSGS_OP: {
+			}
+			break;
+			case UNREGISTER_OP: {
+				#ifdef DEBUG
+					fprintf(stderr, "%d: Ricevuta UNREGISTER_OP\n", workerNumber);
+				#endif
+				fdclose = (sender = checkConnected(msg.hdr.sender, localfd)) == NULL;
+				if (!fdclose) {
+					// Client regolare
 					#ifdef DEBUG
-						fprintf(stderr, "%d: Ricevuta GETPREVMSGS_OP\n", workerNumber);
+						fprintf(stderr, "%d: Deregistro il nickname \"%s\"\n", workerNumber, msg.hdr.sender);
 					#endif
-					fdclose = !checkConnected(msg.hdr.sender, localfd, sender = hash_find(nickname_htable, msg.hdr.sender));
-					if (!fdclose) {
-						// Client regolare, situazione normale
-						setHeader(&response.hdr, OP_OK, "");
-						error_handling_lock(&(sender->mutex));
-						size_t nmsgs = history_len(sender);
-						setData(&response.data, "", (char*)&nmsgs, sizeof(size_t));
-						fdclose = sendMsgResponse(localfd, &response);
-						if (!fdclose) {
-							int i;
-							message_t* curr_msg;
-							history_foreach(sender, i, curr_msg) {
-								if (sendMsgResponse(localfd, curr_msg)) {
-									fdclose = true;
-									break;
-								}
-							}
-						}
+					setHeader(&response.hdr, OP_OK, "");
+					sendHdrResponse(localfd, &response.hdr);
+					// Da qui nessuna CONNECT_OP può più usare il nickname,
+					// neanche quando il client si disconnette
+					error_handling_lock(&(sender->mutex));
+					sender->removed = true;
+					error_handling_unlock(&(sender->mutex));
+					// Un client che deregistra un nick non può restare
+					// connesso con quel nickname
+					disconnectClient(localfd);
+					fdclose = true;
+					ts_hash_remove(nickname_htable, msg.hdr.sender);
+				}
+			}
+			break;
+			case CONNECT_OP: {
+				#ifdef DEBUG
+					fprintf(stderr, "%d: Ricevuta CONNECT_OP\n", workerNumber);
+				#endif
+				if ((sender = hash_find(nickname_htable, msg.hdr.sender)) != NULL) {
+					error_handling_lock(&(sender->mutex));
+					if (sender->removed) {
+						// Nickname deregistrato mentre lo si cercava
+						error_handling_unlock(&(sender->mutex));
+						sendFatalFailResponse(response, localfd, OP_NICK_UNKNOWN);
+						fdclose = true;
+					}
+					else if (sender->fd != 0) {
+						// Nickname già connesso
+						error_handling_unlock(&(sender->mutex));
+						#ifdef DEBUG
+							fprintf(stderr, "%d: Nick \"%s\" già connesso!\n", workerNumber, msg.hdr.sender);
+						#endif
+						sendFatalFailResponse(response, localfd, OP_NICK_CONN);
+						fdclose = true;
+					}
+					else {
+						// Situazione normale. Il nickname viene occupato
+						// subito, nella stessa sezione del controllo, così
+						// non può essere deregistrato né connesso da un altro
+						// client prima di connectClient
+						sender->fd = localfd;
 						error_handling_unlock(&(sender->mutex));
+						#ifdef DEBUG
+							fprintf(stderr, "%d: Connesso \"%s\" (fd %d)\n", workerNumber, msg.hdr.sender, localfd);
+						#endif
+						error_handling_lock(&connected_mutex);
+						connectClient(msg.hdr.sender, localfd, sender);
+						error_handling_unlock(&connected_mutex);
+						if (responseConnectedList(&response)) {
+							fdclose = sendMsgResponse(localfd, &response);
+						}
+						else {
+							sendSoftFailResponse(response, localfd, OP_FAIL, fdclose);
+						}
 					}
 				}
-				break;
-				case POSTFILE_OP: {
+				else {
+					// Nickname inesistente
 					#ifdef DEBUG
-						fprintf(stderr, "%d: Ricevuta POSTFILE_OP\n", workerNumber);
+						fprintf(stderr, "%d: Richiesta di connessione di un nickname inesistente\n", workerNumber);
 					#endif
-					fdclose = !checkConnected(msg.hdr.sender, localfd, hash_find(nickname_htable, msg.hdr.sender));
-					if (!fdclose) {
-						// Client regolare
+					sendFatalFailResponse(response, localfd, OP_NICK_UNKNOWN);
+					fdclose = true;
+				}
+			}
+			break;
+			case DISCONNECT_OP: {
+				#ifdef DEBUG
+					fprintf(stderr, "%d: Ricevuta DISCONNECT_OP\n", workerNumber);
+					fprintf(stderr, "%d: Disconnessione fd %d (\"%s\")\n", workerNumber, localfd, fd_sessions[localfd].name);
+				#endif
+				disconnectClient(localfd);
+				fdclose = true;
+			}
+			break;
+			case USRLIST_OP: {
+				#ifdef DEBUG
+					fprintf(stderr, "%d: Ricevuta USRLIST_OP\n", workerNumber);
+				#endif
+				if (responseConnectedList(&response)) {
+					fdclose = sendMsgResponse(localfd, &response);
+				}
+				else {
+					sendSoftFailResponse(response, localfd, OP_FAIL, fdclose);
+				}
+			}
+			break;
+			case USRLIST_SINCE_OP: {
+				#ifdef DEBUG
+					fprintf(stderr, "%d: Ricevuta USRLIST_SINCE_OP\n", workerNumber);
+				#endif
+				fdclose = respondPresence(localfd, &msg, false);
+			}
+			break;
+			case PRESENCE_SUB_OP: {
+				#ifdef DEBUG
+					fprintf(stderr, "%d: Ricevuta PRESENCE_SUB_OP\n", workerNumber);
+				#endif
+				fdclose = (sender = checkConnected(msg.hdr.sender, localfd)) == NULL;
+				if (!fdclose) {
+					// Client regolare
+					fdclose = respondPresence(localfd, &msg, true);
+				}
+			}
+			break;
+			case POSTTXT_OP: {
+				#ifdef DEBUG
+					fprintf(stderr, "%d: Ricevuta POSTTXT_OP\n", workerNumber);
+				#endif
+				fdclose = (sender = checkConnected(msg.hdr.sender, localfd)) == NULL;
+				if (!fdclose) {
+					// Client regolare
+					if (!checkMsg(&msg)) {
+						// Messaggio invalido
+						sendSoftFailResponse(response, localfd, OP_MSG_INVALID, fdclose);
+					}
+					else if (msg.data.hdr.len > MaxMsgSize) {
+						// Messaggio troppo lungo
+						sendSoftFailResponse(response, localfd, OP_MSG_TOOLONG, fdclose);
+					}
+					else {
 						nickname_t* receiver = hash_find(nickname_htable, msg.data.hdr.receiver);
 						if (receiver == NULL) {
 							// Destinatario inesistente
@@ -499,171 +1172,278 @@ void* worker_thread(void* arg) {
 						}
 						else {
 							// Situazione normale
-							// Crea e apre il file (così se succedono errori può
-							// esplodere subito)
-							message_data_t file;
-							file.buf = NULL;
-							char* full_filename = malloc(strlen(DirName) + msg.data.hdr.len);
-							strncpy(full_filename, DirName, strlen(DirName));
-							strncpy(full_filename + strlen(DirName), msg.data.buf, msg.data.hdr.len);
-							#ifdef DEBUG
-								fprintf(stderr, "%d: salvo il file \"%s\"\n", workerNumber, full_filename);
-							#endif
-							int filefd = open(full_filename, O_WRONLY | O_CREAT, 0755);
-							if (filefd < 0
-								|| dup2(filefd, MaxConnections + workerNumber) < 0) {
-								perror("aprendo il file");
-								sendSoftFailResponse(response, localfd, OP_FAIL, fdclose);
+							msg.hdr.op = TXT_MESSAGE;
+							error_handling_lock(&(receiver->mutex));
+							add_to_history(receiver, copyMsg(&msg), nextSeq());
+							if (receiver->fd > 0 && deliverMsg(receiver, &msg)) {
+								error_handling_unlock(&(receiver->mutex));
+								increaseStat(ndelivered);
 							}
-							// Scarica il file
 							else {
-								close(filefd);
-								if (readData(localfd, &file) <= 0) {
-									perror("scaricando un file");
-									sendSoftFailResponse(response, localfd, OP_FAIL, fdclose);
-								}
-								// Salva il file
-								else if (file.hdr.len > MaxFileSize * FILE_SIZE_FACTOR) {
-									// File troppo grosso
-									sendSoftFailResponse(response, localfd, OP_MSG_TOOLONG, fdclose);
-								}
-								else if (write(MaxConnections + workerNumber, file.buf, file.hdr.len) < 0) {
-									perror("writing to output file");
-									sendSoftFailResponse(response, localfd, OP_FAIL, fdclose);
-								}
-								else {
-									// È andato tutto bene
-									msg.hdr.op = FILE_MESSAGE;
-									error_handling_lock(&(receiver->mutex));
-									add_to_history(receiver, msg);
-									if (receiver->fd > 0) {
-										// Non fa gestione dell'errore perché se non
-										// riesce ad inviare è un problema del client,
-										// il server se lo tiene nell'history e poi sarà
-										// il client a chiedergli di nuovo il messaggio.
-										sendRequest(receiver->fd, &msg);
-										// Non aumenta i file consegnati perché
-										// viene fatto quando finisce GETFILE_OP
-										error_handling_unlock(&(receiver->mutex));
-									}
-									else {
-										error_handling_unlock(&(receiver->mutex));
-										increaseStat(nfilenotdelivered);
-									}
-									// Mette a NULL in modo che non venga deallocato
-									msg.data.buf = NULL;
-									setHeader(&response.hdr, OP_OK, "");
-									fdclose = sendHdrResponse(localfd, &response.hdr);
-								}
-								close(MaxConnections + workerNumber);
-								free(full_filename);
-								if (file.buf != NULL) {
-									free(file.buf);
-								}
+								error_handling_unlock(&(receiver->mutex));
+								increaseStat(nnotdelivered);
 							}
+							setHeader(&response.hdr, OP_OK, "");
+							fdclose = sendHdrResponse(localfd, &response.hdr);
 						}
 					}
 				}
-				break;
-				case GETFILE_OP: {
-					#ifdef DEBUG
-						fprintf(stderr, "%d: Ricevuta GETFILE_OP\n", workerNumber);
-					#endif
-					fdclose = !checkConnected(msg.hdr.sender, localfd, hash_find(nickname_htable, msg.hdr.sender));
-					if (!fdclose) {
-						// Client regolare
-						char* mappedfile = NULL;
-						struct stat st;
-						// Apre il file
-						char* full_filename = malloc(strlen(DirName) + msg.data.hdr.len);
-						strncpy(full_filename, DirName, strlen(DirName));
-						strncpy(full_filename + strlen(DirName), msg.data.buf, msg.data.hdr.len);
-						#ifdef DEBUG
-							fprintf(stderr, "%d: apro il file \"%s\"\n", workerNumber, full_filename);
-						#endif
-						int filefd = open(full_filename, O_RDONLY);
-						if (filefd < 0) {
-							if (errno == EACCES) {
-								// File inesistente
-								#ifdef DEBUG
-									fprintf(stderr, "%d: il file richiesto non esiste\n", workerNumber);
-								#endif
-								sendSoftFailResponse(response, localfd, OP_NO_SUCH_FILE, fdclose);
-							}
-							else {
-								perror("aprendo il file");
-								sendSoftFailResponse(response, localfd, OP_FAIL, fdclose);
+			}
+			break;
+			case POSTTXTALL_OP: {
+				#ifdef DEBUG
+				fprintf(stderr, "%d: Ricevuta POSTTXTALL_OP\n", workerNumber);
+				#endif
+				fdclose = (sender = checkConnected(msg.hdr.sender, localfd)) == NULL;
+				if (!fdclose) {
+					// Client regolare
+					if (!checkMsg(&msg)) {
+						// Messaggio invalido
+						sendSoftFailResponse(response, localfd, OP_MSG_INVALID, fdclose);
+					}
+					else {
+						// Situazione normale
+						// Il messaggio viene salvato una sola volta nel
+						// registro dei messaggi a tutti, da cui lo legge
+						// GETPREVMSGS_OP, e inviato subito solo ai client
+						// connessi: il costo non dipende dal numero di
+						// nickname registrati
+						msg.hdr.op = TXT_MESSAGE;
+						message_t shared = copyMsg(&msg);
+						error_handling_lock(&(broadcasts.mutex));
+						bcast_append(&broadcasts, shared, nextSeq());
+						// Il registro può rilasciare il buffer appena
+						// si sblocca: per le consegne serve un altro
+						// riferimento
+						msgbuf_ref(shared.data.buf);
+						error_handling_unlock(&(broadcasts.mutex));
+						int delivered = 0;
+						error_handling_lock(&connected_mutex);
+						int registered = hash_count(nickname_htable);
+						for (int fd = 0; fd < MaxConnections; ++fd) {
+							nickname_t* val = fd_sessions[fd].nick;
+							if (val != NULL) {
+								error_handling_lock(&(val->mutex));
+								if (val->fd > 0 && deliverMsg(val, &shared)) {
+									++delivered;
+								}
+								error_handling_unlock(&(val->mutex));
 							}
 						}
-						else if (dup2(filefd, MaxConnections + workerNumber) < 0) {
-							perror("aprendo il file");
-							close(filefd);
-							sendSoftFailResponse(response, localfd, OP_FAIL, fdclose);
+						error_handling_unlock(&connected_mutex);
+						msgbuf_unref(shared.data.buf);
+						addStat(ndelivered, delivered);
+						addStat(nnotdelivered, registered - delivered);
+						setHeader(&response.hdr, OP_OK, "");
+						fdclose = sendHdrResponse(localfd, &response.hdr);
+					}
+				}
+			}
+			break;
+			case GETPREVMSGS_OP: {
+				#ifdef DEBUG
+					fprintf(stderr, "%d: Ricevuta GETPREVMSGS_OP\n", workerNumber);
+				#endif
+				fdclose = (sender = checkConnected(msg.hdr.sender, localfd)) == NULL;
+				if (!fdclose) {
+					// Client regolare, situazione normale
+					setHeader(&response.hdr, OP_OK, "");
+					error_handling_lock(&(sender->mutex));
+					error_handling_lock(&(broadcasts.mutex));
+					// Unisce, dal più recente, l'history e i messaggi a
+					// tutti inviati dopo la registrazione, fino a riempire
+					// una history. La risposta e tutti i messaggi vengono
+					// inviati insieme; quello che non sta nel socket viene
+					// copiato nella coda di uscita, quindi le lock possono
+					// essere rilasciate prima di aspettare che il client legga
+					message_t* batch[MaxHistMsgs + 1];
+					int nbatch = 1;
+					int np = 0, nb = 0;
+					unsigned long pseq, bseq;
+					message_t* pmsg = history_nth(sender, np, &pseq);
+					message_t* bmsg = bcast_nth(&broadcasts, nb, &bseq);
+					if (bmsg != NULL && bseq < sender->bcast_cursor) {
+						bmsg = NULL;
+					}
+					while (nbatch <= MaxHistMsgs && (pmsg != NULL || bmsg != NULL)) {
+						if (bmsg == NULL || (pmsg != NULL && pseq > bseq)) {
+							batch[nbatch++] = pmsg;
+							pmsg = history_nth(sender, ++np, &pseq);
 						}
-						// Legge la lunghezza del file
 						else {
-							close(filefd);
-							if (stat(full_filename, &st) < 0) {
-								perror("stat");
-								sendSoftFailResponse(response, localfd, OP_FAIL, fdclose);
-							}
-							else if (!S_ISREG(st.st_mode)) {
-								fprintf(stderr, "ERRORE: il file %s non e' un file regolare\n", msg.data.buf);
-								sendSoftFailResponse(response, localfd, OP_FAIL, fdclose);
-							}
-							// Legge il file in memoria
-							else if ((mappedfile = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, MaxConnections + workerNumber, 0)) == MAP_FAILED) {
-								perror("mmap");
-								fprintf(stderr, "ERRORE: mappando il file %s in memoria\n", msg.data.buf);
-								sendSoftFailResponse(response, localfd, OP_FAIL, fdclose);
-							}
-							else {
-								// È andato tutto bene
-								setHeader(&response.hdr, OP_OK, "");
-								setData(&response.data, "", mappedfile, st.st_size);
-								fdclose = sendMsgResponse(localfd, &response);
-								increaseStat(nfiledelivered);
-							}
-							close(MaxConnections + workerNumber);
-							free(full_filename);
-							if (mappedfile != NULL) {
-								if (munmap(mappedfile, st.st_size) < 0) {
-									perror("errore durante munmap del file");
-									exit(EXIT_FAILURE);
-								}
+							batch[nbatch++] = bmsg;
+							bmsg = bcast_nth(&broadcasts, ++nb, &bseq);
+							if (bmsg != NULL && bseq < sender->bcast_cursor) {
+								bmsg = NULL;
 							}
 						}
 					}
+					size_t nmsgs = nbatch - 1;
+					setData(&response.data, "", (char*)&nmsgs, sizeof(size_t));
+					batch[0] = &response;
+					ssize_t pending = queueMsgs(localfd, batch, nbatch);
+					error_handling_unlock(&(broadcasts.mutex));
+					error_handling_unlock(&(sender->mutex));
+					fdclose = handleResponse(localfd, pending);
 				}
-				break;
-				default: {
-					#ifdef DEBUG
-						fprintf(stderr, "%d: Ricevuta operazione sconosciuta\n", workerNumber);
-					#endif
-					sendSoftFailResponse(response, localfd, OP_FAIL, fdclose);
+			}
+			break;
+			case POSTFILE_OP:
+			case GETFILE_OP: {
+				#ifdef DEBUG
+					fprintf(stderr, "%d: Ricevuta %s\n", workerNumber,
+						msg.hdr.op == POSTFILE_OP ? "POSTFILE_OP" : "GETFILE_OP");
+				#endif
+				fdclose = (sender = checkConnected(msg.hdr.sender, localfd)) == NULL;
+				if (!fdclose) {
+					// Client regolare
+					if (FileThreadsInPool > 0) {
+						// Il trasferimento lo fa un thread di I/O
+						handOffFile(localfd, workerNumber, &msg, &start);
+						return CLIENT_HANDED_OFF;
+					}
+					fdclose = msg.hdr.op == POSTFILE_OP
+						? postFile(localfd, &msg, MaxConnections + workerNumber)
+						: getFile(localfd, &msg);
 				}
-				break;
 			}
+			break;
+			default: {
+				#ifdef DEBUG
+					fprintf(stderr, "%d: Ricevuta operazione sconosciuta\n", workerNumber);
+				#endif
+				sendSoftFailResponse(response, localfd, OP_FAIL, fdclose);
+			}
+			break;
 		}
-		if (msg.data.buf != NULL) {
-			free(msg.data.buf);
+		classExit(cls, &start);
+	}
+	// msg.data.buf punta nel buffer di ricezione, non va liberato
+	return fdclose ? CLIENT_CLOSED : CLIENT_BUSY;
+}
+
+/**
+ * @brief Smette di servire un client che non legge le sue risposte
+ *
+ * Se durante la richiesta la coda di uscita del client ha superato
+ * OutQueueHighWater (e non è nel frattempo scesa sotto OutQueueLowWater) il fd
+ * viene parcheggiato: nessun thread lo serve finché il listener non svuota la
+ * coda, e flush_out_queue lo restituisce ai worker. Così un client che invia
+ * richieste senza leggere le risposte non blocca nessun thread.
+ *
+ * @param fd Il fd del client
+ * @param epollfd In modalità reactor la epoll del worker, da cui il fd va
+ *                tolto prima di parcheggiarlo; -1 altrimenti
+ * @param workerNumber Il numero del worker (ignorato se epollfd è -1)
+ * @return true se il fd è stato parcheggiato: da qui non appartiene più al
+ *         chiamante
+ */
+static bool parkClient(int fd, int epollfd, int workerNumber) {
+	out_queue_t* q = fd_outqueues + fd;
+	if (!q->park_requested) {
+		return false;
+	}
+	q->park_requested = false;
+	// Il fd va tolto dalla epoll prima di essere parcheggiato, perché il
+	// listener potrebbe subito passarlo ad un altro worker
+	if (epollfd >= 0 && epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL) < 0) {
+		perror("togliendo un client dalla epoll del worker");
+		return false;
+	}
+	error_handling_lock(&(q->mutex));
+	bool park = q->writer.pending > (size_t)OutQueueLowWater * OUT_QUEUE_SIZE_FACTOR;
+	q->parked = park;
+	error_handling_unlock(&(q->mutex));
+	if (epollfd >= 0) {
+		if (park) {
+			__atomic_sub_fetch(worker_load + workerNumber, 1, __ATOMIC_RELAXED);
+		}
+		else {
+			// La coda si è già svuotata: il client resta a questo worker
+			struct epoll_event ev;
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.fd = fd;
+			if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+				perror("riassegnando un client al worker");
+			}
+		}
+	}
+	#if defined DEBUG && defined VERBOSE
+		if (park) {
+			fprintf(stderr, "fd %d parcheggiato finché non legge le risposte\n", fd);
+		}
+	#endif
+	return park;
+}
+
+/**
+ * @brief Serve le richieste già inviate da un client, fino a MaxMsgsPerWakeup
+ *
+ * Invece di tornare al listener dopo ogni messaggio il worker continua a
+ * leggere dallo stesso fd finché la read non si bloccherebbe, così un client
+ * che invia molte richieste di fila le vede servite tutte in un solo giro. Il
+ * limite evita che un singolo client tenga occupato il worker troppo a lungo.
+ *
+ * @param localfd Il fd del client
+ * @param workerNumber Il numero del worker
+ * @return CLIENT_CLOSED se la connessione è stata chiusa, CLIENT_IDLE se non
+ *         ci sono altre richieste da leggere, CLIENT_BUSY se il limite è stato
+ *         raggiunto e il client potrebbe averne inviate altre, CLIENT_PARKED se
+ *         il client non legge le sue risposte (vedere parkClient)
+ */
+static client_state_t serveClient(int localfd, int workerNumber) {
+	for (int i = 0; i < MaxMsgsPerWakeup; ++i) {
+		// I nickname_t trovati con hash_find (o nelle sessioni degli altri
+		// client) restano validi per tutta la richiesta, anche se nel
+		// frattempo vengono deregistrati. Le risposte non bloccano mai (al
+		// più il client viene parcheggiato), postFile esce dalla sezione
+		// mentre riceve il file
+		epoch_enter();
+		client_state_t state = serveRequest(localfd, workerNumber);
+		epoch_exit();
+		if ((state == CLIENT_BUSY || state == CLIENT_IDLE)
+			&& parkClient(localfd, DispatchMode == DISPATCH_REACTOR
+				? WORKER_EPOLLFD(workerNumber) : -1, workerNumber)) {
+			return CLIENT_PARKED;
 		}
-		// Finita la richiesta segnala al listener che il fd è di nuovo libero
-		// se non ha chiuso la connessione
+		if (state != CLIENT_BUSY) {
+			return state;
+		}
+	}
+	#if defined DEBUG && defined VERBOSE
+		fprintf(stderr, "%d: esaurite le richieste per il fd %d\n", workerNumber, localfd);
+	#endif
+	return CLIENT_BUSY;
+}
+
+// ------------------------- funzioni esportate -----------------------
+
+// Documentata in worker.h
+void* worker_thread(void* arg) {
+	int workerNumber = *(int*)arg;
+
+	while(threads_continue) {
+		int localfd = ts_pop(&queue);
+		if (localfd == TERMINATION_FD) {
+			// Ha ricevuto il fd falso passato dal signal_handler_thread
+			break;
+		}
+		client_state_t state = serveClient(localfd, workerNumber);
+		// Finite le richieste segnala al listener che il fd è di nuovo libero
+		// se non ha chiuso la connessione. Se il client ne ha ancora da
+		// servire il fd torna invece direttamente in fondo alla coda.
 		#ifdef DEBUG
 			fprintf(stderr, "%d: Operazione gestita\n", workerNumber);
 		#endif
-		if (!fdclose) {
+		if (state == CLIENT_BUSY) {
+			ts_push(&queue, localfd);
+		}
+		else if (state == CLIENT_IDLE) {
 			#if defined DEBUG && defined VERBOSE
 				fprintf(stderr, "%d: fd non chiuso, comunicazione con il listener\n", workerNumber);
 			#endif
-			while(freefd_ack[workerNumber] == 1) {
-				pthread_kill(signal_handler, SIGUSR2);
-				sched_yield();
-			}
-			freefd[workerNumber] = localfd;
-			freefd_ack[workerNumber] = 1;
-			pthread_kill(signal_handler, SIGUSR2);
+			returnFd(workerNumber, localfd);
 			#if defined DEBUG && defined VERBOSE
 				fprintf(stderr, "%d: Restituito l'fd al listener\n", workerNumber);
 			#endif
@@ -672,3 +1452,196 @@ void* worker_thread(void* arg) {
 
 	return NULL;
 }
+
+// Documentata in worker.h
+void* file_thread(void* arg) {
+	int fileThreadNumber = *(int*)arg;
+
+	while (threads_continue) {
+		int localfd = ts_pop(&file_queue);
+		if (localfd == TERMINATION_FD) {
+			break;
+		}
+		file_job_t* job = file_jobs + localfd;
+		// postFile esce dalla sezione mentre riceve il file
+		epoch_enter();
+		bool fdclose = job->msg.hdr.op == POSTFILE_OP
+			? postFile(localfd, &(job->msg), FILE_THREAD_FD(fileThreadNumber))
+			: getFile(localfd, &(job->msg));
+		epoch_exit();
+		// Dopo la restituzione il fd potrebbe avere subito un'altra operazione
+		classExit(&file_class_stats, &(job->start));
+		#ifdef DEBUG
+			fprintf(stderr, "I/O %d: Operazione su file gestita\n", fileThreadNumber);
+		#endif
+		// Il fd non è in nessuna epoll: in modalità reactor l'ha tolto
+		// handOffFile
+		if (!fdclose && !parkClient(localfd, -1, -1)) {
+			// Le code dei thread di I/O seguono quelle dei worker
+			returnFd(ThreadsInPool + fileThreadNumber, localfd);
+		}
+	}
+
+	return NULL;
+}
+
+// Documentata in worker.h
+bool wake_worker(int workerNumber) {
+	worker_queues_t* q = worker_queues + workerNumber;
+	// Ordina la pubblicazione del lavoro prima della lettura di sleeping
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&(q->sleeping), __ATOMIC_RELAXED)) {
+		__atomic_add_fetch(&(q->wake_seq), 1, __ATOMIC_RELEASE);
+		futex_wake(&(q->wake_seq), 1);
+		return true;
+	}
+	return false;
+}
+
+// Documentata in worker.h
+bool flush_out_queue(int fd) {
+	out_queue_t* q = fd_outqueues + fd;
+	error_handling_lock(&(q->mutex));
+	ssize_t pending = flushWriter(fd, &(q->writer));
+	if (pending < 0) {
+		// Il client si è disconnesso: il fd lo chiude il worker che lo serve
+		// quando legge la fine della connessione (se è parcheggiato, dopo
+		// averlo ricevuto da qui)
+		resetWriter(&(q->writer));
+	}
+	else if (pending > 0) {
+		armOutQueue(fd, q);
+	}
+	bool resume = q->parked
+		&& pending <= (ssize_t)OutQueueLowWater * OUT_QUEUE_SIZE_FACTOR;
+	if (resume) {
+		q->parked = false;
+	}
+	error_handling_unlock(&(q->mutex));
+	return resume;
+}
+
+// Documentata in worker.h
+void* reactor_thread(void* arg) {
+	int workerNumber = *(int*)arg;
+	const int epollfd = WORKER_EPOLLFD(workerNumber);
+	worker_queues_t* self = worker_queues + workerNumber;
+	struct epoll_event events[2 * WORKER_MAX_EVENTS];
+	// Client che hanno esaurito il limite di richieste con altri messaggi già
+	// nel buffer di ricezione: la epoll non li segnalerebbe più, quindi
+	// vengono ripresi al giro successivo
+	int busy[WORKER_MAX_EVENTS];
+	int nbusy = 0;
+
+	while(threads_continue) {
+		int nready = epoll_wait(epollfd, events, WORKER_MAX_EVENTS, nbusy > 0 ? 0 : -1);
+		if (nready < 0) {
+			if (errno != EINTR) {
+				perror("epoll_wait di un worker");
+			}
+			continue;
+		}
+		// Aggiunge ai client da servire quelli rimasti dal giro precedente
+		// che la epoll non ha già restituito
+		int nserve = nready;
+		for (int b = 0; b < nbusy; ++b) {
+			bool found = false;
+			for (int e = 0; e < nready && !found; ++e) {
+				found = events[e].data.fd == busy[b];
+			}
+			if (!found) {
+				events[nserve++].data.fd = busy[b];
+			}
+		}
+		nbusy = 0;
+		// Client restituiti dai thread di I/O: vengono serviti subito, perché
+		// potrebbero avere richieste già nel buffer di ricezione che la epoll
+		// non segnalerebbe, e poi tornano nella epoll
+		for (int e = 0; e < nready; ++e) {
+			if (events[e].data.fd == self->wakefd) {
+				eventfd_t wakeups;
+				if (eventfd_read(self->wakefd, &wakeups) < 0) {
+					perror("leggendo l'eventfd di un worker");
+				}
+				int fd;
+				while (nserve < 2 * WORKER_MAX_EVENTS && spsc_pop(&(self->inbox), &fd)) {
+					struct epoll_event ev;
+					memset(&ev, 0, sizeof(ev));
+					ev.events = EPOLLIN;
+					ev.data.fd = fd;
+					if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+						perror("riassegnando un client al worker");
+						__atomic_sub_fetch(worker_load + workerNumber, 1, __ATOMIC_RELAXED);
+						disconnectClient(fd);
+					}
+					else {
+						events[nserve++].data.fd = fd;
+					}
+				}
+				// Quelli che non ci stanno vengono presi al prossimo giro
+				if (!spsc_is_empty(&(self->inbox)) && eventfd_write(self->wakefd, 1) < 0) {
+					perror("svegliando il worker");
+				}
+			}
+		}
+		for (int e = 0; e < nserve && threads_continue; ++e) {
+			int localfd = events[e].data.fd;
+			if (localfd == TERMINATION_EVENTFD || localfd == self->wakefd) {
+				// Il signal handler ha chiesto la terminazione, e il ciclo
+				// esterno si ferma perché threads_continue è falso, oppure
+				// sono arrivati fd nella inbox, già aggiunti sopra
+				continue;
+			}
+			// Il fd appartiene solo a questo worker, quindi non c'è niente da
+			// restituire: resta nella epoll finché il client non si disconnette
+			client_state_t state = serveClient(localfd, workerNumber);
+			if (state == CLIENT_CLOSED) {
+				__atomic_sub_fetch(worker_load + workerNumber, 1, __ATOMIC_RELAXED);
+			}
+			else if (state == CLIENT_BUSY) {
+				if (nbusy < WORKER_MAX_EVENTS) {
+					busy[nbusy++] = localfd;
+				}
+				else {
+					// Non c'è posto per ricordarlo: lo serve di nuovo subito
+					--e;
+				}
+			}
+			#ifdef DEBUG
+				fprintf(stderr, "%d: Operazione gestita\n", workerNumber);
+			#endif
+		}
+	}
+
+	return NULL;
+}
+
+// Documentata in worker.h
+void* stealing_thread(void* arg) {
+	int workerNumber = *(int*)arg;
+	unsigned int served = 0;
+	int localfd;
+
+	while(threads_continue) {
+		if (!findWork(workerNumber, served, &localfd)) {
+			waitForWork(workerNumber);
+			continue;
+		}
+		++served;
+		client_state_t state = serveClient(localfd, workerNumber);
+		#ifdef DEBUG
+			fprintf(stderr, "%d: Operazione gestita\n", workerNumber);
+		#endif
+		// Se il client ha ancora richieste da servire le serve questo
+		// worker, che ha ancora in cache il suo stato; altrimenti il fd torna
+		// al listener
+		if (state == CLIENT_BUSY) {
+			pushOwnFd(workerNumber, localfd);
+		}
+		else if (state == CLIENT_IDLE) {
+			returnFd(workerNumber, localfd);
+		}
+	}
+
+	return NULL;
+}
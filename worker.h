@@ -22,23 +22,254 @@
 
 #include <assert.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/stat.h>
-#include <sys/mman.h>
 
 #include "connections.h"
 #include "stats.h"
 #include "fifo.h"
+#include "spsc.h"
+#include "deque.h"
+#include "writer.h"
 #include "ops.h"
 #include "hashtable.h"
+#include "broadcast.h"
+#include "online.h"
+#include "filecache.h"
+#include "filestore.h"
 #include "lock.h"
 
 #define TERMINATION_FD -1
 #define FILE_SIZE_FACTOR 1024
+/**
+ * Dimensione dei pezzi in cui viene ricevuto un file con POSTFILE_OP, che è
+ * anche la memoria massima occupata da un upload
+ */
+#define UPLOAD_CHUNK_SIZE 65536
+/**
+ * Numero massimo di eventi restituiti da una singola epoll_wait di un worker
+ */
+#define WORKER_MAX_EVENTS 32
+/**
+ * fd dell'eventfd con cui il signal handler termina i worker in modalità
+ * reactor (non viene mai letto, così resta sempre pronto)
+ */
+#define TERMINATION_EVENTFD (MaxConnections + ThreadsInPool + 2)
+/**
+ * fd dell'epoll del worker i in modalità reactor
+ */
+#define WORKER_EPOLLFD(i) (MaxConnections + ThreadsInPool + 3 + (i))
+/**
+ * fd su cui il thread di I/O i apre il file ricevuto con POSTFILE_OP (quello
+ * dei worker è MaxConnections + numero del worker)
+ */
+#define FILE_THREAD_FD(i) (MaxConnections + 2 * ThreadsInPool + 3 + (i))
+/**
+ * Numero minimo dei fd dei file aperti dalla cache di GETFILE_OP, sopra quelli
+ * dei thread di I/O
+ */
+#define FILE_FD_BASE (MaxConnections + 2 * ThreadsInPool + FileThreadsInPool + 3)
+/**
+ * Numero massimo di file tenuti aperti dalla cache di GETFILE_OP
+ */
+#define FILE_CACHE_ENTRIES 64
+/**
+ * fd dell'epoll in cui sono registrati con EPOLLOUT i client che hanno dati
+ * nella coda di uscita; la ascolta il listener
+ */
+#define OUT_EPOLLFD 6
+/**
+ * Le soglie delle code di uscita sono espresse in KB nel file di
+ * configurazione
+ */
+#define OUT_QUEUE_SIZE_FACTOR 1024
+/**
+ * Ogni quante richieste servite un worker in modalità stealing prende il fd più
+ * vecchio della propria deque invece del più recente, perché un client che
+ * invia molte richieste di fila non blocchi gli altri
+ */
+#define STEALING_FAIRNESS_INTERVAL 16
+
+/**
+ * @brief Modalità con cui le richieste dei client vengono distribuite ai worker
+ */
+typedef enum {
+	DISPATCH_QUEUE = 0,   /**< il listener ascolta tutti i client e passa i fd
+	                           pronti ai worker tramite la coda condivisa */
+	DISPATCH_REACTOR = 1, /**< il listener accetta solo le connessioni e le
+	                           assegna ai worker, ognuno dei quali ascolta i
+	                           propri client con una epoll dedicata */
+	DISPATCH_STEALING = 2 /**< il listener passa i fd pronti al worker meno
+	                           carico; ogni worker ha una deque da cui gli
+	                           altri possono rubare quando sono liberi */
+} dispatch_mode_t;
+
+/**
+ * @brief Stato di un client dopo che un worker ne ha servito le richieste
+ */
+typedef enum {
+	CLIENT_IDLE = 0,  /**< non ci sono altre richieste complete da leggere */
+	CLIENT_BUSY = 1,  /**< il worker ha esaurito il limite di richieste per
+	                       risveglio, ma il client potrebbe averne altre */
+	CLIENT_CLOSED = 2, /**< la connessione è stata chiusa */
+	CLIENT_HANDED_OFF = 3, /**< il client è passato ad un thread di I/O, che
+	                           lo restituirà al listener */
+	CLIENT_PARKED = 4 /**< il client non legge le sue risposte: il fd passa
+	                       al listener, che lo restituisce ai worker quando
+	                       la coda di uscita si svuota */
+} client_state_t;
+
+/**
+ * @brief Cosa fare dei messaggi per un client che non legge abbastanza in
+ * fretta (la cui coda di uscita ha superato OutQueueHighWater)
+ */
+typedef enum {
+	OUT_POLICY_DROP = 0,      /**< i messaggi restano solo nell'history, da
+	                               cui il client può recuperarli con
+	                               GETPREVMSGS_OP; le risposte non si
+	                               scartano, ma il client non viene più
+	                               servito finché non le legge */
+	OUT_POLICY_DISCONNECT = 1 /**< la connessione con il client viene chiusa,
+	                               anche se sono le sue risposte a superare
+	                               la soglia */
+} out_policy_t;
+
+/**
+ * @struct out_queue
+ * @brief Coda di uscita di un client
+ *
+ * Tutte le scritture verso un client passano dalla sua coda con la lock
+ * presa, così i messaggi non si mescolano anche se li inviano thread diversi.
+ * Quello che il socket non accetta subito viene inviato dal listener quando il
+ * client torna a leggere, quindi nessun thread si blocca per un client lento.
+ *
+ * @var struct out_queue::mutex Lock della coda
+ * @var struct out_queue::writer I dati in attesa di essere inviati
+ * @var struct out_queue::registered true se il fd è già stato aggiunto a
+ *                                   OUT_EPOLLFD
+ * @var struct out_queue::congested true se la coda ha superato
+ *                                  OutQueueHighWater e non è ancora scesa
+ *                                  sotto OutQueueLowWater
+ * @var struct out_queue::park_requested true se una risposta ha portato la
+ *                                       coda oltre OutQueueHighWater; lo usa
+ *                                       solo il thread che serve il client
+ * @var struct out_queue::parked true se nessun thread serve il client finché
+ *                               la coda non scende sotto OutQueueLowWater
+ *                               (vedere flush_out_queue)
+ */
+typedef struct out_queue {
+	pthread_mutex_t mutex;
+	msg_writer_t writer;
+	bool registered;
+	bool congested;
+	bool park_requested;
+	bool parked;
+} out_queue_t;
+
+/**
+ * @struct client_session
+ * @brief Sessione di un client, indicizzata per fd
+ *
+ * Il nickname_t viene trovato una sola volta, con la CONNECT_OP (o la
+ * REGISTER_OP), e le richieste successive lo prendono da qui invece di
+ * cercarlo nell'hashtable. Un nickname può essere deregistrato solo dalla
+ * sessione connessa con esso, che prima lo segna come rimosso (vedere
+ * nickname_t::removed), poi si disconnette e infine lo toglie dall'hashtable.
+ * Una CONNECT_OP (o una REGISTER_OP, subito dopo l'inserimento) controlla
+ * removed e fd e occupa il nickname nella stessa sezione con la sua lock,
+ * quindi due client non possono occupare lo stesso nickname e nessuno può
+ * trovare libero un nickname che sta per essere rimosso: finché nick non è
+ * NULL il nickname_t è registrato.
+ *
+ * La sessione viene modificata solo dal worker che serve il fd, con la lock
+ * connected_mutex presa; gli altri thread la leggono solo con connected_mutex.
+ *
+ * @var struct client_session::nick Il nickname_t con cui il client è
+ *                                  connesso, NULL se non è connesso
+ * @var struct client_session::name Il nickname con cui il client è connesso
+ * @var struct client_session::online_pos La posizione del nickname in
+ *                                        online_users
+ * @var struct client_session::presence_sub true se il client ha fatto
+ *                                          PRESENCE_SUB_OP
+ * @var struct client_session::presence_pos La posizione del fd in
+ *                                          presence_subs
+ */
+typedef struct client_session {
+	nickname_t* nick;
+	char name[MAX_NAME_LENGTH + 1];
+	int online_pos;
+	bool presence_sub;
+	int presence_pos;
+} client_session_t;
+
+/**
+ * @struct file_job
+ * @brief Operazione su file passata da un worker ad un thread di I/O
+ *
+ * Ce n'è una per fd: finché il thread di I/O non ha finito il fd non viene
+ * servito da nessun altro.
+ *
+ * @var struct file_job::msg La richiesta (POSTFILE_OP o GETFILE_OP). Il body
+ *                           punta nel buffer di ricezione, che nessuno sposta
+ *                           finché l'operazione non è finita
+ * @var struct file_job::start Quando il worker ha letto la richiesta
+ */
+typedef struct file_job {
+	message_t msg;
+	struct timespec start;
+} file_job_t;
+
+/**
+ * @struct op_class_stats
+ * @brief Statistiche di una classe di richieste (messaggi o file)
+ *
+ * Una richiesta entra nella classe quando un worker la legge ed esce quando ha
+ * ricevuto la risposta; per i file il tempo comprende l'attesa di un thread di
+ * I/O libero. Aggiornate con operazioni atomiche.
+ *
+ * @var struct op_class_stats::pending Richieste entrate ma non ancora finite
+ * @var struct op_class_stats::served Richieste finite
+ * @var struct op_class_stats::total_usec Somma delle durate delle richieste
+ *                                        finite, in microsecondi
+ */
+typedef struct op_class_stats {
+	unsigned long pending;
+	unsigned long served;
+	unsigned long total_usec;
+} op_class_stats_t;
+
+/**
+ * @struct worker_queues
+ * @brief Code di un worker in modalità stealing (in modalità reactor si usano
+ * solo inbox e wakefd)
+ *
+ * @var struct worker_queues::inbox fd passati dal listener al worker (il
+ *                                  listener è l'unico produttore)
+ * @var struct worker_queues::deque fd che il worker deve servire; gli altri
+ *                                  worker possono rubarli
+ * @var struct worker_queues::wake_seq Futex su cui il worker dorme quando non
+ *                                     trova niente da fare
+ * @var struct worker_queues::sleeping 1 se il worker sta per dormire o dorme
+ *                                     su wake_seq
+ * @var struct worker_queues::wakefd In modalità reactor, eventfd nella epoll
+ *                                   del worker che segnala fd nella inbox
+ */
+typedef struct worker_queues {
+	spsc_t inbox;
+	deque_t deque;
+	int wake_seq;
+	int sleeping;
+	int wakefd;
+	char pad[CACHE_LINE_SIZE - 3 * sizeof(int)];
+} worker_queues_t;
 
 /**
  * Struttura che memorizza le statistiche del server, struct statistics
@@ -57,6 +288,17 @@ extern pthread_mutex_t stats_mutex;
 	++chattyStats.statName; \
 	error_handling_unlock(&stats_mutex)
 
+/**
+ * Macro per aumentare le statistiche di più di 1 in modo sicuro
+ *
+ * @param statName il nome della statistica da aumentare
+ * @param n di quanto aumentarla
+ */
+#define addStat(statName, n) \
+	error_handling_lock(&stats_mutex); \
+	chattyStats.statName += (n); \
+	error_handling_unlock(&stats_mutex)
+
 
 /**
  * Coda condivisa che contiene i messaggi
@@ -64,15 +306,27 @@ extern pthread_mutex_t stats_mutex;
 extern fifo_t queue;
 
 /**
- * Array di variabili condivise con il listener, una per ogni vorker
+ * Array di code con cui i worker restituiscono i fd al listener, una per ogni
+ * worker
+ */
+extern spsc_t* returned_fds;
+
+/**
+ * Flag che vale 1 se è già stato scritto sull'eventfd del listener un
+ * risveglio che non è ancora stato gestito
+ */
+extern int listener_wakeup_pending;
+
+/**
+ * Carico di ogni worker: in modalità reactor il numero di client assegnati, in
+ * modalità stealing il numero di fd in attesa nelle sue code
  */
-extern int* freefd;
-extern char* freefd_ack;
+extern int* worker_load;
 
 /**
- * Tid del signal handler
+ * Code dei worker in modalità stealing, una per ogni worker
  */
-extern pthread_t signal_handler;
+extern worker_queues_t* worker_queues;
 
 /**
  * Variabile globale per interrompere i cicli infiniti dei thread
@@ -85,20 +339,90 @@ extern bool threads_continue;
 extern htable_t* nickname_htable;
 
 /**
- * Informazioni sui client connessi
+ * Registro dei messaggi inviati a tutti
+ */
+extern bcast_log_t broadcasts;
+
+/**
+ * Elenco dei nickname connessi
+ */
+extern online_list_t online_users;
+
+/**
+ * Cache dei file aperti per GETFILE_OP
+ */
+extern file_cache_t file_cache;
+/**
+ * Archivio dei file ricevuti con POSTFILE_OP
+ */
+extern file_store_t file_store;
+
+/**
+ * Coda dei fd con un'operazione su file per i thread di I/O, e le operazioni
+ * (indicizzate per fd)
+ */
+extern fifo_t file_queue;
+extern file_job_t* file_jobs;
+
+/**
+ * Statistiche delle richieste di messaggi e di quelle su file
+ */
+extern op_class_stats_t msg_class_stats;
+extern op_class_stats_t file_class_stats;
+
+/**
+ * Contatore da cui vengono presi i numeri di sequenza dei messaggi salvati,
+ * sia nelle history che in broadcasts
+ */
+extern unsigned long msg_seq;
+
+/**
+ * Informazioni sui client connessi. num_connected conta i client che hanno
+ * fatto una CONNECT_OP (o REGISTER_OP), num_clients tutte le connessioni
+ * aperte che il listener ha accettato.
  */
 extern int num_connected;
-extern char** fd_to_nickname;
+extern int num_clients;
+
+/**
+ * Sessioni dei client, indicizzate per fd
+ */
+extern client_session_t* fd_sessions;
+
+/**
+ * fd dei client che ricevono i cambiamenti della lista dei connessi
+ * (PRESENCE_SUB_OP), senza buchi. Protetti da connected_mutex.
+ */
+extern int* presence_subs;
+extern int num_presence_subs;
+
+/**
+ * Stato di lettura dei messaggi di ogni client, indicizzato per fd. È usato
+ * solo dal worker che sta servendo quel fd.
+ */
+extern msg_reader_t* fd_readers;
 extern pthread_mutex_t connected_mutex;
 
+/**
+ * Code di uscita dei client, indicizzate per fd
+ */
+extern out_queue_t* fd_outqueues;
+
 /**
  * Costanti globali lette dal file di configurazione
  */
 extern int ThreadsInPool;
+extern int FileThreadsInPool;
 extern int MaxHistMsgs;
 extern int MaxMsgSize;
 extern int MaxFileSize;
 extern int MaxConnections;
+extern int EpollEdgeTriggered;
+extern int MaxMsgsPerWakeup;
+extern int OutQueueHighWater;
+extern int OutQueueLowWater;
+extern out_policy_t OutQueuePolicy;
+extern dispatch_mode_t DispatchMode;
 extern char* DirName;
 extern char* StatFileName;
 extern char* UnixPath;
@@ -114,4 +438,77 @@ extern char* UnixPath;
  */
 void* worker_thread(void* arg);
 
+/**
+ * @brief main di un thread worker in modalità reactor
+ *
+ * Ogni worker ha una propria epoll (WORKER_EPOLLFD) in cui il listener
+ * registra i client che gli assegna. Il worker serve le richieste di quei
+ * client direttamente, senza passare dalla coda condivisa, finché non si
+ * disconnettono.
+ *
+ * @param arg il proprio numero d'indice
+ */
+void* reactor_thread(void* arg);
+
+/**
+ * @brief main di un thread worker in modalità stealing
+ *
+ * Il worker serve prima i fd della propria deque, dove sposta anche quelli
+ * ricevuti dal listener. Se il client ha ancora richieste quando si esaurisce
+ * il limite di MaxMsgsPerWakeup il fd torna in fondo alla deque invece che al
+ * listener, così viene servito di nuovo dallo stesso worker. Quando la propria deque è vuota il
+ * worker ruba dalle altre, e se non trova niente dorme finché il listener o un
+ * altro worker non lo sveglia.
+ *
+ * @param arg il proprio numero d'indice
+ */
+void* stealing_thread(void* arg);
+
+/**
+ * @brief main di un thread di I/O, che esegue le operazioni su file
+ *
+ * Se FileThreadsInPool > 0 i worker, dopo aver controllato il mittente, non
+ * eseguono POSTFILE_OP e GETFILE_OP ma passano il fd ad un thread di I/O
+ * tramite file_queue. Finita l'operazione il fd torna al listener, che lo
+ * tratta come pronto (potrebbe avere altre richieste già nel buffer di
+ * ricezione). Così i trasferimenti lunghi occupano al più FileThreadsInPool
+ * thread e non rallentano i messaggi.
+ *
+ * @param arg il proprio numero d'indice
+ */
+void* file_thread(void* arg);
+
+/**
+ * @brief Sveglia un worker in modalità stealing se sta dormendo
+ *
+ * Va chiamata dopo aver reso visibile il lavoro per quel worker (o dopo aver
+ * azzerato threads_continue).
+ *
+ * @param workerNumber il worker da svegliare
+ * @return true se il worker stava dormendo
+ */
+bool wake_worker(int workerNumber);
+
+/**
+ * @brief Disconnette il client sul fd passato e chiude il fd
+ *
+ * Il fd deve essere gestito in esclusiva dal thread chiamante.
+ *
+ * @param fd il fd del client
+ */
+void disconnectClient(int fd);
+
+/**
+ * @brief Invia quanto possibile della coda di uscita di un client
+ *
+ * La chiama il listener quando OUT_EPOLLFD segnala che il socket del client è
+ * di nuovo scrivibile. Se resta qualcosa in coda il fd viene riarmato.
+ *
+ * @param fd il fd del client
+ * @return true se il client era parcheggiato e la coda è scesa sotto
+ *         OutQueueLowWater (o il client si è disconnesso): il fd va passato di
+ *         nuovo ai worker come se avesse richieste pronte
+ */
+bool flush_out_queue(int fd);
+
 #endif
@@ -0,0 +1,324 @@
+/**
+ * @file writer.c
+ * @brief Implementazione di writer.h
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+
+#include "writer.h"
+
+// ------------------ Funzioni interne ---------------
+
+/**
+* @brief Scrive quanto possibile di una sequenza di buffer senza bloccarsi
+*
+* Come la scrittura di sendRequest, ma invece di aspettare quando il socket è
+* pieno ritorna, lasciando iov e iovcnt sui dati non ancora scritti.
+*
+* @param fd il descrittore di file su cui scrivere (con O_NONBLOCK)
+* @param iov puntatore ai buffer da scrivere, viene avanzato
+* @param iovcnt puntatore al numero di buffer, viene aggiornato
+*
+* @return il numero di byte scritti, < 0 in caso di errore (e imposta errno)
+*/
+static ssize_t writeIov(long fd, struct iovec** iov, int* iovcnt) {
+	ssize_t total = 0;
+	while (true) {
+		while (*iovcnt > 0 && (*iov)->iov_len == 0) {
+			++(*iov);
+			--(*iovcnt);
+		}
+		if (*iovcnt == 0)
+			return total;
+		ssize_t byte_written = writev(fd, *iov, *iovcnt < SEND_MAX_IOV ? *iovcnt : SEND_MAX_IOV);
+		if (byte_written < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return total;
+			errno = EPIPE;
+			return -1;
+		}
+		if (byte_written == 0)
+			return total;
+		total += byte_written;
+		skipIov(iov, iovcnt, byte_written);
+	}
+}
+
+/**
+* @brief Scrive quanto possibile di una parte di un file senza bloccarsi
+*
+* @param fd il descrittore di file su cui scrivere (con O_NONBLOCK)
+* @param filefd il file da inviare
+* @param offset la posizione da cui inviare, viene avanzata
+* @param len il numero di byte da inviare
+*
+* @return il numero di byte scritti, < 0 in caso di errore (e imposta errno)
+*/
+static ssize_t writeFile(long fd, int filefd, off_t* offset, size_t len) {
+	ssize_t total = 0;
+	while ((size_t)total < len) {
+		ssize_t byte_written = sendfile(fd, filefd, offset, len - total);
+		if (byte_written < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return total;
+			errno = EPIPE;
+			return -1;
+		}
+		if (byte_written == 0) {
+			// Il file è più corto della lunghezza già inviata nell'header:
+			// il messaggio non si può più completare
+			errno = EPIPE;
+			return -1;
+		}
+		total += byte_written;
+	}
+	return total;
+}
+
+/**
+* @brief Aggiunge un pezzo in fondo alla coda
+*/
+static void appendChunk(msg_writer_t* writer, out_chunk_t* chunk) {
+	chunk->next = NULL;
+	chunk->sent = 0;
+	if (writer->tail == NULL)
+		writer->head = chunk;
+	else
+		writer->tail->next = chunk;
+	writer->tail = chunk;
+	writer->pending += chunk->len;
+}
+
+/**
+* @brief Copia in coda i buffer non ancora scritti
+*
+* @param writer la coda di invio della connessione
+* @param iov i buffer da copiare
+* @param iovcnt il numero di buffer
+*
+* @return 0 in caso di successo, < 0 se non c'è abbastanza memoria
+*/
+static int queueIov(msg_writer_t* writer, struct iovec* iov, int iovcnt) {
+	size_t left = 0;
+	for (int i = 0; i < iovcnt; ++i)
+		left += iov[i].iov_len;
+	if (left == 0)
+		return 0;
+	out_chunk_t* chunk = malloc(sizeof(out_chunk_t) + left);
+	if (chunk == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	chunk->len = left;
+	chunk->filefd = -1;
+	chunk->offset = 0;
+	size_t p = 0;
+	for (int i = 0; i < iovcnt; ++i) {
+		memcpy(chunk->data + p, iov[i].iov_base, iov[i].iov_len);
+		p += iov[i].iov_len;
+	}
+	appendChunk(writer, chunk);
+	return 0;
+}
+
+/**
+* @brief Mette in coda la parte di un file non ancora inviata
+*
+* Il pezzo usa un duplicato del fd; se non è possibile crearlo la parte viene
+* letta in memoria.
+*
+* @param writer la coda di invio della connessione
+* @param filefd il file
+* @param offset la posizione del primo byte da inviare
+* @param len il numero di byte da inviare
+*
+* @return 0 in caso di successo, < 0 in caso di errore (e imposta errno)
+*/
+static int queueFile(msg_writer_t* writer, int filefd, off_t offset, size_t len) {
+	if (len == 0)
+		return 0;
+	int dupfd = fcntl(filefd, F_DUPFD, filefd);
+	out_chunk_t* chunk = malloc(sizeof(out_chunk_t) + (dupfd < 0 ? len : 0));
+	if (chunk == NULL) {
+		if (dupfd >= 0)
+			close(dupfd);
+		errno = ENOMEM;
+		return -1;
+	}
+	chunk->len = len;
+	chunk->filefd = dupfd;
+	chunk->offset = offset;
+	if (dupfd < 0) {
+		size_t p = 0;
+		while (p < len) {
+			ssize_t r = pread(filefd, chunk->data + p, len - p, offset + p);
+			if (r < 0 && errno == EINTR)
+				continue;
+			if (r <= 0) {
+				free(chunk);
+				errno = EIO;
+				return -1;
+			}
+			p += r;
+		}
+	}
+	appendChunk(writer, chunk);
+	return 0;
+}
+
+/**
+* @brief Invia una sequenza di buffer passando dalla coda di invio
+*
+* @param fd il descrittore di file su cui scrivere (con O_NONBLOCK)
+* @param writer la coda di invio della connessione
+* @param iov i buffer da inviare, in ordine. L'array viene modificato
+* @param iovcnt il numero di buffer
+*
+* @return il numero di byte rimasti in coda, < 0 in caso di errore
+*/
+static ssize_t sendIovNonBlocking(long fd, msg_writer_t* writer, struct iovec* iov, int iovcnt) {
+	bool queued = writer->head != NULL;
+	// Se c'è già qualcosa in coda i nuovi dati vanno dopo, altrimenti si
+	// mescolerebbero con quelli vecchi
+	if (!queued && writeIov(fd, &iov, &iovcnt) < 0)
+		return -1;
+	if (queueIov(writer, iov, iovcnt) < 0)
+		return -1;
+	// La coda era già piena dall'ultimo tentativo: riprova, nel frattempo il
+	// client potrebbe aver letto qualcosa
+	return queued ? flushWriter(fd, writer) : (ssize_t)writer->pending;
+}
+
+// ------- Funzioni esportate --------------
+// Documentate in writer.h
+
+ssize_t sendMsgsNonBlocking(long fd, msg_writer_t* writer, message_t **msgs, int n) {
+	struct iovec iov_small[3];
+	struct iovec* iov = n == 1 ? iov_small : malloc(3 * n * sizeof(struct iovec));
+	if (iov == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	for (int i = 0; i < n; ++i)
+		msgToIov(iov + 3 * i, msgs[i]);
+	ssize_t result = sendIovNonBlocking(fd, writer, iov, 3 * n);
+	if (iov != iov_small)
+		free(iov);
+	return result;
+}
+
+ssize_t sendHeaderNonBlocking(long fd, msg_writer_t* writer, message_hdr_t *hdr) {
+	struct iovec iov;
+	iov.iov_base = hdr;
+	iov.iov_len = sizeof(message_hdr_t);
+	return sendIovNonBlocking(fd, writer, &iov, 1);
+}
+
+ssize_t sendFileNonBlocking(long fd, msg_writer_t* writer, message_t* msg, int filefd) {
+	struct iovec iov_buf[2];
+	iov_buf[0].iov_base = &(msg->hdr);
+	iov_buf[0].iov_len = sizeof(message_hdr_t);
+	iov_buf[1].iov_base = &(msg->data.hdr);
+	iov_buf[1].iov_len = sizeof(message_data_hdr_t);
+	struct iovec* iov = iov_buf;
+	int iovcnt = 2;
+	off_t offset = 0;
+	bool queued = writer->head != NULL;
+	if (!queued) {
+		if (writeIov(fd, &iov, &iovcnt) < 0)
+			return -1;
+		// Il file si può iniziare ad inviare solo dopo tutti gli header
+		if (iovcnt == 0 && writeFile(fd, filefd, &offset, msg->data.hdr.len) < 0)
+			return -1;
+	}
+	if (queueIov(writer, iov, iovcnt) < 0
+		|| queueFile(writer, filefd, offset, msg->data.hdr.len - offset) < 0)
+		return -1;
+	return queued ? flushWriter(fd, writer) : (ssize_t)writer->pending;
+}
+
+ssize_t flushWriter(long fd, msg_writer_t* writer) {
+	while (writer->head != NULL) {
+		out_chunk_t* head = writer->head;
+		if (head->filefd >= 0) {
+			// Parte di un file, inviata senza copiarla
+			off_t offset = head->offset + head->sent;
+			ssize_t byte_written = writeFile(fd, head->filefd, &offset, head->len - head->sent);
+			if (byte_written < 0)
+				return -1;
+			writer->pending -= byte_written;
+			head->sent += byte_written;
+			if (head->sent < head->len)
+				// Il socket è pieno
+				break;
+			close(head->filefd);
+			writer->head = head->next;
+			free(head);
+			if (writer->head == NULL)
+				writer->tail = NULL;
+			continue;
+		}
+		// Scrive più pezzi in memoria con una sola writev
+		struct iovec iov_buf[FLUSH_MAX_IOV];
+		int iovcnt = 0;
+		for (out_chunk_t* c = writer->head; c != NULL && c->filefd < 0 && iovcnt < FLUSH_MAX_IOV; c = c->next) {
+			iov_buf[iovcnt].iov_base = c->data + c->sent;
+			iov_buf[iovcnt].iov_len = c->len - c->sent;
+			++iovcnt;
+		}
+		struct iovec* iov = iov_buf;
+		ssize_t byte_written = writeIov(fd, &iov, &iovcnt);
+		if (byte_written < 0)
+			return -1;
+		writer->pending -= byte_written;
+		// Libera i pezzi inviati del tutto
+		while (byte_written > 0) {
+			out_chunk_t* c = writer->head;
+			size_t left = c->len - c->sent;
+			if ((size_t)byte_written < left) {
+				c->sent += byte_written;
+				break;
+			}
+			byte_written -= left;
+			writer->head = c->next;
+			free(c);
+		}
+		if (writer->head == NULL)
+			writer->tail = NULL;
+		if (iovcnt > 0)
+			// Il socket è pieno
+			break;
+	}
+	return writer->pending;
+}
+
+void resetWriter(msg_writer_t* writer) {
+	while (writer->head != NULL) {
+		out_chunk_t* c = writer->head;
+		writer->head = c->next;
+		if (c->filefd >= 0)
+			close(c->filefd);
+		free(c);
+	}
+	writer->tail = NULL;
+	writer->pending = 0;
+}
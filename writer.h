@@ -0,0 +1,144 @@
+/**
+ * @file writer.h
+ * @brief Coda di invio per le connessioni non bloccanti del server
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera
+ * originale dell'autore.
+ *
+ * @author Flavio Ascari
+ *		 550341
+ *       flavio.ascari@sns.it
+ */
+#ifndef CHATTERBOX_WRITER_H_
+#define CHATTERBOX_WRITER_H_
+
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "connections.h"
+#include "message.h"
+
+#define FLUSH_MAX_IOV 64 /**< numero massimo di pezzi in coda inviati con una
+                              sola writev da flushWriter */
+
+/**
+ * @struct out_chunk
+ * @brief Dati in attesa di essere inviati su una connessione non bloccante
+ *
+ * Un pezzo può essere in memoria (in data) oppure una parte di un file, che
+ * viene inviata con sendfile senza passare dallo spazio utente.
+ *
+ * @var struct out_chunk::next Il pezzo successivo nella coda
+ * @var struct out_chunk::len Numero di byte del pezzo
+ * @var struct out_chunk::sent Numero di byte del pezzo già inviati
+ * @var struct out_chunk::filefd Il fd del file, che appartiene al pezzo; -1
+ *                               per i pezzi in memoria
+ * @var struct out_chunk::offset La posizione nel file del primo byte del pezzo
+ * @var struct out_chunk::data I dati, per i pezzi in memoria
+ */
+typedef struct out_chunk {
+	struct out_chunk* next;
+	size_t len;
+	size_t sent;
+	int filefd;
+	off_t offset;
+	char data[];
+} out_chunk_t;
+
+/**
+ * @struct msg_writer
+ * @brief Coda di invio di una connessione non bloccante
+ *
+ * È il duale di msg_reader_t: i messaggi vengono scritti subito finché il
+ * socket li accetta, e solo quello che non ci sta viene copiato in coda per
+ * essere inviato più tardi con flushWriter. Una struttura azzerata (ad esempio
+ * con calloc) è pronta all'uso. Non è thread safe.
+ *
+ * @var struct msg_writer::head Il primo pezzo da inviare
+ * @var struct msg_writer::tail L'ultimo pezzo da inviare
+ * @var struct msg_writer::pending Numero di byte in coda non ancora inviati
+ */
+typedef struct msg_writer {
+	out_chunk_t* head;
+	out_chunk_t* tail;
+	size_t pending;
+} msg_writer_t;
+
+/**
+ * @function sendMsgsNonBlocking
+ * @brief Invia dei messaggi su una connessione non bloccante senza aspettare
+ *
+ * Se la coda è vuota i messaggi vengono scritti subito con writev; quello che
+ * il socket non accetta viene copiato in coda dopo i dati già presenti, quindi
+ * l'ordine è sempre rispettato. I buffer dei messaggi possono essere riusati
+ * appena la funzione ritorna.
+ *
+ * @param fd     descrittore della connessione (con O_NONBLOCK)
+ * @param writer coda di invio associata alla connessione
+ * @param msgs   array di puntatori ai messaggi da inviare, in ordine
+ * @param n      numero di messaggi
+ *
+ * @return il numero di byte rimasti in coda (0 se è stato inviato tutto),
+ *         < 0 in caso di errore (e imposta errno)
+ */
+ssize_t sendMsgsNonBlocking(long fd, msg_writer_t* writer, message_t **msgs, int n);
+
+/**
+ * @function sendHeaderNonBlocking
+ * @brief Come sendMsgsNonBlocking, ma invia solo un header
+ *
+ * @param fd     descrittore della connessione (con O_NONBLOCK)
+ * @param writer coda di invio associata alla connessione
+ * @param hdr    puntatore all'header da inviare
+ *
+ * @return il numero di byte rimasti in coda (0 se è stato inviato tutto),
+ *         < 0 in caso di errore (e imposta errno)
+ */
+ssize_t sendHeaderNonBlocking(long fd, msg_writer_t* writer, message_hdr_t *hdr);
+
+/**
+ * @function sendFileNonBlocking
+ * @brief Invia un messaggio il cui body è un intero file, senza copiarlo
+ *
+ * L'header e l'header dei dati (msg->data.buf viene ignorato, msg->data.hdr.len
+ * deve essere la dimensione del file) passano dalla coda come in
+ * sendMsgsNonBlocking; il file viene inviato con sendfile direttamente dalla
+ * page cache. Quello che il socket non accetta subito resta in coda come
+ * riferimento al file (con un duplicato di filefd, sopra filefd) e viene
+ * inviato da flushWriter. Il chiamante può chiudere filefd appena la funzione
+ * ritorna.
+ *
+ * @param fd     descrittore della connessione (con O_NONBLOCK)
+ * @param writer coda di invio associata alla connessione
+ * @param msg    il messaggio con gli header
+ * @param filefd descrittore del file, aperto in lettura
+ *
+ * @return il numero di byte rimasti in coda (0 se è stato inviato tutto),
+ *         < 0 in caso di errore (e imposta errno)
+ */
+ssize_t sendFileNonBlocking(long fd, msg_writer_t* writer, message_t* msg, int filefd);
+
+/**
+ * @function flushWriter
+ * @brief Invia quanto possibile dei dati in coda senza bloccarsi
+ *
+ * @param fd     descrittore della connessione (con O_NONBLOCK)
+ * @param writer coda di invio associata alla connessione
+ *
+ * @return il numero di byte rimasti in coda (0 se è stato inviato tutto),
+ *         < 0 in caso di errore (e imposta errno)
+ */
+ssize_t flushWriter(long fd, msg_writer_t* writer);
+
+/**
+ * @function resetWriter
+ * @brief Scarta i dati in coda di una connessione
+ *
+ * Come resetReader, va chiamata quando la connessione viene chiusa. Chiude i
+ * file dei pezzi in coda.
+ *
+ * @param writer la coda di invio da azzerare
+ */
+void resetWriter(msg_writer_t* writer);
+
+#endif /* CHATTERBOX_WRITER_H_ */